@@ -0,0 +1,3 @@
+# builds the benchmark harness (see bench/bench.cpp), takes the same engine flags as build.sh
+# e.g. ./bench.sh -D METAVM_THREADED_DISPATCH && ./build/metavm-bench --json > bench.json
+g++ $(ls ./src/*.cpp | grep -v main.cpp) ./bench/*.cpp -o ./build/metavm-bench -fno-exceptions -fno-rtti -I./src -I./inc -I./inc/achilles -W -Wall -O3 -g3 -pthread "$@"
@@ -0,0 +1,257 @@
+#include <chrono>
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "metavm.hpp"
+#include "corpus.hpp"
+
+// runs the corpus (see corpus.cpp) on the engine this binary was built with:
+//
+//  metavm-bench [--json] [--warmup N] [--repetitions N] [--unverified] [--fuse] [--jit] [name...]
+//
+// every benchmark is decoded once, run `warmup` times untimed and then
+// `repetitions` times, the reported rates come from the median repetition
+// cycles are reference cycles from the time stamp counter, not core clocks
+
+constexpr u64 BENCHMARK_MAX_REPETITIONS = 100;
+
+struct BenchOptions {
+    bool            json = false;
+    u64           warmup = 1;
+    u64      repetitions = 5;
+    bool      unverified = false;
+    bool            fuse = false;
+    bool             jit = false;
+    char         **names = nullptr;
+    u64        nameCount = 0;
+};
+
+struct BenchResult {
+    VMBenchmarkProgram program;
+    f64      seconds[BENCHMARK_MAX_REPETITIONS];
+    u64       cycles[BENCHMARK_MAX_REPETITIONS];
+    u64     repetitions;
+    u64     superinstructions;
+};
+
+static char const *getDispatchName() {
+#if defined(METAVM_THREADED_DISPATCH)
+    return "threaded";
+#else
+    return "switch";
+#endif
+}
+
+template<typename T>
+static T median(T *values, u64 count) {
+    // repetitions are few, insertion sort is plenty
+    for (u64 i = 1; i < count; ++i) {
+        T value = values[i];
+        u64 j = i;
+        for (; j > 0 && values[j - 1] > value; --j) {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+    return values[count / 2];
+}
+
+static bool isSelected(BenchOptions const &options, char const *name) {
+    if (options.nameCount == 0) return true;
+    for (u64 i = 0; i < options.nameCount; ++i) {
+        if (std::strcmp(options.names[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        char const *argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argument, "--json") == 0) {
+            options.json = true;
+        } else if (std::strcmp(argument, "--warmup") == 0 && hasValue) {
+            options.warmup = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argument, "--repetitions") == 0 && hasValue) {
+            options.repetitions = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argument, "--unverified") == 0) {
+            options.unverified = true;
+        } else if (std::strcmp(argument, "--fuse") == 0) {
+            options.fuse = true;
+        } else if (std::strcmp(argument, "--jit") == 0) {
+#if defined(METAVM_JIT)
+            options.jit = true;
+#else
+            std::fprintf(stderr, "--jit needs a build with -D METAVM_JIT\n");
+            return false;
+#endif
+        } else if (argument[0] == '-') {
+            std::fprintf(stderr, "unknown option %s\n", argument);
+            return false;
+        } else {
+            // names follow the options
+            options.names = &argv[i];
+            options.nameCount = argc - i;
+            break;
+        }
+    }
+
+    if (options.repetitions == 0 || options.repetitions > BENCHMARK_MAX_REPETITIONS) {
+        std::fprintf(stderr, "repetitions must be between 1 and %llu\n", BENCHMARK_MAX_REPETITIONS);
+        return false;
+    }
+    return true;
+}
+
+static bool runBenchmark(VMBenchmark const &benchmark, BenchOptions const &options, BenchResult &result) {
+    using TCode = static_array<VMInstruction, BENCHMARK_MAX_LENGTH>;
+    using TStream = static_array<u8, KB(1)>;
+    using TDecoded = static_array<VMDecodedInstruction, BENCHMARK_MAX_LENGTH + 1>;
+    using TConstants = static_array<VMWord, BENCHMARK_MAX_LENGTH * 3>;
+    using TMemory = static_array<u8, BENCHMARK_MAX_MEMORY>;
+    using TExceptions = static_array<VMException, 16>;
+
+    TCode code {};
+    TStream stream {};
+    TDecoded decoded {};
+    TConstants constants {};
+    static TMemory memory {};
+
+    auto codeView = code.view(0, code.size());
+    benchmark.build(codeView, result.program);
+
+    VMBenchmarkProgram const &built = result.program;
+    auto programView = code.view(0, built.length);
+    auto streamView = stream.view(0, stream.size());
+    auto memoryView = memory.view(0, built.memorySize);
+
+    u64 streamLength = 0;
+    if (!encodeBytecode(programView, streamView, streamLength)) {
+        std::fprintf(stderr, "%s: failed to encode bytecode\n", benchmark.name);
+        return false;
+    }
+
+    VMProgram program { decoded.arrayView(), constants.arrayView(), false, false };
+    VMDecodeStatus status = decodeBytecode(streamView, streamLength, program);
+    if (status != VMDECODE_OK) {
+        std::fprintf(stderr, "%s: failed to decode bytecode: %s\n", benchmark.name, getDecodeStatusName(status));
+        return false;
+    }
+
+    if (!options.unverified) {
+        VMVerifyResult verification = verifyProgram(program);
+        if (verification.status != VMVERIFY_OK) {
+            std::fprintf(stderr, "%s: failed to verify instruction %llu: %s\n",
+                benchmark.name, verification.index, getVerifyStatusName(verification.status));
+            return false;
+        }
+    }
+
+    result.superinstructions = options.fuse ? fuseProgram(program) : 0;
+
+#if defined(METAVM_JIT)
+    static_array<VMJitEntry, BENCHMARK_MAX_LENGTH + 1> entries {};
+    auto entriesView = entries.view(0, program.code.length());
+    VMJit jit { program, entriesView };
+#endif
+
+    result.repetitions = options.repetitions;
+    for (u64 i = 0; i < options.warmup + options.repetitions; ++i) {
+        TExceptions exceptions {};
+        auto exceptionsView = exceptions.arrayView();
+        MetaVM vm { program, memoryView, exceptionsView };
+#if defined(METAVM_JIT)
+        if (options.jit) vm.attachJit(&jit);
+#endif
+
+        auto start = std::chrono::steady_clock::now();
+        u64 startCycles = readTimestamp();
+        vm.run();
+        u64 cycles = readTimestamp() - startCycles;
+        std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+
+        // a wrong result makes the timing worthless, stop right away
+        VMWord value = vm.getRegisters().data[built.resultRegister];
+        if (exceptionsView.length() != 0 || value.u != built.result.u) {
+            std::fprintf(stderr, "%s: unexpected result 0x%llx in r%u (expected 0x%llx), %llu exceptions\n",
+                benchmark.name, value.u, built.resultRegister, built.result.u, exceptionsView.length());
+            return false;
+        }
+
+        if (i >= options.warmup) {
+            result.seconds[i - options.warmup] = elapsed.count();
+            result.cycles[i - options.warmup] = cycles;
+        }
+    }
+
+    return true;
+}
+
+static void printResult(VMBenchmark const &benchmark, BenchOptions const &options, BenchResult &result, bool first) {
+    f64 minimum = result.seconds[0];
+    f64 maximum = result.seconds[0];
+    for (u64 i = 1; i < result.repetitions; ++i) {
+        if (result.seconds[i] < minimum) minimum = result.seconds[i];
+        if (result.seconds[i] > maximum) maximum = result.seconds[i];
+    }
+    f64 seconds = median(result.seconds, result.repetitions);
+    u64 cycles = median(result.cycles, result.repetitions);
+
+    f64 executed = (f64) result.program.executed;
+    f64 perSecond = executed / seconds;
+    f64 nanoseconds = seconds * 1e9 / executed;
+    f64 cyclesPerInstruction = cycles / executed;
+
+    if (!options.json) {
+        std::printf("%-16s %12llu %14.0f %10.3f %12.3f\n",
+            benchmark.name, result.program.executed, perSecond, nanoseconds, cyclesPerInstruction);
+        return;
+    }
+
+    std::printf("%s\n    {\n", first ? "" : ",");
+    std::printf("      \"name\": \"%s\",\n", benchmark.name);
+    std::printf("      \"instructions\": %llu,\n", result.program.executed);
+    std::printf("      \"superinstructions\": %llu,\n", result.superinstructions);
+    std::printf("      \"repetitions\": %llu,\n", result.repetitions);
+    std::printf("      \"seconds\": { \"min\": %.9f, \"median\": %.9f, \"max\": %.9f },\n", minimum, seconds, maximum);
+    std::printf("      \"instructions_per_second\": %.1f,\n", perSecond);
+    std::printf("      \"ns_per_instruction\": %.4f,\n", nanoseconds);
+    std::printf("      \"cycles_per_instruction\": %.4f\n", cyclesPerInstruction);
+    std::printf("    }");
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options {};
+    if (!parseOptions(argc, argv, options)) return 2;
+
+    if (options.json) {
+        std::printf("{\n");
+        std::printf("  \"dispatch\": \"%s\",\n", getDispatchName());
+        std::printf("  \"verified\": %s,\n", options.unverified ? "false" : "true");
+        std::printf("  \"fused\": %s,\n", options.fuse ? "true" : "false");
+        std::printf("  \"jit\": %s,\n", options.jit ? "true" : "false");
+        std::printf("  \"warmup\": %llu,\n", options.warmup);
+        std::printf("  \"benchmarks\": [");
+    } else {
+        std::printf("dispatch: %s, verified: %s, fused: %s, jit: %s\n", getDispatchName(),
+            options.unverified ? "no" : "yes", options.fuse ? "yes" : "no", options.jit ? "yes" : "no");
+        std::printf("%-16s %12s %14s %10s %12s\n", "benchmark", "instructions", "inst/s", "ns/inst", "cycles/inst");
+    }
+
+    static BenchResult result;
+    bool first = true;
+    for (u64 i = 0; i < benchmarkCount; ++i) {
+        VMBenchmark const &benchmark = benchmarks[i];
+        if (!isSelected(options, benchmark.name)) continue;
+
+        if (!runBenchmark(benchmark, options, result)) return 1;
+        printResult(benchmark, options, result, first);
+        std::fflush(stdout);
+        first = false;
+    }
+
+    if (options.json) {
+        std::printf("\n  ]\n}\n");
+    }
+}
@@ -0,0 +1,295 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "corpus.hpp"
+
+// every benchmark runs for ten to twenty million instructions, enough to
+// drown out decoding and setup while a repetition stays well under a second
+
+static VMOperand reg(u8 index, VMOperandSize size = VMOPSIZE_QWORD) {
+    VMOperand operand {};
+    operand.type = VMOPTYPE_REGISTER;
+    operand.size = size;
+    operand.registerIndex = index;
+    return operand;
+}
+
+static VMOperand imm(VMWord value, VMOperandSize size = VMOPSIZE_QWORD) {
+    VMOperand operand {};
+    operand.type = VMOPTYPE_IMMEDIATE;
+    operand.size = size;
+    operand.value = value;
+    return operand;
+}
+
+static VMOperand vector(u8 index, VMOperandSize size) {
+    VMOperand operand {};
+    operand.type = VMOPTYPE_VECTOR;
+    operand.size = size;
+    operand.registerIndex = index;
+    return operand;
+}
+
+static VMOperand indirect(u8 index) {
+    VMOperand operand {};
+    operand.type = VMOPTYPE_INDIRECT;
+    operand.size = VMOPSIZE_QWORD;
+    operand.registerIndex = index;
+    return operand;
+}
+
+static VMOperand displaced(u8 index, s64 displacement) {
+    VMOperand operand {};
+    operand.type = VMOPTYPE_DISPLACEMENT;
+    operand.size = VMOPSIZE_QWORD;
+    operand.registerIndex = index;
+    operand.value.s = displacement;
+    return operand;
+}
+
+struct ProgramWriter {
+    memory_view<VMInstruction> &code;
+    u64 length;
+
+    // returns the address of the emitted instruction
+    u64 emit(VMOPCode opcode, VMOperand operand1 = {}, VMOperand operand2 = {}, VMOperand operand3 = {}) {
+        code[length] = { opcode, operand1, operand2, operand3 };
+        return length++;
+    }
+};
+
+// r0 counts to N
+static void buildLoop(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 iterations = 10000000;
+    ProgramWriter writer { code, 0 };
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    u64 loop = writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JLT, imm(loop), reg(0), imm(iterations));
+
+    program = { writer.length, 1 + 2 * iterations + 1, 0, iterations, KB(1) };
+}
+
+// r2 sums 1.0 N times while r3 decays geometrically
+static void buildFloat(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 iterations = 5000000;
+    ProgramWriter writer { code, 0 };
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    writer.emit(VMOPCODE_MOV, imm(1.0), reg(1));
+    writer.emit(VMOPCODE_MOV, imm(1.0), reg(3));
+    u64 loop = writer.emit(VMOPCODE_ADDF, reg(2), reg(1), reg(2));
+    writer.emit(VMOPCODE_MULF, reg(3), imm(0.9999999), reg(3));
+    writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JLT, imm(loop), reg(0), imm(iterations));
+
+    program = { writer.length, 3 + 4 * iterations + 1, 2, (f64) iterations, KB(1) };
+}
+
+// halves the distance of r1 to 2.0 until it's within a tolerance, r0 counts
+// the steps, the distance goes below zero on odd steps so the loop test is a
+// float one on its square
+static void buildConverge(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 rounds = 80000;
+    ProgramWriter writer { code, 0 };
+
+    // the steps one round takes, as the VM computes them
+    u64 steps = 0;
+    for (f64 x = 0.0, distance = 2.0; distance * distance > 1e-24; ++steps) {
+        x += distance * 1.5;
+        distance = 2.0 - x;
+    }
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(4));
+    u64 round = writer.emit(VMOPCODE_MOV, imm(0.0), reg(1));
+    writer.emit(VMOPCODE_MOV, imm(2.0), reg(2));
+    u64 loop = writer.emit(VMOPCODE_MULF, reg(2), imm(1.5), reg(3));
+    writer.emit(VMOPCODE_ADDF, reg(1), reg(3), reg(1));
+    writer.emit(VMOPCODE_SUBF, imm(2.0), reg(1), reg(2));
+    writer.emit(VMOPCODE_MULF, reg(2), reg(2), reg(3));
+    writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JGTF, imm(loop), reg(3), imm(1e-24));
+    writer.emit(VMOPCODE_ADD, reg(4), imm(1ull), reg(4));
+    writer.emit(VMOPCODE_JLT, imm(round), reg(4), imm(rounds));
+
+    program = { writer.length, 2 + rounds * (2 + 6 * steps + 2) + 1, 0, rounds * steps, KB(1) };
+}
+
+// naive recursive fibonacci, argument in r0 and result in r1
+static void buildFib(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 argument = 30;
+    ProgramWriter writer { code, 0 };
+
+    // the addresses of fib and its base case are fixed, see below
+    constexpr u64 fib = 3;
+    constexpr u64 base = 14;
+    writer.emit(VMOPCODE_MOV, imm(argument), reg(0));
+    writer.emit(VMOPCODE_CALL, imm(fib));
+    writer.emit(VMOPCODE_HLT);
+
+    writer.emit(VMOPCODE_JLT, imm(base), reg(0), imm(2ull));
+    writer.emit(VMOPCODE_PUSH, reg(0));
+    writer.emit(VMOPCODE_SUB, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_CALL, imm(fib));
+    writer.emit(VMOPCODE_POP, reg(0));
+    writer.emit(VMOPCODE_PUSH, reg(1));
+    writer.emit(VMOPCODE_SUB, reg(0), imm(2ull), reg(0));
+    writer.emit(VMOPCODE_CALL, imm(fib));
+    writer.emit(VMOPCODE_POP, reg(2));
+    writer.emit(VMOPCODE_ADD, reg(1), reg(2), reg(1));
+    writer.emit(VMOPCODE_RET);
+
+    writer.emit(VMOPCODE_MOV, reg(0), reg(1));
+    writer.emit(VMOPCODE_RET);
+
+    // fib(n) makes fib(n + 1) calls that end in the base case and one less
+    // that recurse, the former run 3 instructions and the latter 11
+    u64 previous = 0, current = 1;
+    for (u64 i = 0; i < argument; ++i) {
+        u64 next = previous + current;
+        previous = current;
+        current = next;
+    }
+    u64 leaves = current;
+
+    program = { writer.length, 2 + 11 * (leaves - 1) + 3 * leaves + 1, 1, previous, KB(1) };
+}
+
+// the same recursion saving its registers with ENTER and returning with LEAVE
+static void buildFibFrames(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 argument = 30;
+    ProgramWriter writer { code, 0 };
+
+    constexpr u64 fib = 3;
+    constexpr u64 base = 12;
+    writer.emit(VMOPCODE_MOV, imm(argument), reg(0));
+    writer.emit(VMOPCODE_CALL, imm(fib));
+    writer.emit(VMOPCODE_HLT);
+
+    // r0 and r2 are the callee's to save
+    writer.emit(VMOPCODE_JLT, imm(base), reg(0), imm(2ull));
+    writer.emit(VMOPCODE_ENTER, imm(1ull << 0 | 1ull << 2), imm(0ull));
+    writer.emit(VMOPCODE_SUB, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_CALL, imm(fib));
+    writer.emit(VMOPCODE_MOV, reg(1), reg(2));
+    writer.emit(VMOPCODE_SUB, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_CALL, imm(fib));
+    writer.emit(VMOPCODE_ADD, reg(1), reg(2), reg(1));
+    writer.emit(VMOPCODE_LEAVE);
+
+    writer.emit(VMOPCODE_MOV, reg(0), reg(1));
+    writer.emit(VMOPCODE_RET);
+
+    u64 previous = 0, current = 1;
+    for (u64 i = 0; i < argument; ++i) {
+        u64 next = previous + current;
+        previous = current;
+        current = next;
+    }
+    u64 leaves = current;
+
+    program = { writer.length, 2 + 9 * (leaves - 1) + 3 * leaves + 1, 1, previous, KB(1) };
+}
+
+// copies of 512 KB at a time, large enough to leave the first level caches
+constexpr u64 COPY_WORDS = KB(64);
+constexpr u64 COPY_ROUNDS = 80;
+
+// copies a qword at a time through VMOPTYPE_INDIRECT
+static void buildCopyIndirect(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 bytes = COPY_WORDS * VMOPSIZE_QWORD;
+    ProgramWriter writer { code, 0 };
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    u64 round = writer.emit(VMOPCODE_MOV, imm(0ull), reg(3));
+    writer.emit(VMOPCODE_MOV, imm(bytes), reg(4));
+    u64 loop = writer.emit(VMOPCODE_MOV, indirect(3), indirect(4));
+    writer.emit(VMOPCODE_ADD, reg(3), imm(8ull), reg(3));
+    writer.emit(VMOPCODE_ADD, reg(4), imm(8ull), reg(4));
+    writer.emit(VMOPCODE_JLT, imm(loop), reg(3), imm(bytes));
+    writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JLT, imm(round), reg(0), imm(COPY_ROUNDS));
+
+    program = { writer.length, 1 + COPY_ROUNDS * (2 + 4 * COPY_WORDS + 2) + 1, 0, COPY_ROUNDS, 2 * bytes + KB(1) };
+}
+
+// copies four qwords at a time through VMOPTYPE_DISPLACEMENT
+static void buildCopyDisplaced(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 bytes = COPY_WORDS * VMOPSIZE_QWORD;
+    ProgramWriter writer { code, 0 };
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    u64 round = writer.emit(VMOPCODE_MOV, imm(0ull), reg(3));
+    writer.emit(VMOPCODE_MOV, imm(bytes), reg(4));
+    u64 loop = writer.emit(VMOPCODE_MOV, displaced(3, 0), displaced(4, 0));
+    writer.emit(VMOPCODE_MOV, displaced(3, 8), displaced(4, 8));
+    writer.emit(VMOPCODE_MOV, displaced(3, 16), displaced(4, 16));
+    writer.emit(VMOPCODE_MOV, displaced(3, 24), displaced(4, 24));
+    writer.emit(VMOPCODE_ADD, reg(3), imm(32ull), reg(3));
+    writer.emit(VMOPCODE_ADD, reg(4), imm(32ull), reg(4));
+    writer.emit(VMOPCODE_JLT, imm(loop), reg(3), imm(bytes));
+    writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JLT, imm(round), reg(0), imm(COPY_ROUNDS));
+
+    program = { writer.length, 1 + COPY_ROUNDS * (2 + 7 * (COPY_WORDS / 4) + 2) + 1, 0, COPY_ROUNDS, 2 * bytes + KB(1) };
+}
+
+// pushes and pops two qwords per iteration
+static void buildStack(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 iterations = 3500000;
+    ProgramWriter writer { code, 0 };
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    u64 loop = writer.emit(VMOPCODE_PUSH, reg(0));
+    writer.emit(VMOPCODE_PUSH, reg(1));
+    writer.emit(VMOPCODE_POP, reg(2));
+    writer.emit(VMOPCODE_POP, reg(3));
+    writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JLT, imm(loop), reg(0), imm(iterations));
+
+    program = { writer.length, 1 + 6 * iterations + 1, 3, iterations - 1, KB(1) };
+}
+
+// increments 512 KB of u32 lanes a vector at a time and adds them up
+static void buildVector(memory_view<VMInstruction> &code, VMBenchmarkProgram &program) {
+    constexpr u64 bytes = COPY_WORDS * VMOPSIZE_QWORD;
+    constexpr u64 rounds = 160;
+    ProgramWriter writer { code, 0 };
+
+    // memory outlives a run, clear it with the still zero accumulator first
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(3));
+    u64 clear = writer.emit(VMOPCODE_VSTORE, vector(0, VMOPSIZE_DWORD), indirect(3));
+    writer.emit(VMOPCODE_ADD, reg(3), imm(VECTOR_SIZE), reg(3));
+    writer.emit(VMOPCODE_JLT, imm(clear), reg(3), imm(bytes));
+
+    writer.emit(VMOPCODE_MOV, imm(0ull), reg(0));
+    writer.emit(VMOPCODE_VSPLAT, imm(1ull), vector(1, VMOPSIZE_DWORD));
+    u64 round = writer.emit(VMOPCODE_MOV, imm(0ull), reg(3));
+    u64 loop = writer.emit(VMOPCODE_VLOAD, indirect(3), vector(2, VMOPSIZE_DWORD));
+    writer.emit(VMOPCODE_VADD, vector(2, VMOPSIZE_DWORD), vector(1, VMOPSIZE_DWORD), vector(2, VMOPSIZE_DWORD));
+    writer.emit(VMOPCODE_VSTORE, vector(2, VMOPSIZE_DWORD), indirect(3));
+    writer.emit(VMOPCODE_VADD, vector(0, VMOPSIZE_DWORD), vector(2, VMOPSIZE_DWORD), vector(0, VMOPSIZE_DWORD));
+    writer.emit(VMOPCODE_ADD, reg(3), imm(VECTOR_SIZE), reg(3));
+    writer.emit(VMOPCODE_JLT, imm(loop), reg(3), imm(bytes));
+    writer.emit(VMOPCODE_ADD, reg(0), imm(1ull), reg(0));
+    writer.emit(VMOPCODE_JLT, imm(round), reg(0), imm(rounds));
+    writer.emit(VMOPCODE_VSUM, vector(0, VMOPSIZE_DWORD), reg(1));
+
+    // round r adds r to every lane of the accumulator once per lane of memory
+    u64 sum = (bytes / VMOPSIZE_DWORD) * rounds * (rounds + 1) / 2;
+    program = { writer.length, 1 + 3 * (bytes / VECTOR_SIZE) + 2 + rounds * (1 + 6 * (bytes / VECTOR_SIZE) + 2) + 2, 1, sum, bytes + KB(1) };
+}
+
+VMBenchmark const benchmarks[] = {
+    { "loop",           buildLoop },
+    { "float",          buildFloat },
+    { "converge",       buildConverge },
+    { "fib",            buildFib },
+    { "fib_frames",     buildFibFrames },
+    { "copy_indirect",  buildCopyIndirect },
+    { "copy_displaced", buildCopyDisplaced },
+    { "stack",          buildStack },
+    { "vector",         buildVector },
+};
+
+u64 const benchmarkCount = sizeof(benchmarks) / sizeof(benchmarks[0]);
@@ -0,0 +1,41 @@
+#if !defined(METAVM_BENCH_CORPUS_HPP)
+#define METAVM_BENCH_CORPUS_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+
+// a benchmark program after it was built, every program is deterministic so
+// the number of instructions a run executes is known up front
+struct VMBenchmarkProgram {
+    // instructions written to the code view
+    u64                    length;
+
+    // instructions one run dispatches, the terminating halt included
+    u64                  executed;
+
+    // register that has to hold `result` after a run, anything else means
+    // the engine under test is broken and its numbers are meaningless
+    u8             resultRegister;
+    VMWord                 result;
+
+    // memory the program touches, the stack included
+    u64                memorySize;
+};
+
+typedef void (*VMBenchmarkBuilder)(memory_view<VMInstruction> &code, VMBenchmarkProgram &program);
+
+struct VMBenchmark {
+    char const          *name;
+    VMBenchmarkBuilder  build;
+};
+
+// upper bound of VMBenchmarkProgram::length over the corpus
+constexpr u64 BENCHMARK_MAX_LENGTH = 32;
+
+// upper bound of VMBenchmarkProgram::memorySize over the corpus
+constexpr u64 BENCHMARK_MAX_MEMORY = KB(1088);
+
+extern VMBenchmark const benchmarks[];
+extern u64 const benchmarkCount;
+
+#endif
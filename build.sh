@@ -1,3 +1,13 @@
 # g++ ./src/*.cpp -o ./build/metavm -fno-exceptions -fno-rtti -I./inc -I./inc/achilles -lbfd -ldl -W -Wall -D BACKWARD_HAS_BFD=1 -g3
-g++ ./src/*.cpp -o ./build/metavm -fno-exceptions -fno-rtti -I./inc -I./inc/achilles -W -Wall -O3 -g3
+# add -D METAVM_THREADED_DISPATCH to use the direct-threaded (computed goto) dispatch engine instead of the switch
+# add -D METAVM_JIT to enable the x86-64 baseline JIT for hot functions (see MetaVM::attachJit)
+# add -D METAVM_PROFILE to profile runs, main then prints a per opcode, per address and per function report (see profile.hpp)
+# add -D METAVM_TRACE to trace runs to metavm.trace, ./build/metavm-trace decodes it (see trace.hpp)
+# add -mavx2 to run the vector opcodes on 256-bit AVX2 instead of SSE2 halves, -D METAVM_SCALAR_VECTORS for plain C++ kernels
+g++ ./src/*.cpp -o ./build/metavm -fno-exceptions -fno-rtti -I./inc -I./inc/achilles -W -Wall -O3 -g3 -pthread
 
+# the offline trace decoder for builds with -D METAVM_TRACE (see tools/trace.cpp)
+g++ $(ls ./src/*.cpp | grep -v main.cpp) ./tools/trace.cpp -o ./build/metavm-trace -fno-exceptions -fno-rtti -I./src -I./inc -I./inc/achilles -W -Wall -O3 -g3 -pthread
+
+# regression programs for the engines (see tools/regress.cpp)
+g++ $(ls ./src/*.cpp | grep -v main.cpp) ./tools/regress.cpp -o ./build/metavm-regress -fno-exceptions -fno-rtti -I./src -I./inc -I./inc/achilles -W -Wall -O3 -g3 -pthread
@@ -0,0 +1,153 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "arena.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+static u64 getPageSize() {
+    static u64 const pageSize = (u64) sysconf(_SC_PAGESIZE);
+    return pageSize;
+}
+
+void *mapPages(u64 size) {
+    // reserved lazily, nothing is committed before it's touched
+    void *memory = mmap(nullptr, memory::align(size, getPageSize()), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    return memory;
+}
+
+void unmapPages(void *memory, u64 size) {
+    if (memory == nullptr) return;
+    munmap(memory, memory::align(size, getPageSize()));
+}
+
+void clearPages(void *memory, u64 size) {
+    u64 dropped = 0;
+    if (size >= VMCLEAR_DROP_THRESHOLD) {
+        // private anonymous pages read back as zero once they're dropped
+        dropped = size & ~(getPageSize() - 1);
+        if (madvise(memory, dropped, MADV_DONTNEED) != 0) dropped = 0;
+    }
+    std::memset(((u8 *) memory) + dropped, 0, size - dropped);
+}
+
+VMArena::VMArena(u64 capacity) :
+            _base((u8 *) mapPages(capacity)),
+        _capacity(_base != nullptr ? capacity : 0)
+{
+}
+
+VMArena::~VMArena() {
+    unmapPages(_base, _capacity);
+}
+
+void VMArena::zero(u64 start, u64 end) {
+    // only what's below the dirty mark was ever written
+    if (start < _dirty) {
+        std::memset(_base + start, 0, (end < _dirty ? end : _dirty) - start);
+    }
+    if (end > _dirty) _dirty = end;
+}
+
+void *VMArena::allocate(u64 size, u64 alignment) {
+    u64 start = memory::align(_cursor, alignment);
+    if (start > _capacity || size > _capacity - start) return nullptr;
+
+    zero(start, start + size);
+    _last = start;
+    _cursor = start + size;
+    return _base + start;
+}
+
+void *VMArena::reallocate(void *previousMemory, u64 previousSize, u64 size, u64 alignment) {
+    u64 previous = (u64) ((u8 *) previousMemory - _base);
+    if (previous == _last && previous + previousSize == _cursor) {
+        if (size > _capacity - previous) return nullptr;
+        if (size > previousSize) zero(_cursor, previous + size);
+        _cursor = previous + size;
+        return previousMemory;
+    }
+
+    void *memory = allocate(size, alignment);
+    if (memory == nullptr) return nullptr;
+    std::memcpy(memory, previousMemory, previousSize < size ? previousSize : size);
+    return memory;
+}
+
+void VMArena::deallocate(void *memory, u64 size) {
+    u64 offset = (u64) ((u8 *) memory - _base);
+    if (offset == _last && offset + size == _cursor) {
+        _cursor = _last;
+    }
+}
+
+void VMArena::release() {
+    if (_dirty != 0) {
+        madvise(_base, memory::align(_dirty, getPageSize()), MADV_DONTNEED);
+    }
+    _dirty = 0;
+    reset();
+}
+
+thread_local VMArena *currentArena = nullptr;
+
+u64 getImageClass(u64 size) {
+    u64 bits = VMIMAGE_MIN_CLASS;
+    while (bits < VMIMAGE_MIN_CLASS + VMIMAGE_CLASS_COUNT && (1ull << bits) < size) {
+        bits++;
+    }
+    return bits - VMIMAGE_MIN_CLASS;
+}
+
+VMImagePool::~VMImagePool() {
+    for (u64 i = 0; i < VMIMAGE_CLASS_COUNT; ++i) {
+        while (_free[i] != nullptr) {
+            FreeImage *image = _free[i];
+            _free[i] = image->next;
+            unmapPages(image, 1ull << (VMIMAGE_MIN_CLASS + i));
+        }
+    }
+}
+
+u8 *VMImagePool::acquire(u64 size) {
+    u64 sizeClass = getImageClass(size);
+    if (sizeClass == VMIMAGE_CLASS_COUNT) return (u8 *) mapPages(size);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        FreeImage *image = _free[sizeClass];
+        if (image != nullptr) {
+            _free[sizeClass] = image->next;
+            _cached[sizeClass]--;
+            image->next = nullptr;
+            return (u8 *) image;
+        }
+    }
+    return (u8 *) mapPages(1ull << (VMIMAGE_MIN_CLASS + sizeClass));
+}
+
+void VMImagePool::release(u8 *image, u64 size) {
+    if (image == nullptr) return;
+
+    u64 sizeClass = getImageClass(size);
+    if (sizeClass == VMIMAGE_CLASS_COUNT) {
+        unmapPages(image, size);
+        return;
+    }
+
+    // only the part the VM could see was ever written
+    clearPages(image, size);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_cached[sizeClass] < maxCached) {
+            FreeImage *free = (FreeImage *) image;
+            free->next = _free[sizeClass];
+            _free[sizeClass] = free;
+            _cached[sizeClass]++;
+            return;
+        }
+    }
+    unmapPages(image, 1ull << (VMIMAGE_MIN_CLASS + sizeClass));
+}
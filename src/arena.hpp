@@ -0,0 +1,138 @@
+#if !defined(METAVM_ARENA_HPP)
+#define METAVM_ARENA_HPP
+
+#include <mutex>
+
+#include "common.hpp"
+#include "types.hpp"
+
+// allocation backends for VM setup and teardown, everything is carved out of
+// private anonymous mappings, whose pages the kernel hands out zeroed on first
+// touch, so memory that was never written is never cleared by hand
+
+// anonymous read/write mapping of `size` bytes rounded up to whole pages,
+// zeroed, null if it couldn't be mapped
+void *mapPages(u64 size);
+void unmapPages(void *memory, u64 size);
+
+// ranges of at least this many bytes are cleared by dropping their pages,
+// smaller ones with a memset, which is cheaper than faulting them back in
+constexpr u64 VMCLEAR_DROP_THRESHOLD = KB(256);
+
+// zeroes `size` bytes at the start of a mapping from mapPages
+void clearPages(void *memory, u64 size);
+
+// bump allocator over one reserved mapping, reset() frees everything at once
+// in O(1), allocations are zeroed like default_allocator's but only the bytes
+// an earlier allocation dirtied are cleared, the rest are still fresh pages
+struct VMArena {
+    // `capacity` is only reserved, pages are committed as they're touched
+    VMArena(u64 capacity = MB(64));
+    ~VMArena();
+
+    // null once the arena is full
+    void *allocate(u64 size, u64 alignment = sizeof(u64));
+
+    // grows or shrinks the most recent allocation in place, anything else
+    // is copied to a new allocation
+    void *reallocate(void *previousMemory, u64 previousSize, u64 size, u64 alignment = sizeof(u64));
+
+    // only the most recent allocation is given back, the rest waits for reset
+    void deallocate(void *memory, u64 size);
+
+    void reset() {
+        _cursor = 0;
+        _last = 0;
+    }
+
+    // resets and hands the dirtied pages back to the kernel
+    void release();
+
+    u64 used() const { return _cursor; }
+    u64 capacity() const { return _capacity; }
+
+private:
+    u8          *_base;
+    u64      _capacity;
+    u64        _cursor = 0;
+
+    // offset of the most recent allocation
+    u64          _last = 0;
+
+    // everything below has been handed out since the pages were fresh
+    u64         _dirty = 0;
+
+    void zero(u64 start, u64 end);
+};
+
+// the arena arena_allocator and arena_deallocator work in, per thread, see
+// VMArenaScope
+extern thread_local VMArena *currentArena;
+
+// makes `arena` the current one of this thread while the scope lives
+struct VMArenaScope {
+    VMArenaScope(VMArena &arena) : _previous(currentArena) { currentArena = &arena; }
+    ~VMArenaScope() { currentArena = _previous; }
+
+private:
+    VMArena *_previous;
+};
+
+// drop-in replacements for default_allocator and default_deallocator that
+// work in the current arena
+inline void *arena_allocator(u64 size, u64 alignment = sizeof(u64), void *previousMemory = nullptr, u64 previousSize = 0) {
+    if (size == previousSize) return previousMemory;
+    if (previousMemory == nullptr) return currentArena->allocate(size, alignment);
+    return currentArena->reallocate(previousMemory, previousSize, size, alignment);
+}
+
+inline void arena_deallocator(void *mem, u64 size) {
+    currentArena->deallocate(mem, size);
+}
+
+// a region or array must not outlive the arena that was current when it
+// allocated, nor be grown while another arena is current
+template<typename T>
+using arena_region = memory::region<T, arena_allocator, arena_deallocator, true>;
+
+template<typename T>
+using arena_array = memory::array<T, arena_allocator, arena_deallocator, true>;
+
+// size classes of VMImagePool, powers of two from 4 KB to 1 GB, larger
+// images are mapped and unmapped every time
+constexpr u64 VMIMAGE_MIN_CLASS = 12;
+constexpr u64 VMIMAGE_CLASS_COUNT = 19;
+
+// index of the smallest class that holds `size`, VMIMAGE_CLASS_COUNT if none
+u64 getImageClass(u64 size);
+
+// recycles VM memory images by size class, thread safe
+//
+// images are cleared when they're released, big ones by dropping their
+// pages, so the zeroing of a reused image is paid as it's touched again and
+// only for the pages the next VM actually uses
+struct VMImagePool {
+    VMImagePool() = default;
+    ~VMImagePool();
+
+    // images kept per size class, the ones released beyond it are unmapped
+    u64 maxCached = 16;
+
+    // a zeroed image of at least `size` bytes, null if it couldn't be mapped
+    u8 *acquire(u64 size);
+
+    // `size` is the one the image was acquired with
+    void release(u8 *image, u64 size);
+
+private:
+    // threaded through the first word of cached images
+    struct FreeImage {
+        FreeImage *next;
+    };
+
+    std::mutex                                    _mutex;
+    FreeImage     *_free[VMIMAGE_CLASS_COUNT] = {};
+    u64          _cached[VMIMAGE_CLASS_COUNT] = {};
+};
+
+#endif
@@ -0,0 +1,547 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "assembler.hpp"
+
+// slots of the mnemonic table, a power of two well above the opcode count
+constexpr u64 VMMNEMONIC_SLOTS = 256;
+
+// the longest mnemonic, longer words can't be one
+constexpr u64 VMMNEMONIC_MAX_LENGTH = 16;
+
+// the longest number a float immediate is parsed from
+constexpr u64 VMASSEMBLER_MAX_FLOAT = 64;
+
+static char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool isIdentifierStart(char c) {
+    c = toLower(c);
+    return (c >= 'a' && c <= 'z') || c == '_' || c == '.' || c == '$';
+}
+
+static bool isIdentifier(char c) {
+    return isIdentifierStart(c) || isDigit(c);
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool isComment(char c) {
+    return c == ';' || c == '#';
+}
+
+// what may follow an operand
+static bool isDelimiter(char const *cursor, char const *end) {
+    return cursor == end || isSpace(*cursor) || isComment(*cursor) || *cursor == ',' || *cursor == ']' || *cursor == ':';
+}
+
+static void skipSpaces(char const *&cursor, char const *end) {
+    while (cursor != end && isSpace(*cursor)) cursor++;
+}
+
+// FNV-1a, never 0 since that marks a free slot
+static u64 hashName(char const *name, u64 length, bool fold) {
+    u64 hash = 0xcbf29ce484222325ull;
+    for (u64 i = 0; i < length; ++i) {
+        hash = (hash ^ (u8) (fold ? toLower(name[i]) : name[i])) * 0x100000001b3ull;
+    }
+    return hash | 1;
+}
+
+// whether `value` fits in `size` bytes, as an unsigned or a signed number
+static bool fitsSize(u64 value, VMOperandSize size, bool negative) {
+    if (size == VMOPSIZE_QWORD) return true;
+    u64 bits = 8 * size;
+    if (negative) return (s64) value >= -((s64) 1 << (bits - 1));
+    return value >> bits == 0;
+}
+
+// the opcode's name without VMOPCODE_, null for unknown opcodes
+static char const *getMnemonic(u8 opcode) {
+    constexpr u64 prefix = sizeof("VMOPCODE_") - 1;
+    char const *name = getOPCodeName((VMOPCode) opcode);
+    return std::strlen(name) > prefix ? name + prefix : nullptr;
+}
+
+struct VMMnemonicTable {
+    u64  hashes[VMMNEMONIC_SLOTS];
+    s16 opcodes[VMMNEMONIC_SLOTS];
+};
+
+// the mnemonics are the opcode names, so there's no second list to keep in
+// sync with VMOPCode
+static VMMnemonicTable buildMnemonics() {
+    VMMnemonicTable table {};
+    for (u64 i = 0; i < VMMNEMONIC_SLOTS; ++i) {
+        table.opcodes[i] = -1;
+    }
+
+    for (u64 opcode = 0; opcode < 256; ++opcode) {
+        char const *name = getMnemonic((u8) opcode);
+        if (name == nullptr || getOperandCount((u8) opcode) < 0) continue;
+
+        u64 hash = hashName(name, std::strlen(name), true);
+        u64 slot = hash & (VMMNEMONIC_SLOTS - 1);
+        while (table.opcodes[slot] >= 0) {
+            slot = (slot + 1) & (VMMNEMONIC_SLOTS - 1);
+        }
+        table.hashes[slot] = hash;
+        table.opcodes[slot] = (s16) opcode;
+    }
+
+    return table;
+}
+
+static s32 findMnemonic(char const *word, u64 length) {
+    static VMMnemonicTable const table = buildMnemonics();
+    if (length > VMMNEMONIC_MAX_LENGTH) return -1;
+
+    u64 hash = hashName(word, length, true);
+    for (u64 slot = hash & (VMMNEMONIC_SLOTS - 1); table.opcodes[slot] >= 0; slot = (slot + 1) & (VMMNEMONIC_SLOTS - 1)) {
+        if (table.hashes[slot] != hash) continue;
+
+        char const *name = getMnemonic((u8) table.opcodes[slot]);
+        if (std::strlen(name) != length) continue;
+
+        bool equal = true;
+        for (u64 i = 0; i < length && equal; ++i) {
+            equal = toLower(name[i]) == toLower(word[i]);
+        }
+        if (equal) return table.opcodes[slot];
+    }
+    return -1;
+}
+
+// an unsigned decimal or hexadecimal number
+static bool parseUnsigned(char const *&cursor, char const *end, u64 &value) {
+    value = 0;
+    char const *start = cursor;
+    if (end - cursor > 2 && cursor[0] == '0' && toLower(cursor[1]) == 'x') {
+        cursor += 2;
+        start = cursor;
+        for (; cursor != end; ++cursor) {
+            char c = toLower(*cursor);
+            u64 digit;
+            if (isDigit(c))               digit = c - '0';
+            else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else                           break;
+            if (value >> 60) return false;
+            value = value << 4 | digit;
+        }
+    } else {
+        for (; cursor != end && isDigit(*cursor); ++cursor) {
+            if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, (u64) (*cursor - '0'), &value)) {
+                return false;
+            }
+        }
+    }
+    return cursor != start;
+}
+
+// a number with an optional sign, `negative` is set for negative integers
+static bool parseNumber(char const *&cursor, char const *end, VMWord &value, bool &negative, bool &floating) {
+    char const *start = cursor;
+    negative = cursor != end && *cursor == '-';
+    if (cursor != end && (*cursor == '-' || *cursor == '+')) cursor++;
+
+    bool hexadecimal = end - cursor > 2 && cursor[0] == '0' && toLower(cursor[1]) == 'x';
+    u64 magnitude;
+    if (!parseUnsigned(cursor, end, magnitude)) return false;
+
+    // a fraction or an exponent after decimal digits makes it a float
+    floating = !hexadecimal && cursor != end && (*cursor == '.' || toLower(*cursor) == 'e');
+    if (floating) {
+        while (cursor != end && (isDigit(*cursor) || *cursor == '.' || toLower(*cursor) == 'e' ||
+               ((*cursor == '-' || *cursor == '+') && toLower(cursor[-1]) == 'e'))) {
+            cursor++;
+        }
+
+        // strtod wants a terminated string, the source isn't one
+        char buffer[VMASSEMBLER_MAX_FLOAT];
+        u64 length = cursor - start;
+        if (length >= sizeof(buffer)) return false;
+        std::memcpy(buffer, start, length);
+        buffer[length] = '\0';
+
+        char *parsed;
+        value.f = std::strtod(buffer, &parsed);
+        negative = false;
+        return parsed == buffer + length;
+    }
+
+    if (negative && magnitude > (1ull << 63)) return false;
+    value.u = negative ? 0 - magnitude : magnitude;
+    return true;
+}
+
+static bool parseSize(char const *&cursor, char const *end, VMOperandSize &size) {
+    if (cursor == end || *cursor != ':') return true;
+    if (++cursor == end) return false;
+
+    switch (toLower(*cursor++)) {
+        case 'b': size = VMOPSIZE_BYTE;  break;
+        case 'w': size = VMOPSIZE_WORD;  break;
+        case 'd': size = VMOPSIZE_DWORD; break;
+        case 'q': size = VMOPSIZE_QWORD; break;
+        default:  return false;
+    }
+    return isDelimiter(cursor, end) && (cursor == end || *cursor != ':');
+}
+
+// a register number after its letter, `r5` or `v3`
+static bool parseRegisterNumber(char const *&cursor, char const *end, u64 limit, u8 &index) {
+    char const *start = cursor;
+    if (cursor == end || !isDigit(*cursor)) return false;
+
+    u64 value = 0;
+    while (cursor != end && isDigit(*cursor) && value < limit) {
+        value = value * 10 + (*cursor++ - '0');
+    }
+    if (value >= limit) {
+        cursor = start;
+        return false;
+    }
+    index = (u8) value;
+    return true;
+}
+
+VMAssembler::VMAssembler (
+    memory_view<u8> &stream,
+    memory_view<VMAssemblerSymbol> &symbols,
+    memory_view<char> &names,
+    array_view<VMAssemblerPatch> &patches
+) :     _stream(stream),
+       _symbols(symbols),
+         _names(names),
+       _patches(patches)
+{
+    // the largest power of two of slots there is room for
+    u64 capacity = symbols.size();
+    while (capacity & (capacity - 1)) {
+        capacity &= capacity - 1;
+    }
+    _mask = capacity ? capacity - 1 : 0;
+    _capacity = capacity;
+
+    for (u64 i = 0; i < capacity; ++i) {
+        _symbols[i] = {};
+    }
+}
+
+s64 VMAssembler::intern(char const *name, u64 length, u64 hash) {
+    if (_capacity == 0) return -1;
+
+    u64 slot = hash & _mask;
+    for (;; slot = (slot + 1) & _mask) {
+        VMAssemblerSymbol &symbol = _symbols[slot];
+        if (symbol.hash == 0) break;
+        if (symbol.hash == hash && symbol.length == length && std::memcmp(&_names[symbol.name], name, length) == 0) {
+            return (s64) slot;
+        }
+    }
+
+    // probes stay short while a quarter of the slots is free
+    if ((_symbolCount + 1) * 4 > _capacity * 3 || _names.size() - _namesUsed < length + 1) {
+        return -1;
+    }
+
+    std::memcpy(&_names[_namesUsed], name, length);
+    _names[_namesUsed + length] = '\0';
+    _symbols[slot] = { hash, 0, (u32) _namesUsed, (u32) length, false };
+    _namesUsed += length + 1;
+    _symbolCount++;
+    return (s64) slot;
+}
+
+VMAssembleStatus VMAssembler::parseOperand(char const *&cursor, char const *end, VMOperand &operand, s64 &label) {
+    operand = {};
+    operand.size = VMOPSIZE_QWORD;
+    char const *start = cursor;
+
+    // [1024], [r5], [r5+16]
+    if (*cursor == '[') {
+        cursor++;
+        skipSpaces(cursor, end);
+        if (cursor != end && toLower(*cursor) == 'r' && ++cursor != end && isDigit(*cursor)) {
+            if (!parseRegisterNumber(cursor, end, REGISTER_COUNT, operand.registerIndex)) return VMASSEMBLE_INVALID_OPERAND;
+            operand.type = VMOPTYPE_INDIRECT;
+
+            skipSpaces(cursor, end);
+            if (cursor != end && (*cursor == '+' || *cursor == '-')) {
+                bool negative = *cursor++ == '-';
+                skipSpaces(cursor, end);
+                u64 displacement;
+                if (!parseUnsigned(cursor, end, displacement)) return VMASSEMBLE_INVALID_OPERAND;
+                if (displacement > (negative ? 1ull << 63 : (1ull << 63) - 1)) return VMASSEMBLE_VALUE_OUT_OF_RANGE;
+                operand.type = VMOPTYPE_DISPLACEMENT;
+                operand.value.u = negative ? 0 - displacement : displacement;
+            }
+        } else {
+            operand.type = VMOPTYPE_POINTER;
+            if (!parseUnsigned(cursor, end, operand.value.u)) return VMASSEMBLE_INVALID_OPERAND;
+        }
+
+        skipSpaces(cursor, end);
+        if (cursor == end || *cursor++ != ']') return VMASSEMBLE_INVALID_OPERAND;
+        return parseSize(cursor, end, operand.size) ? VMASSEMBLE_OK : VMASSEMBLE_INVALID_OPERAND;
+    }
+
+    // r5, r5.d1
+    if (toLower(*cursor) == 'r' && cursor + 1 != end && isDigit(cursor[1])) {
+        cursor++;
+        u8 index;
+        if (parseRegisterNumber(cursor, end, REGISTER_COUNT, index)) {
+            u8 part = 0;
+            bool valid = true;
+            bool sub = cursor != end && *cursor == '.';
+            if (sub && cursor + 1 != end) {
+                cursor++;
+                switch (toLower(*cursor++)) {
+                    case 'd': operand.size = VMOPSIZE_DWORD; break;
+                    case 'w': operand.size = VMOPSIZE_WORD;  break;
+                    case 'b': operand.size = VMOPSIZE_BYTE;  break;
+                    default:  valid = false;                 break;
+                }
+                valid = valid && parseRegisterNumber(cursor, end, VMOPSIZE_QWORD / operand.size, part);
+            }
+
+            if (valid && isDelimiter(cursor, end)) {
+                operand.type = VMOPTYPE_REGISTER;
+                operand.registerIndex = index * (VMOPSIZE_QWORD / operand.size) + part;
+                return VMASSEMBLE_OK;
+            }
+
+            // r1.d2 is a sub register that doesn't exist rather than a label
+            if (sub) return VMASSEMBLE_INVALID_OPERAND;
+        }
+
+        // something like r5x is a label
+        cursor = start;
+        operand.size = VMOPSIZE_QWORD;
+    }
+
+    // v3, v3:d
+    if (toLower(*cursor) == 'v' && cursor + 1 != end && isDigit(cursor[1])) {
+        cursor++;
+        if (parseRegisterNumber(cursor, end, VECTOR_REGISTER_COUNT, operand.registerIndex) && isDelimiter(cursor, end)) {
+            operand.type = VMOPTYPE_VECTOR;
+            return parseSize(cursor, end, operand.size) ? VMASSEMBLE_OK : VMASSEMBLE_INVALID_OPERAND;
+        }
+        cursor = start;
+    }
+
+    // 42, -7, 0x2a, 1.5
+    if (isDigit(*cursor) || *cursor == '-' || *cursor == '+') {
+        bool negative, floating;
+        operand.type = VMOPTYPE_IMMEDIATE;
+        if (!parseNumber(cursor, end, operand.value, negative, floating)) return VMASSEMBLE_INVALID_OPERAND;
+        if (!isDelimiter(cursor, end) || !parseSize(cursor, end, operand.size)) return VMASSEMBLE_INVALID_OPERAND;
+
+        if (floating) {
+            if (operand.size == VMOPSIZE_DWORD) {
+                operand.value = VMWord((f32) operand.value.f);
+            } else if (operand.size != VMOPSIZE_QWORD) {
+                return VMASSEMBLE_INVALID_OPERAND;
+            }
+        } else if (!fitsSize(operand.value.u, operand.size, negative)) {
+            return VMASSEMBLE_VALUE_OUT_OF_RANGE;
+        }
+        return VMASSEMBLE_OK;
+    }
+
+    // a label, the address of the instruction after it
+    if (isIdentifierStart(*cursor)) {
+        while (cursor != end && isIdentifier(*cursor)) cursor++;
+        u64 length = cursor - start;
+        s64 slot = intern(start, length, hashName(start, length, false));
+        if (slot < 0) return VMASSEMBLE_OUT_OF_SPACE;
+
+        operand.type = VMOPTYPE_IMMEDIATE;
+        if (!isDelimiter(cursor, end) || !parseSize(cursor, end, operand.size)) return VMASSEMBLE_INVALID_OPERAND;
+
+        VMAssemblerSymbol const &symbol = _symbols[slot];
+        if (symbol.defined) {
+            if (!fitsSize(symbol.address, operand.size, false)) return VMASSEMBLE_VALUE_OUT_OF_RANGE;
+            operand.value.u = symbol.address;
+        } else {
+            label = slot;
+        }
+        return VMASSEMBLE_OK;
+    }
+
+    return VMASSEMBLE_INVALID_OPERAND;
+}
+
+VMAssembleStatus VMAssembler::assembleLine(char const *cursor, char const *end) {
+    // any number of labels, then the mnemonic
+    char const *word;
+    for (;;) {
+        skipSpaces(cursor, end);
+        if (cursor == end || isComment(*cursor)) return VMASSEMBLE_OK;
+        if (!isIdentifierStart(*cursor)) return VMASSEMBLE_UNKNOWN_MNEMONIC;
+
+        word = cursor;
+        while (cursor != end && isIdentifier(*cursor)) cursor++;
+        if (cursor == end || *cursor != ':') break;
+
+        u64 length = cursor - word;
+        s64 slot = intern(word, length, hashName(word, length, false));
+        if (slot < 0) return VMASSEMBLE_OUT_OF_SPACE;
+
+        VMAssemblerSymbol &symbol = _symbols[slot];
+        if (symbol.defined) return VMASSEMBLE_DUPLICATE_LABEL;
+        symbol.defined = true;
+        symbol.address = _instructions;
+        cursor++;
+    }
+
+    s32 opcode = findMnemonic(word, cursor - word);
+    if (opcode < 0) return VMASSEMBLE_UNKNOWN_MNEMONIC;
+
+    VMInstruction inst {};
+    inst.opcode = (VMOPCode) opcode;
+    VMOperand *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    s64 labels[] = { -1, -1, -1 };
+
+    s32 count = 0;
+    skipSpaces(cursor, end);
+    if (cursor != end && !isComment(*cursor)) {
+        for (;;) {
+            if (count == 3) return VMASSEMBLE_INVALID_OPERAND_COUNT;
+
+            VMAssembleStatus status = parseOperand(cursor, end, *operands[count], labels[count]);
+            if (status != VMASSEMBLE_OK) return status;
+            count++;
+
+            skipSpaces(cursor, end);
+            if (cursor == end || *cursor != ',') break;
+            cursor++;
+            skipSpaces(cursor, end);
+            if (cursor == end) return VMASSEMBLE_INVALID_OPERAND;
+        }
+        if (cursor != end && !isComment(*cursor)) return VMASSEMBLE_INVALID_OPERAND;
+    }
+
+    if (count != getOperandCount((u8) opcode)) return VMASSEMBLE_INVALID_OPERAND_COUNT;
+
+    // the decoder would reject the stream otherwise
+    for (s32 i = 0; i < count; ++i) {
+        if ((operands[i]->type == VMOPTYPE_VECTOR) != isVectorOperand((u8) opcode, i)) return VMASSEMBLE_INVALID_OPERAND;
+    }
+
+    u64 ends[3];
+    if (!encodeInstruction(inst, _stream, _cursor, ends)) return VMASSEMBLE_OUT_OF_SPACE;
+
+    // labels that aren't defined yet are patched into the payload by finish
+    for (s32 i = 0; i < count; ++i) {
+        if (labels[i] < 0) continue;
+
+        VMAssemblerPatch patch { ends[i] - operands[i]->size, _line, (u32) labels[i], operands[i]->size };
+        if (!_patches.append(patch)) return VMASSEMBLE_OUT_OF_SPACE;
+    }
+
+    _instructions++;
+    return VMASSEMBLE_OK;
+}
+
+VMAssembleStatus VMAssembler::fail(VMAssembleStatus status) {
+    _status = status;
+    return status;
+}
+
+VMAssembleStatus VMAssembler::feed(char const *text, u64 length) {
+    if (_status != VMASSEMBLE_OK) return _status;
+
+    char const *cursor = text;
+    char const *end = text + length;
+
+    // finish the line the previous chunk ended in first
+    if (_partialLength != 0) {
+        char const *newline = (char const *) std::memchr(cursor, '\n', length);
+        u64 rest = newline ? newline - cursor : length;
+        if (_partialLength + rest > VMASSEMBLER_MAX_LINE) return fail(VMASSEMBLE_LINE_TOO_LONG);
+
+        std::memcpy(_partial + _partialLength, cursor, rest);
+        _partialLength += rest;
+        if (newline == nullptr) return VMASSEMBLE_OK;
+
+        VMAssembleStatus status = assembleLine(_partial, _partial + _partialLength);
+        _partialLength = 0;
+        if (status != VMASSEMBLE_OK) return fail(status);
+        _line++;
+        cursor = newline + 1;
+    }
+
+    // whole lines are assembled straight from the chunk
+    for (;;) {
+        char const *newline = (char const *) std::memchr(cursor, '\n', end - cursor);
+        if (newline == nullptr) break;
+
+        VMAssembleStatus status = assembleLine(cursor, newline);
+        if (status != VMASSEMBLE_OK) return fail(status);
+        _line++;
+        cursor = newline + 1;
+    }
+
+    u64 rest = end - cursor;
+    if (rest > VMASSEMBLER_MAX_LINE) return fail(VMASSEMBLE_LINE_TOO_LONG);
+    std::memcpy(_partial, cursor, rest);
+    _partialLength = rest;
+    return VMASSEMBLE_OK;
+}
+
+VMAssembleStatus VMAssembler::finish() {
+    if (_status != VMASSEMBLE_OK) return _status;
+
+    if (_partialLength != 0) {
+        VMAssembleStatus status = assembleLine(_partial, _partial + _partialLength);
+        _partialLength = 0;
+        if (status != VMASSEMBLE_OK) return fail(status);
+    }
+
+    for (u64 i = 0; i < _patches.length(); ++i) {
+        VMAssemblerPatch const &patch = _patches[i];
+        VMAssemblerSymbol const &symbol = _symbols[patch.symbol];
+        if (!symbol.defined || !fitsSize(symbol.address, patch.size, false)) {
+            _line = patch.line;
+            return fail(symbol.defined ? VMASSEMBLE_VALUE_OUT_OF_RANGE : VMASSEMBLE_UNDEFINED_LABEL);
+        }
+
+        // immediates are encoded in the bytes of a VMWord
+        VMWord address { symbol.address };
+        std::memcpy(&_stream[patch.offset], address.ubytes, patch.size);
+    }
+
+    return VMASSEMBLE_OK;
+}
+
+bool VMAssembler::findLabel(char const *name, u64 &address) const {
+    if (_capacity == 0) return false;
+
+    u64 length = std::strlen(name);
+    u64 hash = hashName(name, length, false);
+    for (u64 slot = hash & _mask; _symbols[slot].hash != 0; slot = (slot + 1) & _mask) {
+        VMAssemblerSymbol const &symbol = _symbols[slot];
+        if (symbol.hash == hash && symbol.length == length && std::memcmp(&_names[symbol.name], name, length) == 0) {
+            address = symbol.address;
+            return symbol.defined;
+        }
+    }
+    return false;
+}
+
+bool VMAssembler::exportSymbols(array_view<VMSymbol> &symbols) const {
+    for (u64 slot = 0; slot < _capacity; ++slot) {
+        VMAssemblerSymbol const &symbol = _symbols[slot];
+        if (symbol.hash == 0 || !symbol.defined) continue;
+        if (!symbols.append({ &_names[symbol.name], symbol.address })) return false;
+    }
+    return true;
+}
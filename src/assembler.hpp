@@ -1,7 +1,153 @@
 #if !defined(METAVM_ASSEMBLER_HPP)
 #define METAVM_ASSEMBLER_HPP
 
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "module.hpp"
 
+// single pass assembler from MetaVM text to compact bytecode (see
+// bytecode.hpp), the source is fed in chunks of any size and every
+// instruction is encoded as soon as its line is complete, the stream can be
+// decoded or written to a module as is once the assembler finished
+//
+//  line     := [label ':']* [mnemonic [operand (',' operand)*]] [comment]
+//  comment  := (';' | '#') anything up to the end of the line
+//  mnemonic := an opcode name without VMOPCODE_, in any case (mov, jeq, ...)
+//
+//  operand                       type                  size
+//  r5                            VMOPTYPE_REGISTER     qword
+//  r5.d1  r5.w3  r5.b7           sub register of r5    dword, word, byte
+//  42  -7  0x2a  1.5             VMOPTYPE_IMMEDIATE    qword or [size]
+//  label                         VMOPTYPE_IMMEDIATE    qword or [size]
+//  [1024]                        VMOPTYPE_POINTER      qword or [size]
+//  [r5]                          VMOPTYPE_INDIRECT     qword or [size]
+//  [r5+16]  [r5-8]               VMOPTYPE_DISPLACEMENT qword or [size]
+//  v3                            VMOPTYPE_VECTOR       qword lanes or [size]
+//
+//  size     := ':' ('b' | 'w' | 'd' | 'q')
+//
+// sub registers are numbered within their register, r5.d1 is the upper half
+// of r5, floats are f64 immediates or f32 ones with :d, a label stands for
+// the address of the instruction after it, labels used before they're
+// defined are patched into the stream by finish, every opcode takes the
+// operands getOperandCount gives it, neg and not take one they change in
+// place
 
-#endif
+// the longest line that may be split across two chunks
+constexpr u64 VMASSEMBLER_MAX_LINE = 1024;
+
+enum VMAssembleStatus {
+    VMASSEMBLE_OK,
+    VMASSEMBLE_UNKNOWN_MNEMONIC,
+    VMASSEMBLE_INVALID_OPERAND,
+    VMASSEMBLE_INVALID_OPERAND_COUNT,
+    VMASSEMBLE_VALUE_OUT_OF_RANGE,
+    VMASSEMBLE_DUPLICATE_LABEL,
+    VMASSEMBLE_UNDEFINED_LABEL,
+    VMASSEMBLE_LINE_TOO_LONG,
+    VMASSEMBLE_OUT_OF_SPACE,
+};
+
+inline const char *getAssembleStatusName(VMAssembleStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMASSEMBLE_OK);
+        stname(VMASSEMBLE_UNKNOWN_MNEMONIC);
+        stname(VMASSEMBLE_INVALID_OPERAND);
+        stname(VMASSEMBLE_INVALID_OPERAND_COUNT);
+        stname(VMASSEMBLE_VALUE_OUT_OF_RANGE);
+        stname(VMASSEMBLE_DUPLICATE_LABEL);
+        stname(VMASSEMBLE_UNDEFINED_LABEL);
+        stname(VMASSEMBLE_LINE_TOO_LONG);
+        stname(VMASSEMBLE_OUT_OF_SPACE);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// a slot of the label table, open addressing over a power of two of them
+struct VMAssemblerSymbol {
+    // of the name, 0 for a free slot
+    u64                  hash;
+    u64               address;
+
+    // the zero terminated name in the names buffer
+    u32                  name;
+    u32                length;
+    bool              defined;
+};
+
+// a use of a label before its definition, see VMAssembler::finish
+struct VMAssemblerPatch {
+    // where the immediate's payload starts in the stream
+    u64                offset;
+    u64                  line;
+    u32                symbol;
+    VMOperandSize        size;
+};
+
+struct VMAssembler {
+    // the assembler only ever writes to the buffers it's given, `symbols`
+    // should have a power of two of slots, any more are left unused, and at
+    // least a third more than there are labels
+    VMAssembler (
+        memory_view<u8> &stream,
+        memory_view<VMAssemblerSymbol> &symbols,
+        memory_view<char> &names,
+        array_view<VMAssemblerPatch> &patches
+    );
+
+    // assembles the next chunk of source, lines may be split between chunks,
+    // after an error every call returns it again (see line)
+    VMAssembleStatus feed(char const *text, u64 length);
 
+    // assembles the rest of the last line and resolves every label used
+    // before its definition, the stream is complete afterwards
+    VMAssembleStatus finish();
+
+    // bytes of bytecode and instructions assembled so far
+    u64 length() const { return _cursor; }
+    u64 instructions() const { return _instructions; }
+
+    // the line (from 1) the last error was found on
+    u64 line() const { return _line; }
+
+    // looks up the address of a label, returns false if it isn't defined
+    bool findLabel(char const *name, u64 &address) const;
+
+    // appends every label to `symbols` for writeModule, the names point into
+    // the names buffer, returns false if `symbols` is too small
+    bool exportSymbols(array_view<VMSymbol> &symbols) const;
+
+private:
+    memory_view<u8>                  &_stream;
+    memory_view<VMAssemblerSymbol>  &_symbols;
+    memory_view<char>                 &_names;
+    array_view<VMAssemblerPatch>    &_patches;
+
+    u64                             _capacity;
+    u64                                 _mask;
+    u64                          _symbolCount = 0;
+    u64                            _namesUsed = 0;
+    u64                               _cursor = 0;
+    u64                         _instructions = 0;
+    u64                                 _line = 1;
+    VMAssembleStatus                  _status = VMASSEMBLE_OK;
+
+    // the start of a line the previous chunk ended in
+    char          _partial[VMASSEMBLER_MAX_LINE];
+    u64                        _partialLength = 0;
+
+    // records an error, see feed
+    VMAssembleStatus fail(VMAssembleStatus status);
+
+    VMAssembleStatus assembleLine(char const *start, char const *end);
+    VMAssembleStatus parseOperand(char const *&cursor, char const *end, VMOperand &operand, s64 &label);
+    s64 intern(char const *name, u64 length, u64 hash);
+};
+
+#endif
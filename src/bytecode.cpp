@@ -0,0 +1,318 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "metavm.hpp"
+
+s32 getOperandCount(u8 opcode) {
+    switch (opcode) {
+        case VMOPCODE_HLT:
+        case VMOPCODE_NOP:
+        case VMOPCODE_RET:
+        case VMOPCODE_LEAVE:
+            return 0;
+        case VMOPCODE_PUSH:
+        case VMOPCODE_POP:
+        case VMOPCODE_NEG:
+        case VMOPCODE_NOT:
+        case VMOPCODE_JMP:
+        case VMOPCODE_CALL:
+        case VMOPCODE_CALLN:
+            return 1;
+        case VMOPCODE_MOV:
+        case VMOPCODE_ENTER:
+        case VMOPCODE_VLOAD: case VMOPCODE_VSTORE: case VMOPCODE_VSPLAT:
+        case VMOPCODE_VSUM:  case VMOPCODE_VSUMS:  case VMOPCODE_VSUMF:
+            return 2;
+        case VMOPCODE_ADD:  case VMOPCODE_SUB:  case VMOPCODE_MUL:  case VMOPCODE_DIV:  case VMOPCODE_DIVR:
+        case VMOPCODE_ADDS: case VMOPCODE_SUBS: case VMOPCODE_MULS: case VMOPCODE_DIVS: case VMOPCODE_DIVSR:
+        case VMOPCODE_ADDF: case VMOPCODE_SUBF: case VMOPCODE_MULF: case VMOPCODE_DIVF:
+        case VMOPCODE_ADDFS: case VMOPCODE_SUBFS: case VMOPCODE_MULFS: case VMOPCODE_DIVFS:
+        case VMOPCODE_AND:  case VMOPCODE_OR:   case VMOPCODE_XOR:
+        case VMOPCODE_JEQ:  case VMOPCODE_JNE:  case VMOPCODE_JGT:  case VMOPCODE_JLT:  case VMOPCODE_JGE: case VMOPCODE_JLE:
+        case VMOPCODE_JGTS: case VMOPCODE_JLTS: case VMOPCODE_JGES: case VMOPCODE_JLES:
+        case VMOPCODE_JEQF: case VMOPCODE_JNEF: case VMOPCODE_JGTF: case VMOPCODE_JLTF: case VMOPCODE_JGEF: case VMOPCODE_JLEF:
+        case VMOPCODE_VEXTRACT:
+        case VMOPCODE_VADD:   case VMOPCODE_VSUB:   case VMOPCODE_VMUL:
+        case VMOPCODE_VADDF:  case VMOPCODE_VSUBF:  case VMOPCODE_VMULF:
+        case VMOPCODE_VMIN:   case VMOPCODE_VMAX:   case VMOPCODE_VMINS:  case VMOPCODE_VMAXS:
+        case VMOPCODE_VMINF:  case VMOPCODE_VMAXF:  case VMOPCODE_VCMPEQ: case VMOPCODE_VCMPGT:
+        case VMOPCODE_VCMPGTS: case VMOPCODE_VCMPEQF: case VMOPCODE_VCMPGTF: case VMOPCODE_VSHUF:
+        case VMOPCODE_MCOPY:  case VMOPCODE_MFILL:  case VMOPCODE_MCMP:   case VMOPCODE_MFIND:
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+s32 getDestinationOperand(u8 opcode) {
+    switch (opcode) {
+        case VMOPCODE_PUSH: case VMOPCODE_POP:
+        case VMOPCODE_NEG:  case VMOPCODE_NOT:
+        case VMOPCODE_AND:  case VMOPCODE_OR:   case VMOPCODE_XOR:
+            return 0;
+        case VMOPCODE_MOV:
+        case VMOPCODE_VLOAD: case VMOPCODE_VSTORE: case VMOPCODE_VSPLAT:
+        case VMOPCODE_VSUM:  case VMOPCODE_VSUMS:  case VMOPCODE_VSUMF:
+            return 1;
+        case VMOPCODE_MCMP:  case VMOPCODE_MFIND:
+            return 2;
+        case VMOPCODE_MCOPY: case VMOPCODE_MFILL:
+            return -1;
+        default:
+            // the rest with three operands computes into the last one
+            return getOperandCount(opcode) == 3 && !isConditionalJump(opcode) ? 2 : -1;
+    }
+}
+
+bool isConditionalJump(u8 opcode) {
+    return (opcode >= VMOPCODE_JEQ && opcode <= VMOPCODE_JLE) || (opcode >= VMOPCODE_JGTS && opcode <= VMOPCODE_JLEF);
+}
+
+bool hasTarget(u8 opcode) {
+    return opcode == VMOPCODE_JMP || opcode == VMOPCODE_CALL || isConditionalJump(opcode);
+}
+
+bool isVectorOperand(u8 opcode, s32 index) {
+    switch (opcode) {
+        case VMOPCODE_VLOAD:
+        case VMOPCODE_VSPLAT:
+            return index == 1;
+        case VMOPCODE_VSTORE:
+        case VMOPCODE_VEXTRACT:
+        case VMOPCODE_VSUM: case VMOPCODE_VSUMS: case VMOPCODE_VSUMF:
+            return index == 0;
+        default:
+            return opcode >= VMOPCODE_VADD && opcode <= VMOPCODE_VSHUF;
+    }
+}
+
+static bool hasRegister(u8 type) {
+    return type == VMOPTYPE_REGISTER || type == VMOPTYPE_INDIRECT || type == VMOPTYPE_DISPLACEMENT || type == VMOPTYPE_VECTOR;
+}
+
+static u8 getSizeLog2(VMOperandSize size) {
+    switch (size) {
+        case VMOPSIZE_QWORD: return 3;
+        case VMOPSIZE_DWORD: return 2;
+        case VMOPSIZE_WORD:  return 1;
+        default:             return 0;
+    }
+}
+
+struct StreamWriter {
+    memory_view<u8> &stream;
+    u64 cursor;
+    bool overflow;
+
+    void put(u8 byte) {
+        if (cursor >= stream.size()) {
+            overflow = true;
+            return;
+        }
+        stream[cursor++] = byte;
+    }
+
+    void putVarint(u64 value) {
+        do {
+            u8 byte = value & 0x7f;
+            value >>= 7;
+            put(value ? byte | 0x80 : byte);
+        } while (value);
+    }
+};
+
+static void encodeOperand(StreamWriter &writer, VMOperand const &operand) {
+    writer.put((u8) ((operand.type & VMDESCRIPTOR_TYPE_MASK) | (getSizeLog2(operand.size) << VMDESCRIPTOR_SIZE_SHIFT)));
+    if (hasRegister(operand.type)) {
+        writer.put(operand.registerIndex);
+    }
+
+    switch (operand.type) {
+        case VMOPTYPE_IMMEDIATE:
+            for (u8 i = 0; i < operand.size; ++i) {
+                writer.put(operand.value.ubytes[i]);
+            }
+        break;
+        case VMOPTYPE_POINTER:
+            writer.putVarint(operand.value.u);
+        break;
+        case VMOPTYPE_DISPLACEMENT:
+            // zigzag so small negative displacements stay short
+            writer.putVarint(((u64) operand.value.s << 1) ^ (u64) (operand.value.s >> 63));
+        break;
+        default:
+        break;
+    }
+}
+
+bool encodeInstruction(VMInstruction const &inst, memory_view<u8> &stream, u64 &cursor, u64 *ends) {
+    s32 count = getOperandCount(inst.opcode);
+    if (count < 0) return false;
+
+    StreamWriter writer { stream, cursor, false };
+    VMOperand const *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    writer.put((u8) inst.opcode);
+    for (s32 i = 0; i < count; ++i) {
+        encodeOperand(writer, *operands[i]);
+        if (ends != nullptr) ends[i] = writer.cursor;
+    }
+
+    if (writer.overflow) return false;
+    cursor = writer.cursor;
+    return true;
+}
+
+bool encodeBytecode(memory_view<VMInstruction> &instructions, memory_view<u8> &stream, u64 &length) {
+    length = 0;
+    for (u64 i = 0; i < instructions.length(); ++i) {
+        if (!encodeInstruction(instructions[i], stream, length)) return false;
+    }
+    return true;
+}
+
+struct StreamReader {
+    memory_view<u8> &stream;
+    u64 cursor;
+    u64 length;
+
+    bool get(u8 &byte) {
+        if (cursor >= length) return false;
+        byte = stream[cursor++];
+        return true;
+    }
+
+    bool getVarint(u64 &value) {
+        value = 0;
+        for (u8 shift = 0; shift < 64; shift += 7) {
+            u8 byte;
+            if (!get(byte)) return false;
+            value |= (u64) (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+// reads an operand as it was encoded, `vector` says whether it must be a
+// vector register, no handler has to tell vector and scalar operands apart
+static VMDecodeStatus readOperand(StreamReader &reader, VMOperand &operand, bool vector) {
+    u8 descriptor;
+    if (!reader.get(descriptor)) return VMDECODE_UNEXPECTED_END;
+
+    u8 type = descriptor & VMDESCRIPTOR_TYPE_MASK;
+    if (type > VMOPTYPE_VECTOR || descriptor >> (VMDESCRIPTOR_SIZE_SHIFT + 2)) {
+        return VMDECODE_INVALID_OPERAND;
+    }
+    if ((type == VMOPTYPE_VECTOR) != vector) return VMDECODE_INVALID_OPERAND;
+
+    operand = {};
+    operand.type = (VMOperandType) type;
+    operand.size = (VMOperandSize) (1 << ((descriptor >> VMDESCRIPTOR_SIZE_SHIFT) & VMDESCRIPTOR_SIZE_MASK));
+    if (hasRegister(type) && !reader.get(operand.registerIndex)) {
+        return VMDECODE_UNEXPECTED_END;
+    }
+
+    switch (type) {
+        case VMOPTYPE_IMMEDIATE:
+            for (u8 i = 0; i < operand.size; ++i) {
+                if (!reader.get(operand.value.ubytes[i])) return VMDECODE_UNEXPECTED_END;
+            }
+        break;
+        case VMOPTYPE_POINTER:
+            if (!reader.getVarint(operand.value.u)) return VMDECODE_UNEXPECTED_END;
+        break;
+        case VMOPTYPE_DISPLACEMENT: {
+            u64 zigzag;
+            if (!reader.getVarint(zigzag)) return VMDECODE_UNEXPECTED_END;
+            operand.value.s = (s64) (zigzag >> 1) ^ -(s64) (zigzag & 1);
+        } break;
+        default:
+            // registers carry no payload
+        break;
+    }
+    return VMDECODE_OK;
+}
+
+static VMDecodeStatus decodeOperand(StreamReader &reader, VMProgram &program, VMDecodedOperand &operand, u8 opcode, s32 index) {
+    VMOperand encoded;
+    VMDecodeStatus status = readOperand(reader, encoded, isVectorOperand(opcode, index));
+    if (status != VMDECODE_OK) return status;
+
+    operand.type = encoded.type;
+    operand.size = encoded.size;
+    operand.registerIndex = encoded.registerIndex;
+
+    // the jump takes the address as is, see hasTarget
+    if (index == 0 && encoded.type == VMOPTYPE_IMMEDIATE && hasTarget(opcode)) {
+        operand.value = encoded.value.u < VMTARGET_INVALID ? (u32) encoded.value.u : VMTARGET_INVALID;
+        return VMDECODE_OK;
+    }
+
+    switch (encoded.type) {
+        case VMOPTYPE_REGISTER:
+            operand.value = getRegisterOffset(operand.registerIndex, operand.size);
+            return VMDECODE_OK;
+        case VMOPTYPE_IMMEDIATE:
+        case VMOPTYPE_POINTER:
+        case VMOPTYPE_DISPLACEMENT:
+            operand.value = (u32) program.constants.length();
+            if (!program.constants.append(encoded.value)) return VMDECODE_OUT_OF_SPACE;
+            return VMDECODE_OK;
+        default:
+            // indirections and vector registers carry no payload
+            return VMDECODE_OK;
+    }
+}
+
+VMDecodeStatus decodeInstruction(memory_view<u8> &stream, u64 length, u64 &cursor, VMInstruction &inst) {
+    StreamReader reader { stream, cursor, length };
+    u8 opcode;
+    if (!reader.get(opcode)) return VMDECODE_UNEXPECTED_END;
+
+    s32 count = getOperandCount(opcode);
+    if (count < 0) return VMDECODE_UNEXPECTED_OPCODE;
+
+    inst = {};
+    inst.opcode = (VMOPCode) opcode;
+    VMOperand *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    for (s32 i = 0; i < count; ++i) {
+        VMDecodeStatus status = readOperand(reader, *operands[i], isVectorOperand(opcode, i));
+        if (status != VMDECODE_OK) return status;
+    }
+
+    cursor = reader.cursor;
+    return VMDECODE_OK;
+}
+
+VMDecodeStatus decodeBytecode(memory_view<u8> &stream, u64 length, VMProgram &program) {
+    StreamReader reader { stream, 0, length };
+    program.linked = false;
+    program.verified = false;
+    while (reader.cursor < reader.length) {
+        VMDecodedInstruction inst {};
+        u8 opcode;
+        reader.get(opcode);
+
+        s32 count = getOperandCount(opcode);
+        if (count < 0) return VMDECODE_UNEXPECTED_OPCODE;
+        inst.opcode = (VMOPCode) opcode;
+
+        VMDecodeStatus status = VMDECODE_OK;
+        if (count > 0 && status == VMDECODE_OK) status = decodeOperand(reader, program, inst.operand1, opcode, 0);
+        if (count > 1 && status == VMDECODE_OK) status = decodeOperand(reader, program, inst.operand2, opcode, 1);
+        if (count > 2 && status == VMDECODE_OK) status = decodeOperand(reader, program, inst.operand3, opcode, 2);
+        if (status != VMDECODE_OK) return status;
+
+        inst.handler = MetaVM::resolveHandler(inst);
+        inst.dispatch = getDispatch(inst);
+        if (!program.code.append(inst)) return VMDECODE_OUT_OF_SPACE;
+    }
+
+    // the terminating halt, see VMProgram::code
+    VMDecodedInstruction halt {};
+    halt.opcode = VMOPCODE_HLT;
+    halt.dispatch = VMOPCODE_HLT;
+    if (!program.code.append(halt)) return VMDECODE_OUT_OF_SPACE;
+
+    return VMDECODE_OK;
+}
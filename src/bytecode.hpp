@@ -0,0 +1,256 @@
+#if !defined(METAVM_BYTECODE_HPP)
+#define METAVM_BYTECODE_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+
+// encoded instruction stream layout:
+//
+//  instruction := opcode:u8 operand*
+//  operand     := descriptor:u8 [register:u8] [payload]
+//  descriptor  := type (bits 0..2) | log2(size) (bits 3..4)
+//
+// the operand count is implied by the opcode (see getOperandCount)
+// payloads are only present when the addressing mode needs one:
+//  VMOPTYPE_REGISTER     -> register
+//  VMOPTYPE_IMMEDIATE    -> register-less, `size` bytes little endian
+//  VMOPTYPE_POINTER      -> register-less, unsigned LEB128 address
+//  VMOPTYPE_INDIRECT     -> register
+//  VMOPTYPE_DISPLACEMENT -> register, zigzag LEB128 displacement
+//  VMOPTYPE_VECTOR       -> register
+
+constexpr u8 VMDESCRIPTOR_TYPE_MASK  = 0x07;
+constexpr u8 VMDESCRIPTOR_SIZE_SHIFT = 3;
+constexpr u8 VMDESCRIPTOR_SIZE_MASK  = 0x03;
+
+// an operand after pre-decoding, immediates, pointers and displacements live
+// in the program's constant pool so every operand has the same 8 byte shape,
+// registers keep their byte offset into the register file in `value` instead
+// (see getRegisterOffset), and immediate jump and call targets keep the
+// address itself (see hasTarget)
+struct VMDecodedOperand {
+    u8                     type;
+    VMOperandSize          size;
+    u8            registerIndex;
+    u8                 reserved;
+    u32                   value;
+};
+
+// sub registers of a size pack (QWORD / size) of them per register, lowest
+// bytes first, so sub register `index` starts index * size bytes into the
+// register file whatever its size
+inline u32 getRegisterOffset(u8 index, VMOperandSize size) {
+    return (u32) index * size;
+}
+
+struct MetaVM;
+struct VMDecodedInstruction;
+
+// returns false when the instruction raised an exception
+typedef bool (*VMHandler)(MetaVM &vm, VMDecodedInstruction const &inst);
+
+// the internal form the interpreter executes, fetched by reference
+struct VMDecodedInstruction {
+    // handler address for the direct-threaded dispatch engine, filled in
+    // the first time a program runs (see MetaVM::run)
+    void const          *label;
+
+    // operand specialized handler picked by the decoder, null for opcodes
+    // the dispatch loop executes itself (see MetaVM::resolveHandler)
+    VMHandler          handler;
+    VMOPCode           opcode;
+
+    // what the engines dispatch on, see getDispatch, unless fuseProgram
+    // turned the instruction into the head of a superinstruction
+    u8               dispatch;
+    VMDecodedOperand operand1;
+    VMDecodedOperand operand2;
+    VMDecodedOperand operand3;
+};
+
+// dispatch codes of superinstructions, outside of the VMOPCode range so they
+// never appear in a bytecode stream, the instructions a superinstruction
+// covers stay decoded as they were since jumps may still land on them
+enum VMSuperinstruction : u8 {
+    // two or three resolved handlers in a row
+    VMSUPER_OP_OP = 0xe0,
+    VMSUPER_OP_OP_OP,
+
+    // a resolved handler followed by a conditional jump
+    VMSUPER_OP_JEQ,
+    VMSUPER_OP_JNE,
+    VMSUPER_OP_JGT,
+    VMSUPER_OP_JLT,
+    VMSUPER_OP_JGE,
+    VMSUPER_OP_JLE,
+    VMSUPER_OP_JGTS,
+    VMSUPER_OP_JLTS,
+    VMSUPER_OP_JGES,
+    VMSUPER_OP_JLES,
+    VMSUPER_OP_JEQF,
+    VMSUPER_OP_JNEF,
+    VMSUPER_OP_JGTF,
+    VMSUPER_OP_JLTF,
+    VMSUPER_OP_JGEF,
+    VMSUPER_OP_JLEF,
+
+    // a push and the pop right after it, the value goes straight to the
+    // pop's destination instead of through the stack (see MetaVM::pushPop)
+    VMSUPER_PUSH_POP,
+};
+
+// dispatch code of resolved instructions with an operand in r31, which only
+// holds the instruction pointer around these (see MetaVM::execute)
+constexpr u8 VMDISPATCH_SYNCED = 0xdf;
+
+// an entry of a program's exception handler table, an exception in
+// `exceptions` raised by an instruction in [start, end) continues the run at
+// `target` instead of stopping it, with the exception in `exceptionRegister`
+// and the address of the instruction that raised it in `addressRegister`,
+// the first entry that matches wins so nested ranges go first
+struct VMExceptionHandler {
+    u64                 start;
+    u64                   end;
+    u64                target;
+
+    // one bit (1 << VMException) per exception caught
+    u32            exceptions;
+    u8      exceptionRegister;
+    u8        addressRegister;
+    u16              reserved;
+};
+
+struct VMProgram {
+    // decoded instructions, always terminated by an extra VMOPCODE_HLT so
+    // falling off the end of the code halts without a bounds check
+    array_view<VMDecodedInstruction> code;
+    array_view<VMWord>          constants;
+
+    // set once the direct-threaded engine has stored its handler addresses
+    bool                           linked;
+
+    // set by verifyProgram, verified programs run without operand checks
+    bool                         verified;
+
+    // the exception handler table, none unless a module or the host set one
+    VMExceptionHandler const    *handlers = nullptr;
+    u64                      handlerCount = 0;
+};
+
+enum VMDecodeStatus {
+    VMDECODE_OK,
+    VMDECODE_UNEXPECTED_END,
+    VMDECODE_UNEXPECTED_OPCODE,
+    VMDECODE_INVALID_OPERAND,
+    VMDECODE_OUT_OF_SPACE,
+};
+
+inline const char *getDecodeStatusName(VMDecodeStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMDECODE_OK);
+        stname(VMDECODE_UNEXPECTED_END);
+        stname(VMDECODE_UNEXPECTED_OPCODE);
+        stname(VMDECODE_INVALID_OPERAND);
+        stname(VMDECODE_OUT_OF_SPACE);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// returns the number of operands an opcode carries, or -1 for unknown opcodes
+s32 getOperandCount(u8 opcode);
+
+// the operand (from 0) an opcode leaves its result in, -1 for opcodes that
+// have none or only write a range of memory, a push's is the value pushed
+s32 getDestinationOperand(u8 opcode);
+
+// whether an opcode jumps if its comparison holds, the target is its first
+// operand and the two values compared the others
+bool isConditionalJump(u8 opcode);
+
+// whether the first operand of an opcode is a jump or call target, the
+// decoder resolves immediate targets to the address itself, which is kept in
+// the operand's `value` instead of the constant pool, targets past
+// VMTARGET_INVALID become it, it's never inside the code
+bool hasTarget(u8 opcode);
+constexpr u32 VMTARGET_INVALID = ~0u;
+
+// whether operand `index` (from 0) of an opcode is a vector register, every
+// other operand is a scalar one, the decoder rejects anything else
+bool isVectorOperand(u8 opcode, s32 index);
+
+// writes the compact encoding of `instructions` to `stream`, `length` receives
+// the number of bytes written, returns false if the stream is too small
+bool encodeBytecode(memory_view<VMInstruction> &instructions, memory_view<u8> &stream, u64 &length);
+
+// writes the compact encoding of one instruction to `stream` at `cursor` and
+// moves the cursor past it, `ends` receives where the encoding of each operand
+// ends (an immediate's payload is its last `size` bytes), returns false and
+// leaves the cursor alone if the stream is too small or the opcode unknown
+bool encodeInstruction(VMInstruction const &inst, memory_view<u8> &stream, u64 &cursor, u64 *ends = nullptr);
+
+// reads the instruction at `cursor` of the first `length` bytes of `stream`
+// back into the form it was encoded from and moves the cursor past it
+VMDecodeStatus decodeInstruction(memory_view<u8> &stream, u64 length, u64 &cursor, VMInstruction &inst);
+
+// pre-decodes the first `length` bytes of `stream` into `program`
+VMDecodeStatus decodeBytecode(memory_view<u8> &stream, u64 length, VMProgram &program);
+
+enum VMVerifyStatus {
+    VMVERIFY_OK,
+    VMVERIFY_INVALID_OPERANDS,
+    VMVERIFY_INVALID_REGISTER,
+    VMVERIFY_INVALID_TARGET,
+};
+
+inline const char *getVerifyStatusName(VMVerifyStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMVERIFY_OK);
+        stname(VMVERIFY_INVALID_OPERANDS);
+        stname(VMVERIFY_INVALID_REGISTER);
+        stname(VMVERIFY_INVALID_TARGET);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+struct VMVerifyResult {
+    VMVerifyStatus status;
+    // the first instruction that failed verification
+    u64             index;
+};
+
+// checks every instruction of a decoded program once, rejecting the operand
+// combinations the handlers would raise VMEXCEPT_INVALID_OPERANDS for, register
+// indices outside the register file and static jump or call targets outside
+// the code, MOVs of immediates to r31 included, on success the program is
+// marked verified and its handlers are re-resolved to their unchecked
+// instances, the engines still check every other write to r31, the
+// verifier can't know where it goes
+VMVerifyResult verifyProgram(VMProgram &program);
+
+struct VMProfile;
+
+// peephole pass over a decoded program, marks every instruction that starts
+// a fusable pair or triple as a superinstruction (see VMSuperinstruction),
+// with a profile only instructions executed at least `threshold` times are
+// fused, returns the number of superinstructions
+u64 fuseProgram(VMProgram &program, VMProfile const *profile = nullptr, u64 threshold = 1);
+
+// the dispatch code fuseProgram gives the instruction at `address` when it
+// is hot, getDispatch if it can't start a superinstruction
+u8 getSuperinstruction(VMProgram const &program, u64 address);
+
+// the dispatch code of an instruction on its own, its opcode unless it's
+// resolved and uses r31, then VMDISPATCH_SYNCED
+u8 getDispatch(VMDecodedInstruction const &inst);
+
+#endif
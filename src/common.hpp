@@ -20,10 +20,12 @@ inline void *default_allocator(u64 size, u64 alignment = sizeof(u64), void *prev
     u64 aligned = memory::align(size, alignment);
     if (previousMemory == nullptr) {
         void *result = std::malloc(aligned);
+        if (result == nullptr) return nullptr;
         std::memset(result, 0, aligned);
         return result;
     }
     void *newMemory = std::realloc(previousMemory, aligned);
+    if (newMemory == nullptr) return nullptr;
     if (size > previousSize) {
         std::memset(((u8 *) newMemory) + previousSize, 0, size - previousSize);    
     }
@@ -0,0 +1,194 @@
+#include <cmath>
+#include <cstdarg>
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "disassembler.hpp"
+
+// immediates up to this magnitude are written in decimal
+constexpr u64 VMDISASSEMBLE_DECIMAL_LIMIT = 0x10000;
+
+// the column the address comments of disassemble start at
+constexpr u64 VMDISASSEMBLE_COMMENT_COLUMN = 40;
+
+struct TextWriter {
+    memory_view<char> &text;
+    u64 cursor;
+    bool overflow;
+
+    void put(char const *format, ...) {
+        char buffer[64];
+        va_list arguments;
+        va_start(arguments, format);
+        int length = std::vsnprintf(buffer, sizeof(buffer), format, arguments);
+        va_end(arguments);
+
+        if (length < 0 || cursor + length > text.size()) {
+            overflow = true;
+            return;
+        }
+        std::memcpy(&text[cursor], buffer, length);
+        cursor += length;
+    }
+};
+
+// whether immediate operand `index` of an opcode is a float, at its size,
+// the target of a float comparison's jump isn't
+static bool isFloatOperand(u8 opcode, s32 index) {
+    if (opcode >= VMOPCODE_JEQF && opcode <= VMOPCODE_JLEF) return index != 0;
+    return opcode >= VMOPCODE_ADDF && opcode <= VMOPCODE_DIVFS;
+}
+
+static char getSizeLetter(VMOperandSize size) {
+    switch (size) {
+        case VMOPSIZE_BYTE:  return 'b';
+        case VMOPSIZE_WORD:  return 'w';
+        case VMOPSIZE_DWORD: return 'd';
+        default:             return 'q';
+    }
+}
+
+// the :size suffix, qwords go without one
+static void putSize(TextWriter &writer, VMOperandSize size) {
+    if (size != VMOPSIZE_QWORD) writer.put(":%c", getSizeLetter(size));
+}
+
+// returns false for values that have no float literal, they're written as
+// their bits instead
+static bool putFloat(TextWriter &writer, VMOperand const &operand) {
+    f64 value = operand.size == VMOPSIZE_DWORD ? operand.value.fsingles[0] : operand.value.f;
+    if (!std::isfinite(value)) return false;
+
+    // the assembler takes anything without a fraction or an exponent for
+    // an integer
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), operand.size == VMOPSIZE_DWORD ? "%.9g" : "%.17g", value);
+    bool integral = std::strpbrk(buffer, ".e") == nullptr;
+    writer.put(integral ? "%s.0" : "%s", buffer);
+    return true;
+}
+
+static void putImmediate(TextWriter &writer, bool floating, VMOperand const &operand) {
+    if (floating && operand.size >= VMOPSIZE_DWORD && putFloat(writer, operand)) {
+        putSize(writer, operand.size);
+        return;
+    }
+
+    u64 bits = 8 * operand.size;
+    u64 value = bits == 64 ? operand.value.u : operand.value.u & ((1ull << bits) - 1);
+    s64 sign = bits == 64 ? operand.value.s : (s64) (value << (64 - bits)) >> (64 - bits);
+    if (value < VMDISASSEMBLE_DECIMAL_LIMIT) {
+        writer.put("%llu", value);
+    } else if (sign < 0 && sign > -(s64) VMDISASSEMBLE_DECIMAL_LIMIT) {
+        writer.put("-%llu", (u64) -sign);
+    } else {
+        writer.put("%#llx", value);
+    }
+    putSize(writer, operand.size);
+}
+
+static void putOperand(TextWriter &writer, bool floating, VMOperand const &operand) {
+    switch (operand.type) {
+        case VMOPTYPE_REGISTER: {
+            // sub registers of a size pack QWORD / size of them per register
+            u8 parts = VMOPSIZE_QWORD / operand.size;
+            writer.put("r%u", operand.registerIndex / parts);
+            if (operand.size != VMOPSIZE_QWORD) writer.put(".%c%u", getSizeLetter(operand.size), operand.registerIndex % parts);
+        } break;
+        case VMOPTYPE_IMMEDIATE:
+            putImmediate(writer, floating, operand);
+        break;
+        case VMOPTYPE_POINTER:
+            writer.put("[%llu]", operand.value.u);
+            putSize(writer, operand.size);
+        break;
+        case VMOPTYPE_INDIRECT:
+            writer.put("[r%u]", operand.registerIndex);
+            putSize(writer, operand.size);
+        break;
+        case VMOPTYPE_DISPLACEMENT:
+            if (operand.value.s < 0) {
+                writer.put("[r%u-%llu]", operand.registerIndex, 0 - operand.value.u);
+            } else {
+                writer.put("[r%u+%llu]", operand.registerIndex, operand.value.u);
+            }
+            putSize(writer, operand.size);
+        break;
+        default:
+            writer.put("v%u", operand.registerIndex);
+            putSize(writer, operand.size);
+        break;
+    }
+}
+
+// whether every operand of a known opcode has a type and a size it can have
+static bool isValidInstruction(VMInstruction const &inst) {
+    s32 count = getOperandCount(inst.opcode);
+    VMOperand const *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    for (s32 i = 0; i < count; ++i) {
+        VMOperandSize size = operands[i]->size;
+        if (operands[i]->type > VMOPTYPE_VECTOR) return false;
+        if (size != VMOPSIZE_BYTE && size != VMOPSIZE_WORD && size != VMOPSIZE_DWORD && size != VMOPSIZE_QWORD) return false;
+    }
+    return count >= 0;
+}
+
+bool disassembleInstruction(VMInstruction const &inst, memory_view<char> &text, u64 &cursor) {
+    if (!isValidInstruction(inst)) return false;
+    s32 count = getOperandCount(inst.opcode);
+
+    TextWriter writer { text, cursor, false };
+
+    // the opcode's name without VMOPCODE_, in lower case
+    char mnemonic[32];
+    std::snprintf(mnemonic, sizeof(mnemonic), "%s", getOPCodeName(inst.opcode));
+    for (char *c = mnemonic; *c != '\0'; ++c) {
+        if (*c >= 'A' && *c <= 'Z') *c += 'a' - 'A';
+    }
+    writer.put("%s", mnemonic + sizeof("VMOPCODE_") - 1);
+
+    VMOperand const *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    for (s32 i = 0; i < count; ++i) {
+        writer.put(i == 0 ? " " : ", ");
+        putOperand(writer, isFloatOperand(inst.opcode, i), *operands[i]);
+    }
+
+    if (writer.overflow) return false;
+    cursor = writer.cursor;
+    return true;
+}
+
+// the instruction, padded to the comment column, and its address
+static bool disassembleLine(VMInstruction const &inst, u64 address, memory_view<char> &text, u64 &cursor) {
+    u64 start = cursor;
+    TextWriter writer { text, cursor, false };
+    writer.put("    ");
+    if (writer.overflow || !disassembleInstruction(inst, text, writer.cursor)) return false;
+
+    u64 width = writer.cursor - start;
+    writer.put("%*s; %llu\n", (int) (width < VMDISASSEMBLE_COMMENT_COLUMN ? VMDISASSEMBLE_COMMENT_COLUMN - width : 1), "", address);
+    if (writer.overflow) return false;
+    cursor = writer.cursor;
+    return true;
+}
+
+VMDisassembleStatus disassemble(memory_view<VMInstruction> &instructions, memory_view<char> &text, u64 &length) {
+    length = 0;
+    for (u64 i = 0; i < instructions.length(); ++i) {
+        if (!isValidInstruction(instructions[i])) return VMDISASSEMBLE_INVALID_CODE;
+        if (!disassembleLine(instructions[i], i, text, length)) return VMDISASSEMBLE_OUT_OF_SPACE;
+    }
+    return VMDISASSEMBLE_OK;
+}
+
+VMDisassembleStatus disassembleBytecode(memory_view<u8> &stream, u64 streamLength, memory_view<char> &text, u64 &length) {
+    length = 0;
+    u64 cursor = 0;
+    for (u64 address = 0; cursor < streamLength; ++address) {
+        VMInstruction inst;
+        if (decodeInstruction(stream, streamLength, cursor, inst) != VMDECODE_OK) return VMDISASSEMBLE_INVALID_CODE;
+        if (!disassembleLine(inst, address, text, length)) return VMDISASSEMBLE_OUT_OF_SPACE;
+    }
+    return VMDISASSEMBLE_OK;
+}
@@ -0,0 +1,48 @@
+#if !defined(METAVM_DISASSEMBLER_HPP)
+#define METAVM_DISASSEMBLER_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+
+// turns instructions back into the text the assembler reads (see
+// assembler.hpp), assembling the text again gives the same bytecode
+//
+// jump and call targets come out as addresses since instructions carry no
+// labels, immediates of the float opcodes as floats, small immediates in
+// decimal and the rest in hexadecimal
+
+enum VMDisassembleStatus {
+    VMDISASSEMBLE_OK,
+    VMDISASSEMBLE_INVALID_CODE,
+    VMDISASSEMBLE_OUT_OF_SPACE,
+};
+
+inline const char *getDisassembleStatusName(VMDisassembleStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMDISASSEMBLE_OK);
+        stname(VMDISASSEMBLE_INVALID_CODE);
+        stname(VMDISASSEMBLE_OUT_OF_SPACE);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// writes one instruction, without a newline, to `text` at `cursor` and moves
+// the cursor past it, returns false and leaves the cursor alone if the text
+// doesn't fit or the instruction can't be encoded
+bool disassembleInstruction(VMInstruction const &inst, memory_view<char> &text, u64 &cursor);
+
+// writes one line per instruction, each followed by a comment with its
+// address, `length` receives the number of characters written
+VMDisassembleStatus disassemble(memory_view<VMInstruction> &instructions, memory_view<char> &text, u64 &length);
+
+// the same for the first `streamLength` bytes of a bytecode stream, e.g. the
+// code section of a module
+VMDisassembleStatus disassembleBytecode(memory_view<u8> &stream, u64 streamLength, memory_view<char> &text, u64 &length);
+
+#endif
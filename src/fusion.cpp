@@ -0,0 +1,111 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "profile.hpp"
+
+// the engines keep the instruction pointer in a local and r31 only holds it
+// around instructions dispatched as VMDISPATCH_SYNCED, any operand that
+// reads or writes r31 makes one
+static bool usesInstructionPointer(VMDecodedOperand const &operand) {
+    switch (operand.type) {
+        case VMOPTYPE_REGISTER:
+            return getRegisterOffset(operand.registerIndex, operand.size) / sizeof(VMWord) == REGISTER_COUNT - 1;
+        case VMOPTYPE_INDIRECT:
+        case VMOPTYPE_DISPLACEMENT:
+            return operand.registerIndex == REGISTER_COUNT - 1;
+        default:
+            return false;
+    }
+}
+
+static bool usesInstructionPointer(VMDecodedInstruction const &inst) {
+    s32 count = getOperandCount(inst.opcode);
+    VMDecodedOperand const *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    for (s32 i = 0; i < count; ++i) {
+        if (usesInstructionPointer(*operands[i])) return true;
+    }
+    return false;
+}
+
+u8 getDispatch(VMDecodedInstruction const &inst) {
+    if (inst.handler != nullptr && usesInstructionPointer(inst)) return VMDISPATCH_SYNCED;
+    return inst.opcode;
+}
+
+// superinstructions run their parts back to back without ever syncing r31,
+// so none of them may use it
+static bool isFusable(VMDecodedInstruction const &inst) {
+    return inst.handler != nullptr && !usesInstructionPointer(inst);
+}
+
+static bool usesStackPointer(VMDecodedOperand const &operand) {
+    switch (operand.type) {
+        case VMOPTYPE_REGISTER:
+            return getRegisterOffset(operand.registerIndex, operand.size) / sizeof(VMWord) == REGISTER_COUNT - 2;
+        case VMOPTYPE_INDIRECT:
+        case VMOPTYPE_DISPLACEMENT:
+            return operand.registerIndex == REGISTER_COUNT - 2;
+        default:
+            return false;
+    }
+}
+
+// a pushed value that is popped right away can be renamed into the pop's
+// destination, unless either operand sees the stack pointer move in between
+static bool isRenamable(VMDecodedInstruction const &push, VMDecodedInstruction const &pop) {
+    if (push.opcode != VMOPCODE_PUSH || pop.opcode != VMOPCODE_POP) return false;
+    if (pop.operand1.type == VMOPTYPE_IMMEDIATE || pop.operand1.size != push.operand1.size) return false;
+    if (usesInstructionPointer(push) || usesInstructionPointer(pop)) return false;
+    return !usesStackPointer(push.operand1) && !usesStackPointer(pop.operand1);
+}
+
+static u8 getFusedBranch(VMOPCode opcode) {
+    switch (opcode) {
+        case VMOPCODE_JEQ: return VMSUPER_OP_JEQ;
+        case VMOPCODE_JNE: return VMSUPER_OP_JNE;
+        case VMOPCODE_JGT: return VMSUPER_OP_JGT;
+        case VMOPCODE_JLT: return VMSUPER_OP_JLT;
+        case VMOPCODE_JGE: return VMSUPER_OP_JGE;
+        case VMOPCODE_JLE: return VMSUPER_OP_JLE;
+        case VMOPCODE_JGTS: return VMSUPER_OP_JGTS;
+        case VMOPCODE_JLTS: return VMSUPER_OP_JLTS;
+        case VMOPCODE_JGES: return VMSUPER_OP_JGES;
+        case VMOPCODE_JLES: return VMSUPER_OP_JLES;
+        case VMOPCODE_JEQF: return VMSUPER_OP_JEQF;
+        case VMOPCODE_JNEF: return VMSUPER_OP_JNEF;
+        case VMOPCODE_JGTF: return VMSUPER_OP_JGTF;
+        case VMOPCODE_JLTF: return VMSUPER_OP_JLTF;
+        case VMOPCODE_JGEF: return VMSUPER_OP_JGEF;
+        case VMOPCODE_JLEF: return VMSUPER_OP_JLEF;
+        default:           return 0;
+    }
+}
+
+u8 getSuperinstruction(VMProgram const &program, u64 address) {
+    VMDecodedInstruction const &inst = program.code[address];
+    if (!isFusable(inst)) return getDispatch(inst);
+
+    // the terminating halt is never fusable, so looking one or two
+    // instructions ahead of a fusable one stays in range
+    VMDecodedInstruction const &next = program.code[address + 1];
+    if (isRenamable(inst, next)) return VMSUPER_PUSH_POP;
+    if (u8 branch = getFusedBranch(next.opcode)) return branch;
+    if (!isFusable(next)) return getDispatch(inst);
+    return isFusable(program.code[address + 2]) ? VMSUPER_OP_OP_OP : VMSUPER_OP_OP;
+}
+
+u64 fuseProgram(VMProgram &program, VMProfile const *profile, u64 threshold) {
+    u64 fused = 0;
+
+    // superinstructions may overlap, every head gets the longest one
+    for (u64 i = 0; i < program.code.length(); ++i) {
+        VMDecodedInstruction &inst = program.code[i];
+        bool hot = profile == nullptr || (i < profile->entries.length() && profile->entries[i].executions >= threshold);
+        inst.dispatch = hot ? getSuperinstruction(program, i) : getDispatch(inst);
+        if (inst.dispatch != getDispatch(inst)) fused++;
+    }
+
+    // the direct-threaded engine links labels by dispatch code
+    program.linked = false;
+    return fused;
+}
@@ -0,0 +1,400 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "jit.hpp"
+
+#if defined(METAVM_JIT)
+
+#include <sys/mman.h>
+
+// functions larger than this stay interpreted
+constexpr u64 JIT_MAX_INSTRUCTIONS = 4096;
+
+// worst case size of one instruction's template
+constexpr u64 JIT_MAX_TEMPLATE_SIZE = 96;
+
+enum X64Register : u8 {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15,
+};
+
+// compiled code is called as VMJitFunction, so these are its arguments
+constexpr X64Register REGISTERS_BASE = RDI;
+constexpr X64Register MEMORY_BASE    = RSI;
+
+enum X64Alu : u8 {
+    X64_ADD = 0x01,
+    X64_OR  = 0x09,
+    X64_AND = 0x21,
+    X64_SUB = 0x29,
+    X64_XOR = 0x31,
+    X64_CMP = 0x39,
+};
+
+enum X64Condition : u8 {
+    X64_B  = 0x2,
+    X64_AE = 0x3,
+    X64_E  = 0x4,
+    X64_NE = 0x5,
+    X64_BE = 0x6,
+    X64_A  = 0x7,
+    X64_L  = 0xc,
+    X64_GE = 0xd,
+    X64_LE = 0xe,
+    X64_G  = 0xf,
+};
+
+struct X64Emitter {
+    u8 *code;
+    u64 cursor;
+
+    void byte(u8 value) {
+        code[cursor++] = value;
+    }
+
+    void dword(u32 value) {
+        std::memcpy(code + cursor, &value, sizeof(value));
+        cursor += sizeof(value);
+    }
+
+    void qword(u64 value) {
+        std::memcpy(code + cursor, &value, sizeof(value));
+        cursor += sizeof(value);
+    }
+
+    void rex(u8 reg, u8 index, u8 base) {
+        byte(0x48 | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+    }
+
+    // opcode reg, [base + displacement]
+    void memory(u8 opcode, u8 reg, u8 base, s32 displacement) {
+        rex(reg, 0, base);
+        byte(opcode);
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) byte(0x24);
+        dword((u32) displacement);
+    }
+
+    // opcode reg, [base + index]
+    void indexed(u8 opcode, u8 reg, u8 base, u8 index) {
+        rex(reg, index, base);
+        byte(opcode);
+        byte(((reg & 7) << 3) | RSP);
+        byte(((index & 7) << 3) | (base & 7));
+    }
+
+    void load(u8 reg, u8 base, s32 displacement) { memory(0x8b, reg, base, displacement); }
+    void store(u8 base, s32 displacement, u8 reg) { memory(0x89, reg, base, displacement); }
+    void loadIndexed(u8 reg, u8 base, u8 index) { indexed(0x8b, reg, base, index); }
+    void storeIndexed(u8 base, u8 index, u8 reg) { indexed(0x89, reg, base, index); }
+
+    void moveImmediate(u8 reg, u64 value) {
+        rex(0, 0, reg);
+        byte(0xb8 | (reg & 7));
+        qword(value);
+    }
+
+    void alu(X64Alu opcode, u8 dst, u8 src) {
+        rex(src, 0, dst);
+        byte(opcode);
+        byte(0xc0 | ((src & 7) << 3) | (dst & 7));
+    }
+
+    void imul(u8 dst, u8 src) {
+        rex(dst, 0, src);
+        byte(0x0f);
+        byte(0xaf);
+        byte(0xc0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    // neg (3) and not (2) share an opcode
+    void unary(u8 extension, u8 reg) {
+        rex(0, 0, reg);
+        byte(0xf7);
+        byte(0xc0 | (extension << 3) | (reg & 7));
+    }
+
+    // returns the position of the rel32 to patch
+    u64 jump() {
+        byte(0xe9);
+        dword(0);
+        return cursor - sizeof(u32);
+    }
+
+    u64 jump(X64Condition condition) {
+        byte(0x0f);
+        byte(0x80 | condition);
+        dword(0);
+        return cursor - sizeof(u32);
+    }
+
+    void patch(u64 position, u64 target) {
+        s32 relative = (s32) ((s64) target - (s64) (position + sizeof(u32)));
+        std::memcpy(code + position, &relative, sizeof(relative));
+    }
+
+    void ret() {
+        byte(0xc3);
+    }
+};
+
+VMJit::VMJit(VMProgram &program, memory_view<VMJitEntry> &entries, u64 capacity) :
+    _program(program),
+    _entries(entries),
+    _code(nullptr),
+    _capacity(memory::align(capacity, KB(4))),
+    _cursor(0)
+{
+    void *code = mmap(nullptr, _capacity, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        // every function stays interpreted
+        threshold = ~0u;
+        return;
+    }
+    _code = (u8 *) code;
+}
+
+VMJit::~VMJit() {
+    if (_code != nullptr) {
+        munmap(_code, _capacity);
+    }
+}
+
+static bool isQwordOperand(VMDecodedOperand const &operand) {
+    // r31 (the instruction pointer) is stale inside compiled code
+    bool usesRegister = operand.type != VMOPTYPE_IMMEDIATE && operand.type != VMOPTYPE_POINTER;
+    return operand.size == VMOPSIZE_QWORD && !(usesRegister && operand.registerIndex == 31);
+}
+
+static bool isTargetInRange(VMProgram &program, VMDecodedOperand const &target) {
+    return target.type == VMOPTYPE_IMMEDIATE && target.value < program.code.length();
+}
+
+// whether `inst` has a template, everything else exits to the interpreter
+static bool isCompilable(VMProgram &program, VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &op1 = inst.operand1;
+    VMDecodedOperand const &op2 = inst.operand2;
+    VMDecodedOperand const &op3 = inst.operand3;
+
+    switch (inst.opcode) {
+        case VMOPCODE_NOP:
+            return true;
+        case VMOPCODE_MOV:
+            return isQwordOperand(op1) && isQwordOperand(op2) && op2.type != VMOPTYPE_IMMEDIATE;
+        case VMOPCODE_NEG:
+        case VMOPCODE_NOT:
+            return isQwordOperand(op1) && op1.type != VMOPTYPE_IMMEDIATE;
+        case VMOPCODE_ADD:  case VMOPCODE_SUB:  case VMOPCODE_MUL:
+        case VMOPCODE_ADDS: case VMOPCODE_SUBS: case VMOPCODE_MULS:
+            return isQwordOperand(op1) && isQwordOperand(op2) && isQwordOperand(op3) && op3.type != VMOPTYPE_IMMEDIATE;
+        case VMOPCODE_AND:  case VMOPCODE_OR:   case VMOPCODE_XOR:
+            return isQwordOperand(op1) && isQwordOperand(op2) && isQwordOperand(op3) && op1.type != VMOPTYPE_IMMEDIATE;
+        case VMOPCODE_JMP:
+            return isTargetInRange(program, op1);
+        case VMOPCODE_JEQ:  case VMOPCODE_JNE:  case VMOPCODE_JGT:
+        case VMOPCODE_JLT:  case VMOPCODE_JGE:  case VMOPCODE_JLE:
+        case VMOPCODE_JGTS: case VMOPCODE_JLTS: case VMOPCODE_JGES: case VMOPCODE_JLES:
+            return isTargetInRange(program, op1) && isQwordOperand(op2) && isQwordOperand(op3);
+        default:
+            return false;
+    }
+}
+
+struct JitCompiler {
+    VMProgram &program;
+    X64Emitter emitter;
+
+    // computes the memory offset of a memory operand into `reg`, clobbers r10
+    void address(u8 reg, VMDecodedOperand const &operand) {
+        switch (operand.type) {
+            case VMOPTYPE_POINTER:
+                emitter.moveImmediate(reg, program.constants[operand.value].u);
+            break;
+            case VMOPTYPE_INDIRECT:
+                emitter.load(reg, REGISTERS_BASE, operand.registerIndex * sizeof(VMWord));
+            break;
+            default:
+                emitter.load(reg, REGISTERS_BASE, operand.registerIndex * sizeof(VMWord));
+                emitter.moveImmediate(R10, program.constants[operand.value].u);
+                emitter.alu(X64_ADD, reg, R10);
+            break;
+        }
+    }
+
+    void load(u8 reg, VMDecodedOperand const &operand) {
+        switch (operand.type) {
+            case VMOPTYPE_REGISTER:
+                emitter.load(reg, REGISTERS_BASE, operand.registerIndex * sizeof(VMWord));
+            break;
+            case VMOPTYPE_IMMEDIATE:
+                emitter.moveImmediate(reg, program.constants[operand.value].u);
+            break;
+            default:
+                address(reg, operand);
+                emitter.loadIndexed(reg, MEMORY_BASE, reg);
+            break;
+        }
+    }
+
+    void store(VMDecodedOperand const &operand, u8 reg) {
+        if (operand.type == VMOPTYPE_REGISTER) {
+            emitter.store(REGISTERS_BASE, operand.registerIndex * sizeof(VMWord), reg);
+            return;
+        }
+        address(R11, operand);
+        emitter.storeIndexed(MEMORY_BASE, R11, reg);
+    }
+
+    void exit(u64 address) {
+        emitter.moveImmediate(RAX, address);
+        emitter.ret();
+    }
+
+    // emits the template of a compilable instruction, jumps leave the position
+    // of their rel32 in `patch`
+    void emit(VMDecodedInstruction const &inst, u64 &patch) {
+        VMDecodedOperand const &op1 = inst.operand1;
+        VMDecodedOperand const &op2 = inst.operand2;
+        VMDecodedOperand const &op3 = inst.operand3;
+
+        switch (inst.opcode) {
+            case VMOPCODE_MOV:
+                load(RAX, op1);
+                store(op2, RAX);
+            break;
+            case VMOPCODE_NEG:
+            case VMOPCODE_NOT:
+                load(RAX, op1);
+                emitter.unary(inst.opcode == VMOPCODE_NEG ? 3 : 2, RAX);
+                store(op1, RAX);
+            break;
+            case VMOPCODE_ADD: case VMOPCODE_ADDS:
+            case VMOPCODE_SUB: case VMOPCODE_SUBS:
+            case VMOPCODE_MUL: case VMOPCODE_MULS:
+                load(RAX, op1);
+                load(RCX, op2);
+                if (inst.opcode == VMOPCODE_MUL || inst.opcode == VMOPCODE_MULS) {
+                    // the low qword of a product doesn't depend on signedness
+                    emitter.imul(RAX, RCX);
+                } else {
+                    bool add = inst.opcode == VMOPCODE_ADD || inst.opcode == VMOPCODE_ADDS;
+                    emitter.alu(add ? X64_ADD : X64_SUB, RAX, RCX);
+                }
+                store(op3, RAX);
+            break;
+            case VMOPCODE_AND:
+            case VMOPCODE_OR:
+            case VMOPCODE_XOR:
+                load(RAX, op2);
+                load(RCX, op3);
+                emitter.alu(inst.opcode == VMOPCODE_AND ? X64_AND : inst.opcode == VMOPCODE_OR ? X64_OR : X64_XOR, RAX, RCX);
+                store(op1, RAX);
+            break;
+            case VMOPCODE_JMP:
+                patch = emitter.jump();
+            break;
+            case VMOPCODE_JEQ:  case VMOPCODE_JNE:  case VMOPCODE_JGT:
+            case VMOPCODE_JLT:  case VMOPCODE_JGE:  case VMOPCODE_JLE:
+            case VMOPCODE_JGTS: case VMOPCODE_JLTS: case VMOPCODE_JGES: case VMOPCODE_JLES: {
+                X64Condition unsignedConditions[] = { X64_E, X64_NE, X64_A, X64_B, X64_AE, X64_BE };
+                X64Condition signedConditions[] = { X64_G, X64_L, X64_GE, X64_LE };
+                load(RAX, op2);
+                load(RCX, op3);
+                emitter.alu(X64_CMP, RAX, RCX);
+                patch = emitter.jump(inst.opcode >= VMOPCODE_JGTS ? signedConditions[inst.opcode - VMOPCODE_JGTS]
+                                                                  : unsignedConditions[inst.opcode - VMOPCODE_JEQ]);
+            } break;
+            default:
+            break;
+        }
+    }
+};
+
+void VMJit::compile(u64 entry) {
+    VMJitEntry &result = _entries[entry];
+    result.state = VMJIT_FAILED;
+
+    u64 length = _program.code.length();
+    u64 *offsets = (u64 *) default_allocator(length * sizeof(u64));
+    u64 *worklist = (u64 *) default_allocator(2 * length * sizeof(u64));
+    if (offsets == nullptr || worklist == nullptr) {
+        default_deallocator(offsets, length * sizeof(u64));
+        default_deallocator(worklist, 2 * length * sizeof(u64));
+        return;
+    }
+
+    // find every instruction reachable from the entry, following fall through
+    // and static jump targets, `offsets` holds 1 for reachable ones
+    u64 count = 0;
+    u64 pending = 0;
+    worklist[pending++] = entry;
+    offsets[entry] = 1;
+    while (pending > 0 && count <= JIT_MAX_INSTRUCTIONS) {
+        u64 index = worklist[--pending];
+        ++count;
+
+        VMDecodedInstruction const &inst = _program.code[index];
+        if (!isCompilable(_program, inst)) continue;
+
+        u64 successors[2];
+        u64 successorCount = 0;
+        if (inst.opcode != VMOPCODE_JMP && index + 1 < length) {
+            successors[successorCount++] = index + 1;
+        }
+        if (inst.opcode == VMOPCODE_JMP || isConditionalJump(inst.opcode)) {
+            successors[successorCount++] = inst.operand1.value;
+        }
+        for (u64 i = 0; i < successorCount; ++i) {
+            if (offsets[successors[i]] == 0) {
+                offsets[successors[i]] = 1;
+                worklist[pending++] = successors[i];
+            }
+        }
+    }
+
+    u64 size = count * JIT_MAX_TEMPLATE_SIZE + JIT_MAX_TEMPLATE_SIZE;
+    if (count <= JIT_MAX_INSTRUCTIONS && _cursor + size <= _capacity &&
+        mprotect(_code, _capacity, PROT_READ | PROT_WRITE) == 0) {
+        JitCompiler compiler { _program, { _code, _cursor } };
+        u64 start = _cursor;
+
+        // emit in address order so fall through needs no jumps (every compiled
+        // instruction's successor is reachable too), the entry may be in the
+        // middle so native code starts with a jump to it
+        u64 entryJump = compiler.emitter.jump();
+        u64 patches = 0;
+        for (u64 index = 0; index < length; ++index) {
+            if (offsets[index] == 0) continue;
+            offsets[index] = compiler.emitter.cursor;
+
+            VMDecodedInstruction const &inst = _program.code[index];
+            if (!isCompilable(_program, inst)) {
+                compiler.exit(index);
+                continue;
+            }
+
+            u64 patch = 0;
+            compiler.emit(inst, patch);
+            if (patch != 0) {
+                // reuse the worklist as (position, target) pairs of jumps
+                worklist[patches++] = patch;
+                worklist[patches++] = inst.operand1.value;
+            }
+        }
+
+        compiler.emitter.patch(entryJump, offsets[entry]);
+        for (u64 i = 0; i < patches; i += 2) {
+            compiler.emitter.patch(worklist[i], offsets[worklist[i + 1]]);
+        }
+
+        _cursor = compiler.emitter.cursor;
+        result.function = (VMJitFunction) (_code + start);
+        result.state = VMJIT_COMPILED;
+    }
+
+    mprotect(_code, _capacity, PROT_READ | PROT_EXEC);
+    default_deallocator(offsets, length * sizeof(u64));
+    default_deallocator(worklist, 2 * length * sizeof(u64));
+}
+
+#endif
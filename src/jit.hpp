@@ -0,0 +1,67 @@
+#if !defined(METAVM_JIT_HPP)
+#define METAVM_JIT_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+
+// baseline template JIT, build with -D METAVM_JIT on x86-64 to enable it
+//
+// every supported VMOPCode has a fixed machine code template, compiled code
+// keeps VMRegisters::data pinned in rdi and the memory base in rsi, so
+// registers (including r30, the stack pointer) are read and written in place
+// the instruction pointer (r31) only exists implicitly while native code runs,
+// anything the templates don't cover (or that could raise) becomes an exit
+// that returns the address the interpreter resumes at
+#if defined(METAVM_JIT)
+    #if !defined(__x86_64__) || !defined(__linux__)
+        #error "METAVM_JIT requires x86-64 Linux"
+    #endif
+
+// returns the instruction pointer the interpreter continues at
+typedef u64 (*VMJitFunction)(VMWord *registers, u8 *memory);
+
+enum VMJitState : u32 {
+    VMJIT_INTERPRETED,
+    VMJIT_COMPILED,
+    VMJIT_FAILED,
+};
+
+// one per decoded instruction, only entries of call targets are ever used
+struct VMJitEntry {
+    u32       invocations;
+    VMJitState      state;
+    VMJitFunction function;
+};
+
+struct VMJit {
+    // `entries` must hold one entry per instruction of `program`
+    VMJit(VMProgram &program, memory_view<VMJitEntry> &entries, u64 capacity = KB(256));
+    ~VMJit();
+
+    // invocations of a function before it gets compiled
+    u32 threshold = 1000;
+
+    // counts an invocation of the function at `address`, returns its native
+    // code once it is hot and compiled, null while it's interpreted
+    VMJitFunction enter(u64 address) {
+        VMJitEntry &entry = _entries[address];
+        if (entry.state == VMJIT_INTERPRETED && ++entry.invocations >= threshold) {
+            compile(address);
+        }
+        return entry.function;
+    }
+
+private:
+    VMProgram                 &_program;
+    memory_view<VMJitEntry>   &_entries;
+    u8                           *_code;
+    u64                       _capacity;
+    u64                         _cursor;
+
+    void compile(u64 address);
+};
+
+#endif
+
+#endif
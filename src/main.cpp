@@ -1,23 +1,116 @@
+#if defined(METAVM_TRACE)
+    #include <thread>
+#endif
+
 #include "common.hpp"
 #include "types.hpp"
+#include "bytecode.hpp"
+#include "module.hpp"
 #include "metavm.hpp"
 
-int main() {
+// usage: metavm [module]
+int main(int argc, char **argv) {
     using TCode = static_array<VMInstruction, 64>;
-    using TMemory = static_array<u8, KB(1)>;
+    using TStream = static_array<u8, KB(4)>;
+    using TDecoded = static_array<VMDecodedInstruction, KB(16) + 1>;
+    using TConstants = static_array<VMWord, KB(16) * 3>;
+    using TMemory = static_array<u8, KB(64)>;
     using TExceptions = static_array<VMException, KB(1)>;
 
-    TCode code {};
-    TMemory memory {};
+    static TDecoded decoded {};
+    static TConstants constants {};
+    static TMemory memory {};
     TExceptions exceptions {};
-    auto codeView = code.view(0, code.size());
     auto memoryView = memory.view(0, memory.size());
     auto exceptionsView = exceptions.arrayView();
-    MetaVM vm { codeView, memoryView, exceptionsView };
+
+    VMProgram program { decoded.arrayView(), constants.arrayView(), false, false };
+    VMModule module {};
+    if (argc > 1) {
+        VMModuleStatus status = mapModule(argv[1], module);
+        if (status == VMMODULE_OK) status = loadModule(module, program, memoryView);
+        if (status != VMMODULE_OK) {
+            std::printf("failed to load module %s: %s\n", argv[1], getModuleStatusName(status));
+            return 1;
+        }
+    } else {
+        TCode code {};
+        TStream stream {};
+        auto codeView = code.view(0, code.size());
+        auto streamView = stream.view(0, stream.size());
+
+        u64 streamLength = 0;
+        if (!encodeBytecode(codeView, streamView, streamLength)) {
+            std::printf("failed to encode bytecode\n");
+            return 1;
+        }
+
+        VMDecodeStatus status = decodeBytecode(streamView, streamLength, program);
+        if (status != VMDECODE_OK) {
+            std::printf("failed to decode bytecode: %s\n", getDecodeStatusName(status));
+            return 1;
+        }
+    }
+
+    VMVerifyResult verification = verifyProgram(program);
+    if (verification.status != VMVERIFY_OK) {
+        std::printf("failed to verify instruction %llu: %s\n", verification.index, getVerifyStatusName(verification.status));
+        return 1;
+    }
+
+#if !defined(METAVM_PROFILE)
+    // profiles only count what is dispatched (see VMProfile), and a decoded
+    // cache keeps the superinstructions it was written with
+    if (module.decodedCount == 0) fuseProgram(program);
+#endif
+
+    MetaVM vm { program, memoryView, exceptionsView };
+
+#if defined(METAVM_PROFILE)
+    static static_array<VMProfileEntry, KB(16) + 1> profileEntries {};
+    auto profileView = profileEntries.view(0, program.code.length());
+    VMProfile profile { profileView };
+    vm.attachProfile(&profile);
+#endif
+
+#if defined(METAVM_TRACE)
+    // the run is traced to metavm.trace while it goes, see tools/trace.cpp
+    static static_array<u8, MB(16)> traceBuffer {};
+    auto traceView = traceBuffer.view(0, traceBuffer.size());
+    static VMTrace trace { traceView };
+    std::FILE *traceFile = std::fopen("metavm.trace", "wb");
+    if (traceFile == nullptr || !writeTraceHeader(traceFile)) {
+        std::printf("failed to open metavm.trace\n");
+        return 1;
+    }
+    vm.attachTrace(&trace);
+
+    std::atomic<bool> tracing { true };
+    std::thread traceWriter([&] {
+        while (tracing.load(std::memory_order_acquire)) {
+            drainTrace(trace, traceFile);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+#endif
 
     vm.run();
+
+#if defined(METAVM_TRACE)
+    tracing.store(false, std::memory_order_release);
+    traceWriter.join();
+    bool traced = drainTrace(trace, traceFile);
+    traced = std::fclose(traceFile) == 0 && traced;
+    if (!traced) std::printf("failed to write metavm.trace\n");
+    if (trace.dropped != 0) std::printf("the trace dropped %llu records at the end\n", trace.dropped);
+#endif
+
     vm.printRegisters();
     vm.printExceptions();
+#if defined(METAVM_PROFILE)
+    printProfile(program, profile);
+#endif
     // vm.printMemory();
-}
 
+    unmapModule(module);
+}
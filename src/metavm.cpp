@@ -2,139 +2,535 @@
 #include "types.hpp"
 #include "metavm.hpp"
 
-VMInstruction MetaVM::fetch() {
-    VMInstruction inst {}; 
-    switch (_registers.data[31].u) {
-        default:
-            inst.opcode = VMOPCODE_HLT;
-        break;
+// build with -D METAVM_THREADED_DISPATCH to use the direct-threaded engine,
+// every decoded instruction then jumps straight to the next one's handler
+// instead of going through the single indirect branch of the switch
+#if defined(METAVM_THREADED_DISPATCH)
+    #if !defined(__GNUC__)
+        #error "METAVM_THREADED_DISPATCH requires labels as values (GCC or Clang)"
+    #endif
+
+    #define VM_TARGET(opcode) target_##opcode
+    #define VM_DISPATCH() do { VM_FETCH(); VM_PROFILE(); goto *inst->label; } while (0)
+#else
+    #define VM_TARGET(opcode) case opcode
+    #define VM_DISPATCH() continue
+#endif
+
+// the decoder terminates the code with a halt, and jumps and writes to r31
+// are checked against the code length, so the instruction pointer is always
+// in range, fetching retires the instruction fetched before
+#define VM_FETCH() do { VM_TRACE(); inst = &code[ip++]; } while (0)
+
+// build with -D METAVM_PROFILE to count dispatches, see MetaVM::attachProfile
+#if defined(METAVM_PROFILE)
+    #define VM_PROFILE() do { if (_profile) profileDispatch(ip - 1); } while (0)
+#else
+    #define VM_PROFILE() do {} while (0)
+#endif
+
+// build with -D METAVM_TRACE to record retired instructions, see
+// MetaVM::attachTrace
+#if defined(METAVM_TRACE)
+    #define VM_TRACE() do { if (_trace && inst) traceRetire(*inst, inst - code); } while (0)
+#else
+    #define VM_TRACE() do {} while (0)
+#endif
+
+VMRunStatus MetaVM::run(u64 budget, u64 deadline) {
+    // a suspended VM stays put until its native call completed
+    if (_suspended) return VMRUN_SUSPENDED;
+
+    _status = VMRUN_EXCEPTION;
+    _limited = budget != VMRUN_UNLIMITED || deadline != VMRUN_NO_DEADLINE;
+    _budget = budget;
+    _deadline = deadline;
+    _deadlineCountdown = VMRUN_DEADLINE_INTERVAL;
+    _runStart = _registers.data[31].u;
+
+    // a run that may not execute anything doesn't start
+    if (_budget == 0 || (_deadline != VMRUN_NO_DEADLINE && getMonotonicTime() >= _deadline)) {
+        return VMRUN_PREEMPTED;
     }
 
-    _registers.data[31].u++;
-    return inst;
+    // a native call that completed with a failure raises where it was made,
+    // r31 is past it like after any other raise
+    if (_completion != VMNATIVE_OK) {
+        raiseNative(_completion);
+        _completion = VMNATIVE_OK;
+        if (!catchException()) return _status;
+    }
+
+    // the engines only return on a halt, which sets the status, or when a
+    // handler failed, either raising, preempting (see checkpoint) or
+    // suspending (see calln), raising
+    // costs nothing until it happens, the program's handlers are only looked
+    // at then
+    do {
+        if (_program.verified) {
+            execute<false>(false);
+        } else {
+            execute<true>(false);
+        }
+    } while (_status == VMRUN_EXCEPTION && catchException());
+
+    // the host sees every batched call once the run returns
+    if (_natives != nullptr) _natives->flush(_memory);
+    return _status;
 }
 
-void MetaVM::run() {
-    bool isRunning = true;
-    while (isRunning && _exceptions.length() == 0) {
-        VMInstruction inst = fetch();
-        VMOPCode op = inst.opcode;
-        switch (op) {
-            case VMOPCODE_HLT:
-                isRunning = false;
-            break;
-            case VMOPCODE_NOP:
-                // do nothing
-            break;
-            case VMOPCODE_MOV:
-                mov(inst);
-            break;
-            case VMOPCODE_PUSH:
-                push(inst);
-            break;
-            case VMOPCODE_POP:
-                pop(inst);
-            break;
-            case VMOPCODE_ADD:
-                add(inst);
-            break;
-            case VMOPCODE_SUB:
-                sub(inst);
-            break;
-            case VMOPCODE_MUL:
-                mul(inst);
-            break;
-            case VMOPCODE_DIV:
-                div(inst);
-            break;
-            case VMOPCODE_DIVR:
-                divr(inst);
-            break;
-            case VMOPCODE_ADDS:
-                adds(inst);
-            break;
-            case VMOPCODE_SUBS:
-                subs(inst);
-            break;
-            case VMOPCODE_MULS:
-                muls(inst);
-            break;
-            case VMOPCODE_DIVS:
-                divs(inst);
-            break;
-            case VMOPCODE_DIVSR:
-                divsr(inst);
-            break;
-            case VMOPCODE_ADDF:
-                addf(inst);
-            break;
-            case VMOPCODE_SUBF:
-                subf(inst);
-            break;
-            case VMOPCODE_MULF:
-                mulf(inst);
-            break;
-            case VMOPCODE_DIVF:
-                divf(inst);
-            break;
-            case VMOPCODE_ADDFS:
-                addfs(inst);
-            break;
-            case VMOPCODE_SUBFS:
-                subfs(inst);
-            break;
-            case VMOPCODE_MULFS:
-                mulfs(inst);
-            break;
-            case VMOPCODE_DIVFS:
-                divfs(inst);
-            break;
-            case VMOPCODE_NEG:
-                neg(inst);
-            break;
-            case VMOPCODE_AND:
-                bitwise_and(inst);
-            break;
-            case VMOPCODE_OR:
-                bitwise_or(inst);
-            break;
-            case VMOPCODE_XOR:
-                bitwise_xor(inst);
-            break;
-            case VMOPCODE_NOT:
-                bitwise_not(inst);
-            break;
-            case VMOPCODE_JMP:
-                jmp(inst);
-            break;
-            case VMOPCODE_JEQ:
-                jeq(inst);
-            break;
-            case VMOPCODE_JNE:
-                jne(inst);
-            break;
-            case VMOPCODE_JGT:
-                jgt(inst);
-            break;
-            case VMOPCODE_JLT:
-                jlt(inst);
-            break;
-            case VMOPCODE_JGE:
-                jge(inst);
-            break;
-            case VMOPCODE_JLE:
-                jle(inst);
-            break;
-            case VMOPCODE_CALL:
-                call(inst);
-            break;
-            case VMOPCODE_RET:
-                ret(inst);
+bool MetaVM::catchException() {
+    // the engines stop right after fetching the instruction that raised
+    u64 address = _registers.data[31].u - 1;
+    _exception.address = address;
+
+    for (u64 i = 0; i < _program.handlerCount; ++i) {
+        VMExceptionHandler const &handler = _program.handlers[i];
+        if (address < handler.start || address >= handler.end) continue;
+        if (!((handler.exceptions >> _exception.exception) & 1)) continue;
+
+        // an entry that can't be taken catches nothing
+        if (handler.target >= _program.code.length() || handler.exceptionRegister >= REGISTER_COUNT ||
+            handler.addressRegister >= REGISTER_COUNT) {
             break;
         }
+
+        _registers.data[handler.exceptionRegister].u = _exception.exception;
+        _registers.data[handler.addressRegister].u = address;
+        _registers.data[31].u = handler.target;
+
+        // a transfer of control like any other, a loop of raises and
+        // handlers runs out of budget as well
+        return checkpoint(address, handler.target);
     }
+
+    _exceptions.append(_exception.exception);
+    return false;
+}
+
+void MetaVM::prepare(VMProgram &program) {
+    // linking touches neither memory nor exceptions
+    memory_view<u8> memory {};
+    array_view<VMException> exceptions {};
+    MetaVM vm { program, memory, exceptions };
+    if (program.verified) {
+        vm.execute<false>(true);
+    } else {
+        vm.execute<true>(true);
+    }
+}
+
+// returns false if the target is outside the code
+template<bool Checked>
+bool MetaVM::getTarget(VMDecodedOperand const &target, u64 &address) {
+    // immediate targets are addresses already (see hasTarget), the verifier
+    // checked the ones of verified programs
+    if (target.type == VMOPTYPE_IMMEDIATE) {
+        address = target.value;
+        return !Checked || address < _program.code.length();
+    }
+
+    address = getUnsigned(target.size, getVMWord(target));
+    return address < _program.code.length();
 }
 
+template<bool Checked>
+bool MetaVM::jmp(VMDecodedInstruction const &inst, u64 &ip) {
+    u64 target;
+    if (!getTarget<Checked>(inst.operand1, target)) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
+    }
+
+    return jump(ip, target);
+}
+
+template<VMOPCode Op> struct VMBranchCondition;
+
+// the conditional jumps, the kind of values they compare and the comparison
+#define brcond(opcode, valueKind, expression)                                          \
+    template<> struct VMBranchCondition<opcode> {                                      \
+        static constexpr VMValueKind kind = valueKind;                                 \
+        template<typename T> static bool apply(T lhs, T rhs) { return expression; }    \
+    };
+
+brcond(VMOPCODE_JEQ,  VMVALUE_UNSIGNED, lhs == rhs)
+brcond(VMOPCODE_JNE,  VMVALUE_UNSIGNED, lhs != rhs)
+brcond(VMOPCODE_JGT,  VMVALUE_UNSIGNED, lhs > rhs)
+brcond(VMOPCODE_JLT,  VMVALUE_UNSIGNED, lhs < rhs)
+brcond(VMOPCODE_JGE,  VMVALUE_UNSIGNED, lhs >= rhs)
+brcond(VMOPCODE_JLE,  VMVALUE_UNSIGNED, lhs <= rhs)
+brcond(VMOPCODE_JGTS, VMVALUE_SIGNED,   lhs > rhs)
+brcond(VMOPCODE_JLTS, VMVALUE_SIGNED,   lhs < rhs)
+brcond(VMOPCODE_JGES, VMVALUE_SIGNED,   lhs >= rhs)
+brcond(VMOPCODE_JLES, VMVALUE_SIGNED,   lhs <= rhs)
+brcond(VMOPCODE_JEQF, VMVALUE_FLOAT,    lhs == rhs)
+brcond(VMOPCODE_JNEF, VMVALUE_FLOAT,    lhs != rhs)
+brcond(VMOPCODE_JGTF, VMVALUE_FLOAT,    lhs > rhs)
+brcond(VMOPCODE_JLTF, VMVALUE_FLOAT,    lhs < rhs)
+brcond(VMOPCODE_JGEF, VMVALUE_FLOAT,    lhs >= rhs)
+brcond(VMOPCODE_JLEF, VMVALUE_FLOAT,    lhs <= rhs)
+
+#undef brcond
+
+template<bool Checked, VMOPCode Op>
+bool MetaVM::branch(VMDecodedInstruction const &inst, u64 &ip) {
+    using Condition = VMBranchCondition<Op>;
+    VMDecodedOperand const &dst = inst.operand1;
+    VMDecodedOperand const &lhs = inst.operand2;
+    VMDecodedOperand const &rhs = inst.operand3;
+
+    u64 target;
+    if (!getTarget<Checked>(dst, target)) return raise(VMEXCEPT_INVALID_OPERANDS, 0);
+    if (Checked && lhs.size != rhs.size) return raise(VMEXCEPT_INVALID_OPERANDS, 2);
+
+    bool taken;
+    if constexpr (Condition::kind == VMVALUE_FLOAT) {
+        // floats are f32 or f64, the verifier rejected other sizes
+        if (Checked && lhs.size != VMOPSIZE_DWORD && lhs.size != VMOPSIZE_QWORD) {
+            return raise(VMEXCEPT_INVALID_OPERANDS, 1);
+        }
+
+        VMWord &lhsWord = getVMWord(lhs);
+        VMWord &rhsWord = getVMWord(rhs);
+        if (lhs.size == VMOPSIZE_DWORD) {
+            taken = Condition::apply(lhsWord.fsingles[0], rhsWord.fsingles[0]);
+        } else {
+            taken = Condition::apply(lhsWord.f, rhsWord.f);
+        }
+    } else if constexpr (Condition::kind == VMVALUE_SIGNED) {
+        taken = Condition::apply(getSigned(lhs.size, getVMWord(lhs)), getSigned(rhs.size, getVMWord(rhs)));
+    } else {
+        taken = Condition::apply(getUnsigned(lhs.size, getVMWord(lhs)), getUnsigned(rhs.size, getVMWord(rhs)));
+    }
+
+    // the jump was fetched last, even as part of a superinstruction
+    profileBranch(ip - 1, taken);
+    if (!taken) return true;
+
+    return jump(ip, target);
+}
+
+template<bool Checked>
+bool MetaVM::call(VMDecodedInstruction const &inst, u64 &ip) {
+    u64 value;
+    if (!getTarget<Checked>(inst.operand1, value)) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
+    }
+
+    u64 caller = ip - 1;
+
+    // make sure there's enough room for (at least) the instruction pointer
+    u64 top = _registers.data[30].u - VMOPSIZE_QWORD;
+    if (!isInMemory(top, VMOPSIZE_QWORD)) {
+        return raise(VMEXCEPT_STACK_OVERFLOW);
+    }
+
+    // push the return address, the instruction after the call
+    _registers.data[30].u = top;
+    getStackTop().u = ip;
+
+    // make the next instruction the called code
+    ip = value;
+    profileCall(value);
+    if (!checkpoint(caller, value)) return false;
+
+#if defined(METAVM_JIT)
+    // compiled code can't be preempted, limited runs stay interpreted
+    if (_jit != nullptr && !_limited) {
+        VMJitFunction function = _jit->enter(value);
+        if (function != nullptr) {
+            // compiled code runs until it reaches something it has no template
+            // for (at the latest the callee's RET), the interpreter takes over there
+            _registers.data[31].u = ip;
+            ip = function(_registers.data, &_memory[0]);
+        }
+    }
+#endif
+
+    return true;
+}
+
+template<bool Checked>
+bool MetaVM::ret(VMDecodedInstruction const &, u64 &ip) {
+    u64 top = _registers.data[30].u;
+    if (!isInMemory(top, VMOPSIZE_QWORD)) {
+        return raise(VMEXCEPT_STACK_UNDERFLOW);
+    }
+
+    // make sure the stack top is a sane address
+    u64 target = getStackTop().u;
+    if (target >= _program.code.length()) {
+        return raise(VMEXCEPT_UNEXPECTED_OPCODE);
+    }
+
+    // a function may enter a frame and return without leaving it
+    if (_frameDepth != 0 && _frames[_frameDepth - 1].base == top) --_frameDepth;
+
+    _registers.data[30].u = top + VMOPSIZE_QWORD;
+    u64 address = ip - 1;
+    ip = target;
+    return checkpoint(address, target);
+}
+
+template<bool Checked>
+bool MetaVM::enter(VMDecodedInstruction const &inst, u64 &) {
+    u64 registers = getFrameOperand(inst.operand1);
+    u64 size = getFrameOperand(inst.operand2);
+    if (registers >> VMFRAME_REGISTERS) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
+    }
+
+    // frames at or below the stack pointer were left by a RET of a function
+    // that didn't enter one, or by a handler catching an exception
+    u64 base = _registers.data[30].u;
+    while (_frameDepth != 0 && _frames[_frameDepth - 1].base <= base) --_frameDepth;
+    if (_frameDepth == VMFRAME_DEPTH) {
+        return raise(VMEXCEPT_STACK_OVERFLOW);
+    }
+
+    if (!isInMemory(base, VMOPSIZE_QWORD)) {
+        return raise(VMEXCEPT_STACK_UNDERFLOW);
+    }
+    u64 saved = VMOPSIZE_QWORD * __builtin_popcountll(registers);
+    if (size > base || saved > base - size) {
+        return raise(VMEXCEPT_STACK_OVERFLOW);
+    }
+
+    // the lowest register right below the return address, LEAVE reads them
+    // back the same way
+    u64 slot = base;
+    for (u64 bits = registers; bits != 0; bits &= bits - 1) {
+        slot -= VMOPSIZE_QWORD;
+        std::memcpy(&_memory[slot], &_registers.data[__builtin_ctzll(bits)], VMOPSIZE_QWORD);
+    }
+
+    _frames[_frameDepth++] = { base, getStackTop().u, (u32) registers, 0 };
+    _registers.data[30].u = slot - size;
+    return true;
+}
+
+template<bool Checked>
+bool MetaVM::leave(VMDecodedInstruction const &, u64 &ip) {
+    // the innermost frame the stack pointer is still inside of, the ones
+    // below it were left without a LEAVE (see enter)
+    u64 top = _registers.data[30].u;
+    while (_frameDepth != 0 && _frames[_frameDepth - 1].base < top) --_frameDepth;
+    if (_frameDepth == 0) {
+        return raise(VMEXCEPT_STACK_UNDERFLOW);
+    }
+
+    // returns to the address the call pushed, even if the program wrote
+    // over it since, only a RET would go where it points now
+    VMFrame const &frame = _frames[_frameDepth - 1];
+    if (frame.returnAddress >= _program.code.length()) {
+        return raise(VMEXCEPT_UNEXPECTED_OPCODE);
+    }
+    --_frameDepth;
+
+    // ENTER checked the slots are in memory
+    u64 slot = frame.base;
+    for (u64 bits = frame.registers; bits != 0; bits &= bits - 1) {
+        slot -= VMOPSIZE_QWORD;
+        std::memcpy(&_registers.data[__builtin_ctzll(bits)], &_memory[slot], VMOPSIZE_QWORD);
+    }
+
+    // whatever the function left on the stack goes with the frame
+    _registers.data[30].u = frame.base + VMOPSIZE_QWORD;
+    u64 address = ip - 1;
+    ip = frame.returnAddress;
+    return checkpoint(address, ip);
+}
+
+template<bool Checked>
+bool MetaVM::calln(VMDecodedInstruction const &inst, u64 &) {
+    u64 index = getUnsigned(inst.operand1.size, getVMWord(inst.operand1));
+    if (_natives == nullptr || index >= _natives->natives.length()) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
+    }
+
+    VMNative const &native = _natives->natives[index];
+    if (native.batch != nullptr) {
+        _natives->record(index, _registers.data, _memory);
+        return true;
+    }
+
+    // batched calls made before this one run before it
+    _natives->flush(_memory);
+
+    VMNativeCall call { _registers.data, _memory, native.context, this };
+    VMNativeStatus status = native.function(call);
+    if (status == VMNATIVE_OK) return true;
+
+    // the engine stops with r31 past the call, see complete
+    if (status == VMNATIVE_PENDING) {
+        _suspended = true;
+        _status = VMRUN_SUSPENDED;
+        return false;
+    }
+    return raiseNative(status);
+}
+
+template<bool Checked>
+void MetaVM::execute(bool linkOnly) {
+    VMDecodedInstruction const *inst = nullptr;
+
+#if defined(METAVM_THREADED_DISPATCH)
+    if (!_program.linked) {
+        void const *labels[256];
+        for (u64 i = 0; i < 256; ++i) {
+            labels[i] = &&target_unexpected;
+        }
+        labels[VMOPCODE_HLT] = &&VM_TARGET(VMOPCODE_HLT);
+        labels[VMOPCODE_NOP] = &&VM_TARGET(VMOPCODE_NOP);
+        #define VM_LABEL(opcode, handler) labels[opcode] = &&VM_TARGET(opcode);
+        METAVM_HANDLERS(VM_LABEL)
+        #undef VM_LABEL
+        #define VM_LABEL(opcode) labels[opcode] = &&target_resolved;
+        METAVM_RESOLVED(VM_LABEL)
+        #undef VM_LABEL
+        labels[VMDISPATCH_SYNCED] = &&VM_TARGET(VMDISPATCH_SYNCED);
+        labels[VMSUPER_OP_OP] = &&VM_TARGET(VMSUPER_OP_OP);
+        labels[VMSUPER_OP_OP_OP] = &&VM_TARGET(VMSUPER_OP_OP_OP);
+        labels[VMSUPER_PUSH_POP] = &&VM_TARGET(VMSUPER_PUSH_POP);
+        #define VM_LABEL(dispatch, branch) labels[dispatch] = &&VM_TARGET(dispatch);
+        METAVM_FUSED_BRANCHES(VM_LABEL)
+        #undef VM_LABEL
+
+        for (u64 i = 0; i < _program.code.length(); ++i) {
+            VMDecodedInstruction &decoded = _program.code[i];
+            decoded.label = labels[decoded.dispatch];
+        }
+        _program.linked = true;
+    }
+#endif
+    if (linkOnly) return;
+
+    // the run's state the compiler can keep in host registers, r31 gets the
+    // instruction pointer back when the engine stops
+    VMDecodedInstruction const *code = &_program.code[0];
+    u64 ip = _registers.data[31].u;
+
+#if defined(METAVM_THREADED_DISPATCH)
+    VM_DISPATCH();
+#else
+    for (;;) {
+        VM_FETCH();
+        VM_PROFILE();
+        switch (inst->dispatch) {
+#endif
+
+    VM_TARGET(VMOPCODE_HLT):
+        _status = VMRUN_HALTED;
+        goto stop;
+
+    VM_TARGET(VMOPCODE_NOP):
+        // do nothing
+        VM_DISPATCH();
+
+    // control flow operands may be r31 as well, storing it is cheap, it's
+    // reading it back on every fetch that isn't
+    #define VM_HANDLER(opcode, handler)                         \
+        VM_TARGET(opcode):                                      \
+            _registers.data[31].u = ip;                         \
+            if (!handler<Checked>(*inst, ip)) goto stop;        \
+            VM_DISPATCH();
+    METAVM_HANDLERS(VM_HANDLER)
+    #undef VM_HANDLER
+
+#if defined(METAVM_THREADED_DISPATCH)
+    target_resolved:
+#else
+    #define VM_CASE(opcode) case opcode:
+    METAVM_RESOLVED(VM_CASE)
+    #undef VM_CASE
+#endif
+        if (!inst->handler(*this, *inst)) goto stop;
+        VM_DISPATCH();
+
+    // resolved handlers that read or write r31 see the real instruction
+    // pointer, and any jump they make through it is taken, checked against
+    // the code and, going backwards, charged to the budget like any other
+    // jump, verified programs included, the verifier can't see where such a
+    // write goes
+    VM_TARGET(VMDISPATCH_SYNCED): {
+        _registers.data[31].u = ip;
+        if (!inst->handler(*this, *inst)) {
+            ip = _registers.data[31].u;
+            goto stop;
+        }
+
+        u64 target = _registers.data[31].u;
+        if (target != ip) {
+            if (target >= _program.code.length()) {
+                raise(VMEXCEPT_INVALID_OPERANDS, getDestinationOperand(inst->opcode));
+                goto stop;
+            }
+            if (!jump(ip, target)) goto stop;
+        }
+        VM_DISPATCH();
+    }
+
+    // superinstructions, the parts after the first are fetched without
+    // dispatching so the instruction pointer stays exact (see fuseProgram)
+    VM_TARGET(VMSUPER_OP_OP):
+        if (!inst->handler(*this, *inst)) goto stop;
+        VM_FETCH();
+        if (!inst->handler(*this, *inst)) goto stop;
+        VM_DISPATCH();
+
+    VM_TARGET(VMSUPER_OP_OP_OP):
+        if (!inst->handler(*this, *inst)) goto stop;
+        VM_FETCH();
+        if (!inst->handler(*this, *inst)) goto stop;
+        VM_FETCH();
+        if (!inst->handler(*this, *inst)) goto stop;
+        VM_DISPATCH();
+
+    // the pop is only skipped once the push succeeded, it's fetched all the
+    // same so it's retired like the push
+    VM_TARGET(VMSUPER_PUSH_POP):
+        if (!pushPop(*inst, code[ip])) goto stop;
+        VM_FETCH();
+        VM_DISPATCH();
+
+    #define VM_FUSED(dispatch, branch)                          \
+        VM_TARGET(dispatch):                                    \
+            if (!inst->handler(*this, *inst)) goto stop;        \
+            VM_FETCH();                                         \
+            _registers.data[31].u = ip;                         \
+            if (!branch<Checked>(*inst, ip)) goto stop;         \
+            VM_DISPATCH();
+    METAVM_FUSED_BRANCHES(VM_FUSED)
+    #undef VM_FUSED
+
+#if defined(METAVM_THREADED_DISPATCH)
+    target_unexpected:
+        raise(VMEXCEPT_UNEXPECTED_OPCODE);
+        goto stop;
+#else
+        default:
+            raise(VMEXCEPT_UNEXPECTED_OPCODE);
+            goto stop;
+        }
+    }
+#endif
+
+stop:
+    // halts, preemptions and suspensions happen after the instruction did
+    // its part, an exception means it didn't
+    if (_status != VMRUN_EXCEPTION) VM_TRACE();
+#if defined(METAVM_TRACE)
+    if (_trace) _trace->flush();
+#endif
+    _registers.data[31].u = ip;
+}
+
+#undef VM_TARGET
+#undef VM_DISPATCH
+#undef VM_FETCH
+#undef VM_PROFILE
+#undef VM_TRACE
+
 void MetaVM::printRegisters() {
     std::printf("REGISTERS:\n");
     for (u8 i = 0; i < REGISTER_COUNT; ++i) {
@@ -171,6 +567,9 @@ void MetaVM::printExceptions() {
     for (u64 i = 0; i < _exceptions.length(); ++i) {
         std::printf("%s\n", getExceptionName(_exceptions[i]));
     }
+    if (_exceptions.length() != 0) {
+        std::printf("last raised at %llu, operand %d\n", _exception.address, _exception.operand);
+    }
     std::printf("\n");
 }
 
@@ -180,46 +579,49 @@ void MetaVM::printAll() {
     printExceptions();
 }
 
-u64 MetaVM::getIndirect(VMOperand const &operand) const {
+u64 MetaVM::getIndirect(VMDecodedOperand const &operand) const {
     return _registers.data[operand.registerIndex];
 }
 
-u64 MetaVM::getDisplaced(VMOperand const &operand) const {
-    return _registers.data[operand.registerIndex].u + operand.value.s;
-}
-
-VMWord &MetaVM::getRegister(VMOperand const &operand) {
-    u8 index = operand.registerIndex;
-    switch (operand.size) {
-        case VMOPSIZE_QWORD:
-            return _registers.data[index];
-        case VMOPSIZE_DWORD: {
-            index = (u8) ((index / (REGISTER_COUNT * 2.0f)) * REGISTER_COUNT);
-            VMWord &actualRegister = _registers.data[index];
-            return *reinterpret_cast<VMWord *>(&actualRegister.udwords[operand.registerIndex % 2]);
-        } break;
-        case VMOPSIZE_WORD: {
-            index = (u8) ((index / (REGISTER_COUNT * 4.0f)) * REGISTER_COUNT);
-            VMWord &actualRegister = _registers.data[index];
-            return *reinterpret_cast<VMWord *>(&actualRegister.uwords[operand.registerIndex % 4]);
-        } break;
+u64 MetaVM::getDisplaced(VMDecodedOperand const &operand) const {
+    return _registers.data[operand.registerIndex].u + _program.constants[operand.value].s;
+}
+
+u64 MetaVM::getAddress(VMDecodedOperand const &operand) const {
+    switch (operand.type) {
+        case VMOPTYPE_INDIRECT:     return getIndirect(operand);
+        case VMOPTYPE_DISPLACEMENT: return getDisplaced(operand);
+        default:                    return _program.constants[operand.value].u;
+    }
+}
+
+u64 MetaVM::getTraceValue(VMDecodedOperand const &operand) {
+    switch (operand.type) {
+        case VMOPTYPE_IMMEDIATE:
+            return getUnsigned(operand.size, _program.constants[operand.value]);
+        case VMOPTYPE_VECTOR:
+            return _registers.vectors[operand.registerIndex].uqwords[0];
         default: {
-            index = (u8) ((index / (REGISTER_COUNT * 8.0f)) * REGISTER_COUNT);
-            VMWord &actualRegister = _registers.data[index];
-            return *reinterpret_cast<VMWord *>(&actualRegister.ubytes[operand.registerIndex % 8]);
-        } break;
+            // the instruction may have moved the register the address is in
+            u64 address = getAddress(operand);
+            if (!isInMemory(address, operand.size)) return 0;
+
+            VMWord value {};
+            std::memcpy(&value, &_memory[address], operand.size);
+            return value.u;
+        }
     }
 }
 
-VMWord &MetaVM::getMemoryFromPointer(VMOperand const &operand) {
-    return *reinterpret_cast<VMWord *>(&_memory[operand.value.u]);
+VMWord &MetaVM::getMemoryFromPointer(VMDecodedOperand const &operand) {
+    return *reinterpret_cast<VMWord *>(&_memory[_program.constants[operand.value].u]);
 }
 
-VMWord &MetaVM::getMemoryFromIndirect(VMOperand const &operand) {
+VMWord &MetaVM::getMemoryFromIndirect(VMDecodedOperand const &operand) {
     return *reinterpret_cast<VMWord *>(&_memory[getIndirect(operand)]);
 }
 
-VMWord &MetaVM::getMemoryFromDisplaced(VMOperand const &operand) {
+VMWord &MetaVM::getMemoryFromDisplaced(VMDecodedOperand const &operand) {
     return *reinterpret_cast<VMWord *>(&_memory[getDisplaced(operand)]);
 }
 
@@ -227,13 +629,13 @@ VMWord &MetaVM::getStackTop() const {
     return *reinterpret_cast<VMWord *>(&_memory[_registers.data[30].u]);
 }
 
-VMWord &MetaVM::getVMWord(VMOperand &operand) {
+VMWord &MetaVM::getVMWord(VMDecodedOperand const &operand) {
     switch (operand.type) {
         case VMOPTYPE_REGISTER:     return getRegister(operand);
         case VMOPTYPE_POINTER:      return getMemoryFromPointer(operand);
         case VMOPTYPE_INDIRECT:     return getMemoryFromIndirect(operand);
         case VMOPTYPE_DISPLACEMENT: return getMemoryFromDisplaced(operand);
-        default:                    return operand.value;
+        default:                    return _program.constants[operand.value];
     }
 }
 
@@ -1,79 +1,577 @@
 #if !defined(METAVM_HPP)
 #define METAVM_HPP
 
+#include <time.h>
+
 #include "common.hpp"
 #include "types.hpp"
+#include "bytecode.hpp"
+#include "jit.hpp"
+#include "native.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+
+// every opcode that is executed by a member handler, used to build both the
+// switch cases and the direct-threaded label table, these are the control
+// flow ones and run inlined into the engines (see MetaVM::execute)
+#define METAVM_HANDLERS(X)                                                                        \
+    X(VMOPCODE_JMP, jmp)           X(VMOPCODE_JEQ, jeq)           X(VMOPCODE_JNE, jne)             \
+    X(VMOPCODE_JGT, jgt)           X(VMOPCODE_JLT, jlt)           X(VMOPCODE_JGE, jge)             \
+    X(VMOPCODE_JLE, jle)           X(VMOPCODE_JGTS, jgts)         X(VMOPCODE_JLTS, jlts)           \
+    X(VMOPCODE_JGES, jges)         X(VMOPCODE_JLES, jles)         X(VMOPCODE_JEQF, jeqf)           \
+    X(VMOPCODE_JNEF, jnef)         X(VMOPCODE_JGTF, jgtf)         X(VMOPCODE_JLTF, jltf)           \
+    X(VMOPCODE_JGEF, jgef)         X(VMOPCODE_JLEF, jlef)         X(VMOPCODE_CALL, call)           \
+    X(VMOPCODE_RET, ret)           X(VMOPCODE_ENTER, enter)       X(VMOPCODE_LEAVE, leave)         \
+    X(VMOPCODE_CALLN, calln)
+
+// opcodes executed through the handler resolveHandler stored in the instruction
+#define METAVM_RESOLVED(X)                                                                        \
+    X(VMOPCODE_MOV)   X(VMOPCODE_PUSH)  X(VMOPCODE_POP)   X(VMOPCODE_NEG)   X(VMOPCODE_NOT)       \
+    X(VMOPCODE_ADD)   X(VMOPCODE_SUB)   X(VMOPCODE_MUL)   X(VMOPCODE_DIV)   X(VMOPCODE_DIVR)      \
+    X(VMOPCODE_ADDS)  X(VMOPCODE_SUBS)  X(VMOPCODE_MULS)  X(VMOPCODE_DIVS)  X(VMOPCODE_DIVSR)     \
+    X(VMOPCODE_ADDF)  X(VMOPCODE_SUBF)  X(VMOPCODE_MULF)  X(VMOPCODE_DIVF)                        \
+    X(VMOPCODE_ADDFS) X(VMOPCODE_SUBFS) X(VMOPCODE_MULFS) X(VMOPCODE_DIVFS)                       \
+    X(VMOPCODE_AND)   X(VMOPCODE_OR)    X(VMOPCODE_XOR)                                           \
+    METAVM_VECTOR(X)  METAVM_MEMORY(X)
+
+// the vector extension, see metavm_vector.cpp
+#define METAVM_VECTOR(X)                                                                          \
+    X(VMOPCODE_VLOAD)   X(VMOPCODE_VSTORE)  X(VMOPCODE_VSPLAT)  X(VMOPCODE_VEXTRACT)               \
+    X(VMOPCODE_VADD)    X(VMOPCODE_VSUB)    X(VMOPCODE_VMUL)                                       \
+    X(VMOPCODE_VADDF)   X(VMOPCODE_VSUBF)   X(VMOPCODE_VMULF)                                      \
+    X(VMOPCODE_VMIN)    X(VMOPCODE_VMAX)    X(VMOPCODE_VMINS)   X(VMOPCODE_VMAXS)                  \
+    X(VMOPCODE_VMINF)   X(VMOPCODE_VMAXF)   X(VMOPCODE_VCMPEQ)  X(VMOPCODE_VCMPGT)                 \
+    X(VMOPCODE_VCMPGTS) X(VMOPCODE_VCMPEQF) X(VMOPCODE_VCMPGTF) X(VMOPCODE_VSHUF)                  \
+    X(VMOPCODE_VSUM)    X(VMOPCODE_VSUMS)   X(VMOPCODE_VSUMF)
+
+// the bulk memory operations, see metavm_memory.cpp
+#define METAVM_MEMORY(X)                                                                          \
+    X(VMOPCODE_MCOPY)   X(VMOPCODE_MFILL)   X(VMOPCODE_MCMP)    X(VMOPCODE_MFIND)
+
+// superinstructions ending in a conditional jump and the jump's handler
+#define METAVM_FUSED_BRANCHES(X)                                                                  \
+    X(VMSUPER_OP_JEQ, jeq)         X(VMSUPER_OP_JNE, jne)         X(VMSUPER_OP_JGT, jgt)           \
+    X(VMSUPER_OP_JLT, jlt)         X(VMSUPER_OP_JGE, jge)         X(VMSUPER_OP_JLE, jle)           \
+    X(VMSUPER_OP_JGTS, jgts)       X(VMSUPER_OP_JLTS, jlts)       X(VMSUPER_OP_JGES, jges)         \
+    X(VMSUPER_OP_JLES, jles)       X(VMSUPER_OP_JEQF, jeqf)       X(VMSUPER_OP_JNEF, jnef)         \
+    X(VMSUPER_OP_JGTF, jgtf)       X(VMSUPER_OP_JLTF, jltf)       X(VMSUPER_OP_JGEF, jgef)         \
+    X(VMSUPER_OP_JLEF, jlef)
+
+enum VMRunStatus {
+    // the program executed a VMOPCODE_HLT
+    VMRUN_HALTED,
+
+    // a handler raised an exception the program has no handler for, see
+    // printExceptions and getException
+    VMRUN_EXCEPTION,
+
+    // the budget or the deadline ran out, r31 holds the address of the next
+    // instruction and running again resumes there
+    VMRUN_PREEMPTED,
+
+    // a native call is pending, r31 holds the address after the CALLN and
+    // running again resumes there once the call completed, see
+    // MetaVM::complete
+    VMRUN_SUSPENDED,
+};
+
+inline const char *getRunStatusName(VMRunStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMRUN_HALTED);
+        stname(VMRUN_EXCEPTION);
+        stname(VMRUN_PREEMPTED);
+        stname(VMRUN_SUSPENDED);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// frames ENTER can nest, one more raises VMEXCEPT_STACK_OVERFLOW
+constexpr u64 VMFRAME_DEPTH = 1024;
+
+// registers ENTER can save, r30 and r31 are the stack and the instruction
+// pointer and have their own way back
+constexpr u64 VMFRAME_REGISTERS = REGISTER_COUNT - 2;
+
+// a frame ENTER made, kept by the VM rather than in memory, so LEAVE reads
+// nothing back but the saved registers and returns to an address the
+// program can't overwrite
+struct VMFrame {
+    // where the return address is, the stack pointer before ENTER
+    u64           base;
+    u64  returnAddress;
+    u32      registers;
+    u32       reserved;
+};
+
+constexpr u64 VMRUN_UNLIMITED = ~0ull;
+constexpr u64 VMRUN_NO_DEADLINE = ~0ull;
+
+// instructions between two looks at the clock in runs with a deadline
+constexpr u64 VMRUN_DEADLINE_INTERVAL = 4096;
+
+// the clock deadlines are given in, nanoseconds
+inline u64 getMonotonicTime() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u64) time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+// the low `size` bytes of a value, zero or sign extended
+u64 getUnsigned(VMOperandSize size, VMWord &value);
+s64 getSigned(VMOperandSize size, VMWord &value);
 
 struct MetaVM {
     MetaVM (
-        memory_view<VMInstruction> &bytecode,
+        VMProgram &program,
         memory_view<u8> &memory,
         array_view<VMException> &exceptions
-    ) :      _bytecode(bytecode),
+    ) :        _program(program),
                  _memory(memory),
          _exceptions(exceptions)
     {
         _registers.data[30].u = _memory.size();
     }
 
-    void run();
+    // runs until the program halts or raises, or until about `budget`
+    // instructions ran or the clock passed `deadline` (see getMonotonicTime)
+    //
+    // budgets and deadlines are only looked at when control goes backwards
+    // (jumps to lower addresses, calls and returns), which every loop does,
+    // so straight-line code runs unchecked, a budget is charged the whole
+    // straight run between two such points, forward jumps in it included,
+    // so it can be overshot by one straight run at most
+    VMRunStatus run(u64 budget = VMRUN_UNLIMITED, u64 deadline = VMRUN_NO_DEADLINE);
+
+    // does what the first run of a program would do to it up front, a
+    // program shared by VMs on several threads has to be prepared before
+    // any of them runs, it is read-only from then on
+    static void prepare(VMProgram &program);
     void printRegisters();
     void printMemory();
     void printExceptions();
     void printAll(); 
 
+    VMRegisters const &getRegisters() const {
+        return _registers;
+    }
+
+    void setRegister(u8 index, VMWord value) {
+        _registers.data[index] = value;
+    }
+
+    // frames entered before are dropped with the registers they belong to,
+    // a LEAVE of one raises VMEXCEPT_STACK_UNDERFLOW
+    void setRegisters(VMRegisters const &registers) {
+        _registers = registers;
+        _frameDepth = 0;
+    }
+
+    // the frames ENTER made and LEAVE didn't drop yet, innermost last, they
+    // go with the registers, a VM picking up where another one stopped
+    // needs both (see VMSnapshot)
+    VMFrame const *getFrames() const {
+        return _frames;
+    }
+
+    u64 getFrameDepth() const {
+        return _frameDepth;
+    }
+
+    // `depth` is at most VMFRAME_DEPTH
+    void setRegisters(VMRegisters const &registers, VMFrame const *frames, u64 depth) {
+        _registers = registers;
+        std::memcpy(_frames, frames, depth * sizeof(VMFrame));
+        _frameDepth = depth;
+    }
+
+    // the last exception the program raised, caught by one of its handlers
+    // or not, with where it was raised
+    VMExceptionRecord const &getException() const {
+        return _exception;
+    }
+
+    // picks the handler for a decoded instruction, operand modes and sizes
+    // known at decode time select a specialized instance of the operation,
+    // `checked` is false once the program passed verifyProgram
+    static VMHandler resolveHandler(VMDecodedInstruction const &inst, bool checked = true);
+
+    // the natives VMOPCODE_CALLN calls, without any it raises
+    // VMEXCEPT_INVALID_OPERANDS
+    void attachNatives(VMNatives *natives) {
+        _natives = natives;
+    }
+
+    // completes the native call a run was suspended at with what the native
+    // would have returned had it not been pending, VMNATIVE_OK or a failure
+    // the next run raises at the CALLN, results go into the registers before,
+    // any thread can complete and run the VM but only once the suspended run
+    // returned, the VM does no locking of its own
+    void complete(VMNativeStatus status) {
+        if (!_suspended) return;
+        _suspended = false;
+        _completion = status;
+    }
+
+#if defined(METAVM_PROFILE)
+    // records every instruction the engines dispatch into `profile`
+    void attachProfile(VMProfile *profile) {
+        _profile = profile;
+    }
+#endif
+
+#if defined(METAVM_TRACE)
+    // records every instruction the engines retire into `trace`
+    void attachTrace(VMTrace *trace) {
+        _trace = trace;
+        for (u64 opcode = 0; opcode < 256; ++opcode) {
+            _destinations[opcode] = (s8) getDestinationOperand((u8) opcode);
+        }
+    }
+#endif
+
+#if defined(METAVM_JIT)
+    // calls to hot functions of the program run their compiled code
+    void attachJit(VMJit *jit) {
+        _jit = jit;
+    }
+#endif
+
 private:
     VMRegisters                  _registers {};
-    memory_view<VMInstruction>   &_bytecode;
+    VMProgram                     &_program;
     memory_view<u8>                &_memory;
     array_view<VMException>    &_exceptions;
 
-    u64 getIndirect(VMOperand const &operand) const;
-    u64 getDisplaced(VMOperand const &operand) const;
-    VMWord &getRegister(VMOperand const &operand);
-    VMWord &getMemoryFromPointer(VMOperand const &operand);
-    VMWord &getMemoryFromIndirect(VMOperand const &operand);
-    VMWord &getMemoryFromDisplaced(VMOperand const &operand);
+    // state of the current run, see run
+    VMRunStatus                          _status;
+    bool                                _limited;
+    u64                                  _budget;
+    u64                                _deadline;
+    u64                       _deadlineCountdown;
+
+    // where straight-line execution since the last checkpoint started
+    u64                              _runStart;
+
+    // the last exception raised, see getException
+    VMExceptionRecord               _exception {};
+
+    // the frames ENTER made, innermost last, see VMFrame
+    VMFrame                _frames[VMFRAME_DEPTH];
+    u64                         _frameDepth = 0;
+
+    VMNatives                  *_natives = nullptr;
+
+    // a run returned VMRUN_SUSPENDED and complete wasn't called yet, and
+    // what it was called with
+    bool                      _suspended = false;
+    VMNativeStatus           _completion = VMNATIVE_OK;
+
+#if defined(METAVM_PROFILE)
+    VMProfile                  *_profile = nullptr;
+#endif
+
+#if defined(METAVM_TRACE)
+    VMTrace                      *_trace = nullptr;
+
+    // getDestinationOperand of every opcode, looked up once per record
+    s8                     _destinations[256];
+#endif
+
+#if defined(METAVM_JIT)
+    VMJit                          *_jit = nullptr;
+#endif
+
+    u64 getIndirect(VMDecodedOperand const &operand) const;
+    u64 getDisplaced(VMDecodedOperand const &operand) const;
+    u64 getAddress(VMDecodedOperand const &operand) const;
+
+    // whether `length` bytes from `address` on are all inside memory
+    bool isInMemory(u64 address, u64 length) const {
+        return address <= _memory.size() && _memory.size() - address >= length;
+    }
+
+    // the decoder resolved the (sub) register to its offset already
+    VMWord &getRegister(VMDecodedOperand const &operand) {
+        return *reinterpret_cast<VMWord *>(reinterpret_cast<u8 *>(_registers.data) + operand.value);
+    }
+
+    VMWord &getMemoryFromPointer(VMDecodedOperand const &operand);
+    VMWord &getMemoryFromIndirect(VMDecodedOperand const &operand);
+    VMWord &getMemoryFromDisplaced(VMDecodedOperand const &operand);
     VMWord &getStackTop() const;
-    VMWord &getVMWord(VMOperand &operand);
-
-    void mov(VMInstruction &inst);
-    void push(VMInstruction &inst);
-    void pop(VMInstruction &inst);
-    void add(VMInstruction &inst);
-    void sub(VMInstruction &inst);
-    void mul(VMInstruction &inst);
-    void div(VMInstruction &inst);
-    void divr(VMInstruction &inst);
-    void adds(VMInstruction &inst);
-    void subs(VMInstruction &inst);
-    void muls(VMInstruction &inst);
-    void divs(VMInstruction &inst);
-    void divsr(VMInstruction &inst);
-    void addf(VMInstruction &inst);
-    void subf(VMInstruction &inst);
-    void mulf(VMInstruction &inst);
-    void divf(VMInstruction &inst);
-    void addfs(VMInstruction &inst);
-    void subfs(VMInstruction &inst);
-    void mulfs(VMInstruction &inst);
-    void divfs(VMInstruction &inst);
-    void neg(VMInstruction &inst);
-    void bitwise_and(VMInstruction &inst);
-    void bitwise_or(VMInstruction &inst);
-    void bitwise_xor(VMInstruction &inst);
-    void bitwise_not(VMInstruction &inst);
-    void jmp(VMInstruction &inst);
-    void jeq(VMInstruction &inst);
-    void jne(VMInstruction &inst);
-    void jgt(VMInstruction &inst);
-    void jlt(VMInstruction &inst);
-    void jge(VMInstruction &inst);
-    void jle(VMInstruction &inst);
-    void call(VMInstruction &inst);
-    void ret(VMInstruction &inst);
-
-    VMInstruction fetch();
+    VMWord &getVMWord(VMDecodedOperand const &operand);
+
+    // an unsigned operand of ENTER, frame layouts are qword immediates as a
+    // rule and those skip both the type and the size dispatch
+    u64 getFrameOperand(VMDecodedOperand const &operand) {
+        if (operand.type == VMOPTYPE_IMMEDIATE && operand.size == VMOPSIZE_QWORD) {
+            return _program.constants[operand.value].u;
+        }
+        return getUnsigned(operand.size, getVMWord(operand));
+    }
+
+    template<u8 Mode, VMOperandSize Size>
+    VMWord &getVMWord(VMDecodedOperand const &operand);
+
+    // charges the straight run that ended with a backward transfer of
+    // control at `address` to the budget, returns false to preempt
+    bool checkpoint(u64 address, u64 target) {
+        // every transfer of control past the start is a jump forward, which
+        // keeps it, or a checkpoint, which moves it, so the start is never
+        // past the address, the guard only keeps a broken start from
+        // charging the whole address space
+        u64 executed = address >= _runStart ? address - _runStart + 1 : 1;
+        _runStart = target;
+        if (!_limited) return true;
+
+        if (executed >= _budget) {
+            _budget = 0;
+            _status = VMRUN_PREEMPTED;
+            return false;
+        }
+        _budget -= executed;
+
+        if (_deadline != VMRUN_NO_DEADLINE && executed >= _deadlineCountdown) {
+            _deadlineCountdown = VMRUN_DEADLINE_INTERVAL;
+            if (getMonotonicTime() >= _deadline) {
+                _status = VMRUN_PREEMPTED;
+                return false;
+            }
+        } else {
+            _deadlineCountdown -= executed;
+        }
+        return true;
+    }
+
+    // moves the engine's instruction pointer `ip` to `target`, a jump to a
+    // lower address is a checkpoint
+    bool jump(u64 &ip, u64 target) {
+        u64 address = ip - 1;
+        ip = target;
+        return target > address || checkpoint(address, target);
+    }
+
+    // profiling hooks, empty unless built with -D METAVM_PROFILE
+    void profileDispatch(u64 address) {
+#if defined(METAVM_PROFILE)
+        VMProfile &profile = *_profile;
+        profile.entries[address].executions++;
+
+        // a sample ends at the dispatch after the one that started it
+        if (profile.sampling) {
+            VMProfileEntry &sampled = profile.entries[profile.sampleAddress];
+            sampled.cycles += readTimestamp() - profile.sampleStart;
+            sampled.samples++;
+            profile.sampling = false;
+        }
+
+        if (--profile.countdown == 0) {
+            profile.countdown = profile.nextCountdown();
+            profile.sampling = true;
+            profile.sampleAddress = address;
+            profile.sampleStart = readTimestamp();
+        }
+#else
+        (void) address;
+#endif
+    }
+
+    void profileBranch(u64 address, bool taken) {
+#if defined(METAVM_PROFILE)
+        if (_profile == nullptr) return;
+
+        VMProfileEntry &entry = _profile->entries[address];
+        if (taken) {
+            entry.taken++;
+        } else {
+            entry.notTaken++;
+        }
+#else
+        (void) address;
+        (void) taken;
+#endif
+    }
+
+    void profileCall(u64 target) {
+#if defined(METAVM_PROFILE)
+        if (_profile != nullptr) _profile->entries[target].calls++;
+#else
+        (void) target;
+#endif
+    }
+
+    // tracing hook, empty unless built with -D METAVM_TRACE, `inst` is the
+    // instruction at `address` and has just been retired
+    void traceRetire(VMDecodedInstruction const &inst, u64 address) {
+#if defined(METAVM_TRACE)
+        s32 destination = _destinations[inst.opcode];
+        if (destination < 0) {
+            _trace->record(address, inst.opcode, false, 0);
+            return;
+        }
+
+        VMDecodedOperand const &operand = destination == 0 ? inst.operand1 : destination == 1 ? inst.operand2 : inst.operand3;
+        if (operand.type != VMOPTYPE_REGISTER) {
+            _trace->record(address, inst.opcode, true, getTraceValue(operand));
+            return;
+        }
+
+        u64 value = getRegister(operand).u;
+        if (operand.size != VMOPSIZE_QWORD) value &= (1ull << 8 * operand.size) - 1;
+        _trace->record(address, inst.opcode, true, value);
+#else
+        (void) inst;
+        (void) address;
+#endif
+    }
+
+    // the value of a destination that isn't a register, the first lane of
+    // vectors, zero for memory that's out of range
+    u64 getTraceValue(VMDecodedOperand const &operand);
+
+    // records the exception, handlers return its result so the dispatch
+    // loop only has to look at the status in a register, where it was
+    // raised is filled in once the engine stopped (see catchException)
+    bool raise(VMException exception, s32 operand = VMEXCEPTION_NO_OPERAND) {
+        _exception = { exception, operand, 0 };
+        return false;
+    }
+
+    // raises what a native call failed with
+    bool raiseNative(VMNativeStatus status) {
+        return raise(status == VMNATIVE_INVALID_ADDRESS ? VMEXCEPT_INVALID_ADDRESS : VMEXCEPT_NATIVE_FAILED);
+    }
+
+    // looks up the handler of the exception the engine stopped on, returns
+    // true if the run continues there, otherwise the exception goes to the
+    // exceptions the VM was given
+    bool catchException();
+
+    // runs a member handler through a VMHandler
+    template<bool (MetaVM::*Handler)(VMDecodedInstruction const &)>
+    static bool member(MetaVM &vm, VMDecodedInstruction const &inst) {
+        return (vm.*Handler)(inst);
+    }
+
+    template<bool Checked> bool mov(VMDecodedInstruction const &inst);
+    template<bool Checked> bool pop(VMDecodedInstruction const &inst);
+
+    // moves and stack operations specialized on operand modes and the size
+    // of the value, see metavm_inst.cpp
+    template<u8 Src, u8 Dst, VMOperandSize Size>
+    static bool move(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<u8 Src, VMOperandSize Size>
+    static bool pushValue(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<u8 Dst, VMOperandSize Size>
+    static bool popValue(MetaVM &vm, VMDecodedInstruction const &inst);
+    static VMHandler resolveMove(VMDecodedInstruction const &inst, bool checked);
+    template<u8 Src>
+    static VMHandler resolveMove(u8 dst, VMOperandSize size);
+    template<u8 Src, u8 Dst>
+    static VMHandler resolveMove(VMOperandSize size);
+    static VMHandler resolvePush(VMDecodedInstruction const &inst);
+    static VMHandler resolvePop(VMDecodedInstruction const &inst, bool checked);
+
+    // a push directly followed by a pop of the same size, see VMSUPER_PUSH_POP
+    bool pushPop(VMDecodedInstruction const &push, VMDecodedInstruction const &pop);
+    template<VMOperandSize Size>
+    bool pushPop(VMDecodedInstruction const &push, VMDecodedInstruction const &pop);
+
+    // binary operations, see metavm_inst.cpp
+    template<VMOPCode Op, bool Checked>
+    static bool binary(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMOPCode Op, u8 Lhs, u8 Rhs, u8 Dst, VMOperandSize Size>
+    static bool binary(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMOPCode Op>
+    static VMHandler resolveBinary(VMDecodedInstruction const &inst, bool checked);
+    template<VMOPCode Op, u8 Lhs>
+    static VMHandler resolveBinary(u8 rhs, u8 dst, VMOperandSize size);
+    template<VMOPCode Op, u8 Lhs, u8 Rhs>
+    static VMHandler resolveBinary(u8 dst, VMOperandSize size);
+    template<VMOPCode Op, u8 Lhs, u8 Rhs, u8 Dst>
+    static VMHandler resolveBinary(VMOperandSize size);
+    template<VMOPCode Op, VMOperandSize Size, VMOperandSize Wide>
+    static bool widening(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMOPCode Op>
+    static VMHandler resolveWidening(VMOperandSize size, VMOperandSize wide);
+
+    // vector operations, see metavm_vector.cpp, their operands are checked
+    // once by resolveVector, which picks a raising handler for invalid ones
+    static VMHandler resolveVector(VMDecodedInstruction const &inst);
+    template<VMOPCode Op>
+    static VMHandler resolveLanes(VMOperandSize size);
+    template<VMOPCode Op, VMOperandSize Size>
+    static bool vectorLanes(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<bool Store>
+    static bool vectorMove(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMOperandSize Size>
+    static bool vectorSplat(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMOperandSize Size>
+    static bool vectorExtract(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMValueKind Kind, VMOperandSize Size>
+    static bool vectorSum(MetaVM &vm, VMDecodedInstruction const &inst);
+
+    // the handler resolveVector and resolveMemory pick for invalid operands
+    static bool invalidOperands(MetaVM &vm, VMDecodedInstruction const &inst);
+
+    // bulk memory operations, see metavm_memory.cpp, checked like vectors
+    static VMHandler resolveMemory(VMDecodedInstruction const &inst);
+    static bool memoryCopy(MetaVM &vm, VMDecodedInstruction const &inst);
+    static bool memoryFill(MetaVM &vm, VMDecodedInstruction const &inst);
+    static bool memoryCompare(MetaVM &vm, VMDecodedInstruction const &inst);
+    static bool memoryFind(MetaVM &vm, VMDecodedInstruction const &inst);
+
+    // neg and not, specialized on the mode and size of their operand, the
+    // generic instances only take immediates
+    template<bool Checked> bool neg(VMDecodedInstruction const &inst);
+    template<bool Checked> bool bitwise_not(VMDecodedInstruction const &inst);
+    template<VMOPCode Op, u8 Mode, VMOperandSize Size>
+    static bool unary(MetaVM &vm, VMDecodedInstruction const &inst);
+    template<VMOPCode Op>
+    static VMHandler resolveUnary(VMDecodedInstruction const &inst, bool checked);
+    template<VMOPCode Op, u8 Mode>
+    static VMHandler resolveUnary(VMOperandSize size);
+
+    // control flow, defined next to the engines in metavm.cpp so it inlines
+    // into them, `ip` is the engine's instruction pointer (see execute)
+    template<bool Checked> bool jmp(VMDecodedInstruction const &inst, u64 &ip);
+    template<bool Checked> bool getTarget(VMDecodedOperand const &target, u64 &address);
+    template<bool Checked, VMOPCode Op> bool branch(VMDecodedInstruction const &inst, u64 &ip);
+    template<bool Checked> bool jeq(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JEQ>(inst, ip); }
+    template<bool Checked> bool jne(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JNE>(inst, ip); }
+    template<bool Checked> bool jgt(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JGT>(inst, ip); }
+    template<bool Checked> bool jlt(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JLT>(inst, ip); }
+    template<bool Checked> bool jge(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JGE>(inst, ip); }
+    template<bool Checked> bool jle(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JLE>(inst, ip); }
+    template<bool Checked> bool jgts(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JGTS>(inst, ip); }
+    template<bool Checked> bool jlts(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JLTS>(inst, ip); }
+    template<bool Checked> bool jges(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JGES>(inst, ip); }
+    template<bool Checked> bool jles(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JLES>(inst, ip); }
+    template<bool Checked> bool jeqf(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JEQF>(inst, ip); }
+    template<bool Checked> bool jnef(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JNEF>(inst, ip); }
+    template<bool Checked> bool jgtf(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JGTF>(inst, ip); }
+    template<bool Checked> bool jltf(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JLTF>(inst, ip); }
+    template<bool Checked> bool jgef(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JGEF>(inst, ip); }
+    template<bool Checked> bool jlef(VMDecodedInstruction const &inst, u64 &ip) { return branch<Checked, VMOPCODE_JLEF>(inst, ip); }
+    template<bool Checked> bool call(VMDecodedInstruction const &inst, u64 &ip);
+    template<bool Checked> bool ret(VMDecodedInstruction const &inst, u64 &ip);
+    template<bool Checked> bool enter(VMDecodedInstruction const &inst, u64 &ip);
+    template<bool Checked> bool leave(VMDecodedInstruction const &inst, u64 &ip);
+    template<bool Checked> bool calln(VMDecodedInstruction const &inst, u64 &ip);
+
+    // the dispatch loop, `Checked` is false for verified programs, with
+    // `linkOnly` it returns once the program is linked
+    //
+    // the instruction pointer lives in a local for the whole run and r31
+    // only sees it on the way out and around the few resolved handlers that
+    // use r31 as an operand (see VMDISPATCH_SYNCED), which is what lets the
+    // compiler keep it in a host register
+    template<bool Checked> void execute(bool linkOnly);
 };
 
 #endif
@@ -2,56 +2,36 @@
 #include "types.hpp"
 #include "metavm.hpp"
 
-// NOTE: many opcodes implementations can be reduced to a macro, but I don't have the time to it, so copy pasting for now :)
+// the generic move and pop, only invalid operands end up here, see resolveMove
 
-void MetaVM::mov(VMInstruction &inst) {
-    VMOperand src = inst.operand1;
-    VMOperand dst = inst.operand2;
-    u8 size = src.size;
-    u8 dstSize = dst.size;
-    if (dstSize < size || dst.type == VMOPTYPE_IMMEDIATE) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+template<bool Checked>
+bool MetaVM::mov(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &src = inst.operand1;
+    VMDecodedOperand const &dst = inst.operand2;
+    if (Checked && (dst.size < src.size || dst.type == VMOPTYPE_IMMEDIATE)) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 1);
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &srcWord = getVMWord(src);
-
-    for (u8 i = 0; i < size; ++i) {
-        dstWord.ubytes[i] = srcWord.ubytes[i];
-    }
+    std::memmove((void *) &getVMWord(dst), &getVMWord(src), src.size);
+    return true;
 }
 
-void MetaVM::push(VMInstruction &inst) {
-    VMOperand src = inst.operand1;
-    u8 size = src.size;
-    if (_registers.data[30].u - size >= _memory.size()) {
-        _exceptions.append(VMEXCEPT_STACK_OVERFLOW);
-        return;
-    }
-    _registers.data[30].u -= size;
-    VMWord &stackTop = getStackTop();
-    VMWord &srcVMWord = getVMWord(src);
-
-    for (u8 i = 0; i < size; ++i) {
-        stackTop.ubytes[i] = srcVMWord.ubytes[i];
+template<bool Checked>
+bool MetaVM::pop(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &dst = inst.operand1;
+    if (Checked && dst.type == VMOPTYPE_IMMEDIATE) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
     }
-}
 
-void MetaVM::pop(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    u8 size = dst.size;
-    if (_registers.data[30].u + size >= _memory.size()) {
-        _exceptions.append(VMEXCEPT_STACK_UNDERFLOW);
-        return;
+    u64 top = _registers.data[30].u;
+    if (!isInMemory(top, dst.size)) {
+        return raise(VMEXCEPT_STACK_UNDERFLOW);
     }
-    VMWord &stackTop = getStackTop();
-    _registers.data[30].u += size;
-    VMWord &dstVMWord = getVMWord(dst);
 
-    for (u8 i = 0; i < size; ++i) {
-        dstVMWord.ubytes[i] = stackTop.ubytes[i];
-    }
+    // the destination is written with the stack pointer already moved
+    _registers.data[30].u = top + dst.size;
+    std::memmove((void *) &getVMWord(dst), &_memory[top], dst.size);
+    return true;
 }
 
 u64 getUnsigned(VMOperandSize size, VMWord &value) {
@@ -74,907 +54,520 @@ s64 getSigned(VMOperandSize size, VMWord &value) {
     }
 }
 
-void MetaVM::add(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.ubytes[0] = lhsWord.ubytes[0] + rhsWord.ubytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue + rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue + rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.u = lhsValue + rhsValue;
-        } break;
+// binary operations (arithmetics and bits) are implemented once as templates,
+// resolveHandler picks a specialized instance per instruction at decode time
+// so the common "all operands have the same size" forms run without any
+// operand or size switch, anything else goes through the generic instance
+
+// operand modes handlers are specialized on, every memory form shares one mode
+enum VMOperandMode : u8 {
+    VMMODE_REGISTER,
+    VMMODE_IMMEDIATE,
+    VMMODE_MEMORY,
+};
+
+template<VMOPCode Op> struct VMBinaryOperation;
+
+// the bits family takes its destination first and sources of one size, and
+// a float operation only accepts operands of `floatOperandSize`
+#define binop(opcode, valueKind, floatOperandSize, destinationFirst, expression)        \
+    template<> struct VMBinaryOperation<opcode> {                                      \
+        static constexpr VMValueKind kind = valueKind;                                 \
+        static constexpr VMOperandSize floatSize = floatOperandSize;                   \
+        static constexpr bool dstFirst = destinationFirst;                             \
+        template<typename T> static T apply(T lhs, T rhs) { return expression; }       \
+    };
+
+binop(VMOPCODE_ADD,   VMVALUE_UNSIGNED, VMOPSIZE_QWORD, false, lhs + rhs)
+binop(VMOPCODE_SUB,   VMVALUE_UNSIGNED, VMOPSIZE_QWORD, false, lhs - rhs)
+binop(VMOPCODE_MUL,   VMVALUE_UNSIGNED, VMOPSIZE_QWORD, false, lhs * rhs)
+binop(VMOPCODE_DIV,   VMVALUE_UNSIGNED, VMOPSIZE_QWORD, false, lhs / rhs)
+binop(VMOPCODE_DIVR,  VMVALUE_UNSIGNED, VMOPSIZE_QWORD, false, lhs % rhs)
+binop(VMOPCODE_ADDS,  VMVALUE_SIGNED,   VMOPSIZE_QWORD, false, lhs + rhs)
+binop(VMOPCODE_SUBS,  VMVALUE_SIGNED,   VMOPSIZE_QWORD, false, lhs - rhs)
+binop(VMOPCODE_MULS,  VMVALUE_SIGNED,   VMOPSIZE_QWORD, false, lhs * rhs)
+binop(VMOPCODE_DIVS,  VMVALUE_SIGNED,   VMOPSIZE_QWORD, false, lhs / rhs)
+binop(VMOPCODE_DIVSR, VMVALUE_SIGNED,   VMOPSIZE_QWORD, false, lhs % rhs)
+binop(VMOPCODE_ADDF,  VMVALUE_FLOAT,    VMOPSIZE_QWORD, false, lhs + rhs)
+binop(VMOPCODE_SUBF,  VMVALUE_FLOAT,    VMOPSIZE_QWORD, false, lhs - rhs)
+binop(VMOPCODE_MULF,  VMVALUE_FLOAT,    VMOPSIZE_QWORD, false, lhs * rhs)
+binop(VMOPCODE_DIVF,  VMVALUE_FLOAT,    VMOPSIZE_QWORD, false, lhs / rhs)
+binop(VMOPCODE_ADDFS, VMVALUE_FLOAT,    VMOPSIZE_DWORD, false, lhs + rhs)
+binop(VMOPCODE_SUBFS, VMVALUE_FLOAT,    VMOPSIZE_DWORD, false, lhs - rhs)
+binop(VMOPCODE_MULFS, VMVALUE_FLOAT,    VMOPSIZE_DWORD, false, lhs * rhs)
+binop(VMOPCODE_DIVFS, VMVALUE_FLOAT,    VMOPSIZE_DWORD, false, lhs / rhs)
+binop(VMOPCODE_AND,   VMVALUE_UNSIGNED, VMOPSIZE_QWORD, true,  lhs & rhs)
+binop(VMOPCODE_OR,    VMVALUE_UNSIGNED, VMOPSIZE_QWORD, true,  lhs | rhs)
+binop(VMOPCODE_XOR,   VMVALUE_UNSIGNED, VMOPSIZE_QWORD, true,  lhs ^ rhs)
+
+#undef binop
+
+template<typename T>
+static T loadValue(void const *source) {
+    T value;
+    std::memcpy(&value, source, sizeof(T));
+    return value;
+}
+
+template<typename T>
+static void storeValue(void *destination, T value) {
+    std::memcpy(destination, &value, sizeof(T));
+}
+
+static VMOperandMode getOperandMode(VMDecodedOperand const &operand) {
+    switch (operand.type) {
+        case VMOPTYPE_REGISTER:  return VMMODE_REGISTER;
+        case VMOPTYPE_IMMEDIATE: return VMMODE_IMMEDIATE;
+        default:                 return VMMODE_MEMORY;
+    }
+}
+
+template<u8 Mode, VMOperandSize Size>
+VMWord &MetaVM::getVMWord(VMDecodedOperand const &operand) {
+    if constexpr (Mode == VMMODE_REGISTER) {
+        return getRegister(operand);
+    } else if constexpr (Mode == VMMODE_IMMEDIATE) {
+        return _program.constants[operand.value];
+    } else {
+        return getVMWord(operand);
+    }
+}
+
+template<VMOPCode Op, bool Checked>
+bool MetaVM::binary(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using Operation = VMBinaryOperation<Op>;
+    VMDecodedOperand const &dst = Operation::dstFirst ? inst.operand1 : inst.operand3;
+    VMDecodedOperand const &lhs = Operation::dstFirst ? inst.operand2 : inst.operand1;
+    VMDecodedOperand const &rhs = Operation::dstFirst ? inst.operand3 : inst.operand2;
+
+    bool valid = dst.type != VMOPTYPE_IMMEDIATE;
+    if constexpr (Operation::kind == VMVALUE_FLOAT) {
+        valid = valid && dst.size == Operation::floatSize && lhs.size == dst.size && rhs.size == dst.size;
+    } else {
+        valid = valid && dst.size >= lhs.size && dst.size >= rhs.size;
+        if constexpr (Operation::dstFirst) valid = valid && lhs.size == rhs.size;
+    }
+
+    if (Checked && !valid) {
+        return vm.raise(VMEXCEPT_INVALID_OPERANDS, Operation::dstFirst ? 0 : 2);
+    }
+
+    VMWord &dstWord = vm.getVMWord(dst);
+    VMWord &lhsWord = vm.getVMWord(lhs);
+    VMWord &rhsWord = vm.getVMWord(rhs);
+
+    if constexpr (Operation::kind == VMVALUE_FLOAT) {
+        using T = typename VMValue<VMVALUE_FLOAT, Operation::floatSize>::type;
+        storeValue<T>(&dstWord, Operation::apply(loadValue<T>(&lhsWord), loadValue<T>(&rhsWord)));
+    } else {
+        // narrower sources are widened to the destination size first
+        constexpr VMValueKind kind = Operation::kind;
+        s64 lhsValue = kind == VMVALUE_SIGNED ? getSigned(lhs.size, lhsWord) : (s64) getUnsigned(lhs.size, lhsWord);
+        s64 rhsValue = kind == VMVALUE_SIGNED ? getSigned(rhs.size, rhsWord) : (s64) getUnsigned(rhs.size, rhsWord);
+
+        switch (dst.size) {
+            case VMOPSIZE_QWORD: {
+                using T = typename VMValue<kind, VMOPSIZE_QWORD>::type;
+                storeValue<T>(&dstWord, Operation::apply((T) lhsValue, (T) rhsValue));
+            } break;
+            case VMOPSIZE_DWORD: {
+                using T = typename VMValue<kind, VMOPSIZE_DWORD>::type;
+                storeValue<T>(&dstWord, Operation::apply((T) lhsValue, (T) rhsValue));
+            } break;
+            case VMOPSIZE_WORD: {
+                using T = typename VMValue<kind, VMOPSIZE_WORD>::type;
+                storeValue<T>(&dstWord, Operation::apply((T) lhsValue, (T) rhsValue));
+            } break;
+            case VMOPSIZE_BYTE: {
+                using T = typename VMValue<kind, VMOPSIZE_BYTE>::type;
+                storeValue<T>(&dstWord, Operation::apply((T) lhsValue, (T) rhsValue));
+            } break;
+        }
+    }
+
+    return true;
+}
+
+template<VMOPCode Op, u8 Lhs, u8 Rhs, u8 Dst, VMOperandSize Size>
+bool MetaVM::binary(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using Operation = VMBinaryOperation<Op>;
+    using T = typename VMValue<Operation::kind, Size>::type;
+    VMDecodedOperand const &dst = Operation::dstFirst ? inst.operand1 : inst.operand3;
+    VMDecodedOperand const &lhs = Operation::dstFirst ? inst.operand2 : inst.operand1;
+    VMDecodedOperand const &rhs = Operation::dstFirst ? inst.operand3 : inst.operand2;
+
+    // operand validity was established by resolveHandler
+    T lhsValue = loadValue<T>(&vm.getVMWord<Lhs, Size>(lhs));
+    T rhsValue = loadValue<T>(&vm.getVMWord<Rhs, Size>(rhs));
+    storeValue<T>(&vm.getVMWord<Dst, Size>(dst), Operation::apply(lhsValue, rhsValue));
+
+    return true;
+}
+
+template<VMOPCode Op, u8 Lhs, u8 Rhs, u8 Dst>
+VMHandler MetaVM::resolveBinary(VMOperandSize size) {
+    if constexpr (VMBinaryOperation<Op>::kind == VMVALUE_FLOAT) {
+        constexpr VMOperandSize floatSize = VMBinaryOperation<Op>::floatSize;
+        return size == floatSize ? &binary<Op, Lhs, Rhs, Dst, floatSize> : &binary<Op, true>;
+    } else {
+        switch (size) {
+            case VMOPSIZE_QWORD: return &binary<Op, Lhs, Rhs, Dst, VMOPSIZE_QWORD>;
+            case VMOPSIZE_DWORD: return &binary<Op, Lhs, Rhs, Dst, VMOPSIZE_DWORD>;
+            case VMOPSIZE_WORD:  return &binary<Op, Lhs, Rhs, Dst, VMOPSIZE_WORD>;
+            default:             return &binary<Op, Lhs, Rhs, Dst, VMOPSIZE_BYTE>;
+        }
+    }
+}
+
+template<VMOPCode Op, u8 Lhs, u8 Rhs>
+VMHandler MetaVM::resolveBinary(u8 dst, VMOperandSize size) {
+    switch (dst) {
+        case VMMODE_REGISTER: return resolveBinary<Op, Lhs, Rhs, VMMODE_REGISTER>(size);
+        default:              return resolveBinary<Op, Lhs, Rhs, VMMODE_MEMORY>(size);
+    }
+}
+
+template<VMOPCode Op, u8 Lhs>
+VMHandler MetaVM::resolveBinary(u8 rhs, u8 dst, VMOperandSize size) {
+    switch (rhs) {
+        case VMMODE_REGISTER:  return resolveBinary<Op, Lhs, VMMODE_REGISTER>(dst, size);
+        case VMMODE_IMMEDIATE: return resolveBinary<Op, Lhs, VMMODE_IMMEDIATE>(dst, size);
+        default:               return resolveBinary<Op, Lhs, VMMODE_MEMORY>(dst, size);
+    }
+}
+
+// narrow sources into a wider destination, extended like the generic
+// instance does but without its switches over the operand sizes, the
+// operands themselves still go through getVMWord
+template<VMOPCode Op, VMOperandSize Size, VMOperandSize Wide>
+bool MetaVM::widening(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using Operation = VMBinaryOperation<Op>;
+    using T = typename VMValue<Operation::kind, Size>::type;
+    using W = typename VMValue<Operation::kind, Wide>::type;
+    VMDecodedOperand const &dst = Operation::dstFirst ? inst.operand1 : inst.operand3;
+    VMDecodedOperand const &lhs = Operation::dstFirst ? inst.operand2 : inst.operand1;
+    VMDecodedOperand const &rhs = Operation::dstFirst ? inst.operand3 : inst.operand2;
+
+    W lhsValue = loadValue<T>(&vm.getVMWord(lhs));
+    W rhsValue = loadValue<T>(&vm.getVMWord(rhs));
+    storeValue<W>(&vm.getVMWord(dst), Operation::apply(lhsValue, rhsValue));
+
+    return true;
+}
+
+template<VMOPCode Op>
+VMHandler MetaVM::resolveWidening(VMOperandSize size, VMOperandSize wide) {
+    if constexpr (VMBinaryOperation<Op>::kind == VMVALUE_FLOAT) {
+        return nullptr;
+    } else {
+        switch (size) {
+            case VMOPSIZE_BYTE:
+                if (wide == VMOPSIZE_WORD)  return &widening<Op, VMOPSIZE_BYTE, VMOPSIZE_WORD>;
+                if (wide == VMOPSIZE_DWORD) return &widening<Op, VMOPSIZE_BYTE, VMOPSIZE_DWORD>;
+                return &widening<Op, VMOPSIZE_BYTE, VMOPSIZE_QWORD>;
+            case VMOPSIZE_WORD:
+                if (wide == VMOPSIZE_DWORD) return &widening<Op, VMOPSIZE_WORD, VMOPSIZE_DWORD>;
+                return &widening<Op, VMOPSIZE_WORD, VMOPSIZE_QWORD>;
+            default:
+                return &widening<Op, VMOPSIZE_DWORD, VMOPSIZE_QWORD>;
+        }
     }
 }
 
-void MetaVM::sub(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
+template<VMOPCode Op>
+VMHandler MetaVM::resolveBinary(VMDecodedInstruction const &inst, bool checked) {
+    using Operation = VMBinaryOperation<Op>;
+    VMDecodedOperand const &dst = Operation::dstFirst ? inst.operand1 : inst.operand3;
+    VMDecodedOperand const &lhs = Operation::dstFirst ? inst.operand2 : inst.operand1;
+    VMDecodedOperand const &rhs = Operation::dstFirst ? inst.operand3 : inst.operand2;
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.ubytes[0] = lhsWord.ubytes[0] - rhsWord.ubytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue - rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue - rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.u = lhsValue - rhsValue;
-        } break;
+    // invalid operands and sources of two different sizes are left to the
+    // generic instance, which only validates the operands for unverified
+    // programs, equally narrow sources into a wider destination are widened
+    // by an instance of their own
+    if (Operation::kind != VMVALUE_FLOAT && dst.type != VMOPTYPE_IMMEDIATE &&
+        lhs.size == rhs.size && lhs.size < dst.size) {
+        return resolveWidening<Op>(lhs.size, dst.size);
     }
-}
-
-void MetaVM::mul(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+    if (dst.type == VMOPTYPE_IMMEDIATE || lhs.size != dst.size || rhs.size != dst.size) {
+        return checked ? &binary<Op, true> : &binary<Op, false>;
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.ubytes[0] = lhsWord.ubytes[0] * rhsWord.ubytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue * rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue * rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.u = lhsValue * rhsValue;
-        } break;
+    u8 rhsMode = getOperandMode(rhs);
+    u8 dstMode = getOperandMode(dst);
+    switch (getOperandMode(lhs)) {
+        case VMMODE_REGISTER:  return resolveBinary<Op, VMMODE_REGISTER>(rhsMode, dstMode, dst.size);
+        case VMMODE_IMMEDIATE: return resolveBinary<Op, VMMODE_IMMEDIATE>(rhsMode, dstMode, dst.size);
+        default:               return resolveBinary<Op, VMMODE_MEMORY>(rhsMode, dstMode, dst.size);
     }
 }
 
-void MetaVM::div(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
+// moves, pushes and pops are specialized on the modes of their operands and
+// the size of the value they move, a single load and store of that size
+// instead of a copy through the bytes of a VMWord
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
+template<u8 Src, u8 Dst, VMOperandSize Size>
+bool MetaVM::move(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using T = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
 
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.ubytes[0] = lhsWord.ubytes[0] / rhsWord.ubytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue / rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue / rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.u = lhsValue / rhsValue;
-        } break;
-    }
+    // a wider destination keeps its upper bytes
+    T value = loadValue<T>(&vm.getVMWord<Src, Size>(inst.operand1));
+    storeValue<T>(&vm.getVMWord<Dst, Size>(inst.operand2), value);
+    return true;
 }
 
-void MetaVM::divr(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+template<u8 Src, VMOperandSize Size>
+bool MetaVM::pushValue(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using T = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
+    u64 top = vm._registers.data[30].u - Size;
+    if (!vm.isInMemory(top, Size)) {
+        return vm.raise(VMEXCEPT_STACK_OVERFLOW);
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.ubytes[0] = lhsWord.ubytes[0] % rhsWord.ubytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue % rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue % rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(lhs.size, rhsWord);
-            dstWord.u = lhsValue % rhsValue;
-        } break;
-    }
+    vm._registers.data[30].u = top;
+    storeValue<T>(&vm._memory[top], loadValue<T>(&vm.getVMWord<Src, Size>(inst.operand1)));
+    return true;
 }
 
-void MetaVM::adds(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.sbytes[0] = lhsWord.sbytes[0] + rhsWord.sbytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            s16 lhsValue = getSigned(lhs.size, lhsWord);
-            s16 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.swords[0] = lhsValue + rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            s32 lhsValue = getSigned(lhs.size, lhsWord);
-            s32 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.sdwords[0] = lhsValue + rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            s64 lhsValue = getSigned(lhs.size, lhsWord);
-            s64 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.s = lhsValue + rhsValue;
-        } break;
+template<u8 Dst, VMOperandSize Size>
+bool MetaVM::popValue(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using T = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
+    u64 top = vm._registers.data[30].u;
+    if (!vm.isInMemory(top, Size)) {
+        return vm.raise(VMEXCEPT_STACK_UNDERFLOW);
     }
+
+    vm._registers.data[30].u = top + Size;
+    storeValue<T>(&vm.getVMWord<Dst, Size>(inst.operand1), loadValue<T>(&vm._memory[top]));
+    return true;
 }
 
-void MetaVM::subs(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.sbytes[0] = lhsWord.sbytes[0] - rhsWord.sbytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            s16 lhsValue = getSigned(lhs.size, lhsWord);
-            s16 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.swords[0] = lhsValue - rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            s32 lhsValue = getSigned(lhs.size, lhsWord);
-            s32 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.sdwords[0] = lhsValue - rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            s64 lhsValue = getSigned(lhs.size, lhsWord);
-            s64 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.s = lhsValue - rhsValue;
-        } break;
+template<u8 Src, u8 Dst>
+VMHandler MetaVM::resolveMove(VMOperandSize size) {
+    switch (size) {
+        case VMOPSIZE_QWORD: return &move<Src, Dst, VMOPSIZE_QWORD>;
+        case VMOPSIZE_DWORD: return &move<Src, Dst, VMOPSIZE_DWORD>;
+        case VMOPSIZE_WORD:  return &move<Src, Dst, VMOPSIZE_WORD>;
+        default:             return &move<Src, Dst, VMOPSIZE_BYTE>;
     }
 }
 
-void MetaVM::muls(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.sbytes[0] = lhsWord.sbytes[0] * rhsWord.sbytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            s16 lhsValue = getSigned(lhs.size, lhsWord);
-            s16 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.swords[0] = lhsValue * rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            s32 lhsValue = getSigned(lhs.size, lhsWord);
-            s32 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.sdwords[0] = lhsValue * rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            s64 lhsValue = getSigned(lhs.size, lhsWord);
-            s64 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.s = lhsValue * rhsValue;
-        } break;
+template<u8 Src>
+VMHandler MetaVM::resolveMove(u8 dst, VMOperandSize size) {
+    switch (dst) {
+        case VMMODE_REGISTER: return resolveMove<Src, VMMODE_REGISTER>(size);
+        default:              return resolveMove<Src, VMMODE_MEMORY>(size);
     }
 }
 
-void MetaVM::divs(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
+VMHandler MetaVM::resolveMove(VMDecodedInstruction const &inst, bool checked) {
+    VMDecodedOperand const &src = inst.operand1;
+    VMDecodedOperand const &dst = inst.operand2;
 
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+    // invalid operands are left to the generic instance, like for binary
+    // operations, which only validates them for unverified programs
+    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < src.size) {
+        return checked ? &member<&MetaVM::mov<true>> : &member<&MetaVM::mov<false>>;
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.sbytes[0] = lhsWord.sbytes[0] / rhsWord.sbytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            s16 lhsValue = getSigned(lhs.size, lhsWord);
-            s16 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.swords[0] = lhsValue / rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            s32 lhsValue = getSigned(lhs.size, lhsWord);
-            s32 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.sdwords[0] = lhsValue / rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            s64 lhsValue = getSigned(lhs.size, lhsWord);
-            s64 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.s = lhsValue / rhsValue;
-        } break;
+    u8 dstMode = getOperandMode(dst);
+    switch (getOperandMode(src)) {
+        case VMMODE_REGISTER:  return resolveMove<VMMODE_REGISTER>(dstMode, src.size);
+        case VMMODE_IMMEDIATE: return resolveMove<VMMODE_IMMEDIATE>(dstMode, src.size);
+        default:               return resolveMove<VMMODE_MEMORY>(dstMode, src.size);
     }
 }
 
-void MetaVM::divsr(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (dst.type == VMOPTYPE_IMMEDIATE || dst.size < lhs.size || dst.size < rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+// `stack` stands for pushValue or popValue, `mode` for the operand's mode
+#define sized(stack, mode, size)                                        \
+    switch (size) {                                                     \
+        case VMOPSIZE_QWORD: return &stack<mode, VMOPSIZE_QWORD>;       \
+        case VMOPSIZE_DWORD: return &stack<mode, VMOPSIZE_DWORD>;       \
+        case VMOPSIZE_WORD:  return &stack<mode, VMOPSIZE_WORD>;        \
+        default:             return &stack<mode, VMOPSIZE_BYTE>;        \
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_BYTE: {
-            // lhs and rhs are guaranteed to be 1 byte long
-            dstWord.sbytes[0] = lhsWord.sbytes[0] % rhsWord.sbytes[0];
-        } break;
-        case VMOPSIZE_WORD: {
-            s16 lhsValue = getSigned(lhs.size, lhsWord);
-            s16 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.swords[0] = lhsValue % rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            s32 lhsValue = getSigned(lhs.size, lhsWord);
-            s32 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.sdwords[0] = lhsValue % rhsValue;
-        } break;
-        case VMOPSIZE_QWORD: {
-            s64 lhsValue = getSigned(lhs.size, lhsWord);
-            s64 rhsValue = getSigned(lhs.size, rhsWord);
-            dstWord.s = lhsValue % rhsValue;
-        } break;
+VMHandler MetaVM::resolvePush(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &src = inst.operand1;
+    switch (getOperandMode(src)) {
+        case VMMODE_REGISTER:  sized(pushValue, VMMODE_REGISTER, src.size);
+        case VMMODE_IMMEDIATE: sized(pushValue, VMMODE_IMMEDIATE, src.size);
+        default:               sized(pushValue, VMMODE_MEMORY, src.size);
     }
 }
 
-void MetaVM::addf(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (
-        dst.size != VMOPSIZE_QWORD ||
-        lhs.size != VMOPSIZE_QWORD ||
-        rhs.size != VMOPSIZE_QWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.f = lhsWord.f + rhsWord.f;
-}
-
-void MetaVM::subf(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (
-        dst.size != VMOPSIZE_QWORD ||
-        lhs.size != VMOPSIZE_QWORD ||
-        rhs.size != VMOPSIZE_QWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+VMHandler MetaVM::resolvePop(VMDecodedInstruction const &inst, bool checked) {
+    VMDecodedOperand const &dst = inst.operand1;
+    switch (getOperandMode(dst)) {
+        case VMMODE_REGISTER:  sized(popValue, VMMODE_REGISTER, dst.size);
+        case VMMODE_MEMORY:    sized(popValue, VMMODE_MEMORY, dst.size);
+        default:               return checked ? &member<&MetaVM::pop<true>> : &member<&MetaVM::pop<false>>;
     }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.f = lhsWord.f - rhsWord.f;
 }
 
-void MetaVM::mulf(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
+#undef sized
 
-    if (
-        dst.size != VMOPSIZE_QWORD ||
-        lhs.size != VMOPSIZE_QWORD ||
-        rhs.size != VMOPSIZE_QWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+template<VMOperandSize Size>
+bool MetaVM::pushPop(VMDecodedInstruction const &push, VMDecodedInstruction const &pop) {
+    using T = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
+    u64 top = _registers.data[30].u - Size;
+    if (!isInMemory(top, Size)) {
+        return raise(VMEXCEPT_STACK_OVERFLOW);
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.f = lhsWord.f * rhsWord.f;
+    // the slot below the stack pointer still ends up holding the value
+    T value = loadValue<T>(&getVMWord(push.operand1));
+    storeValue<T>(&_memory[top], value);
+    storeValue<T>(&getVMWord(pop.operand1), value);
+    return true;
 }
 
-void MetaVM::divf(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (
-        dst.size != VMOPSIZE_QWORD ||
-        lhs.size != VMOPSIZE_QWORD ||
-        rhs.size != VMOPSIZE_QWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+bool MetaVM::pushPop(VMDecodedInstruction const &push, VMDecodedInstruction const &pop) {
+    switch (push.operand1.size) {
+        case VMOPSIZE_QWORD: return pushPop<VMOPSIZE_QWORD>(push, pop);
+        case VMOPSIZE_DWORD: return pushPop<VMOPSIZE_DWORD>(push, pop);
+        case VMOPSIZE_WORD:  return pushPop<VMOPSIZE_WORD>(push, pop);
+        default:             return pushPop<VMOPSIZE_BYTE>(push, pop);
     }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.f = lhsWord.f / rhsWord.f;
 }
 
-void MetaVM::addfs(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
+// neg and not read and write the same operand, so they only ever need its
+// mode and size, immediates are left to the generic instances
+template<VMOPCode Op> struct VMUnaryOperation;
 
-    if (
-        dst.size != VMOPSIZE_DWORD ||
-        lhs.size != VMOPSIZE_DWORD ||
-        rhs.size != VMOPSIZE_DWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
+template<> struct VMUnaryOperation<VMOPCODE_NEG> {
+    static constexpr VMValueKind kind = VMVALUE_SIGNED;
+    template<typename T> static T apply(T value) { return -value; }
+};
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
+template<> struct VMUnaryOperation<VMOPCODE_NOT> {
+    static constexpr VMValueKind kind = VMVALUE_UNSIGNED;
+    template<typename T> static T apply(T value) { return ~value; }
+};
 
-    dstWord.fsingles[0] = lhsWord.fsingles[0] + rhsWord.fsingles[0];
+template<VMOPCode Op, u8 Mode, VMOperandSize Size>
+bool MetaVM::unary(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using Operation = VMUnaryOperation<Op>;
+    using T = typename VMValue<Operation::kind, Size>::type;
+    VMWord &word = vm.getVMWord<Mode, Size>(inst.operand1);
+    storeValue<T>(&word, Operation::apply(loadValue<T>(&word)));
+    return true;
 }
 
-void MetaVM::subfs(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (
-        dst.size != VMOPSIZE_DWORD ||
-        lhs.size != VMOPSIZE_DWORD ||
-        rhs.size != VMOPSIZE_DWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+template<VMOPCode Op, u8 Mode>
+VMHandler MetaVM::resolveUnary(VMOperandSize size) {
+    switch (size) {
+        case VMOPSIZE_QWORD: return &unary<Op, Mode, VMOPSIZE_QWORD>;
+        case VMOPSIZE_DWORD: return &unary<Op, Mode, VMOPSIZE_DWORD>;
+        case VMOPSIZE_WORD:  return &unary<Op, Mode, VMOPSIZE_WORD>;
+        default:             return &unary<Op, Mode, VMOPSIZE_BYTE>;
     }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.fsingles[0] = lhsWord.fsingles[0] - rhsWord.fsingles[0];
 }
 
-void MetaVM::mulfs(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
-
-    if (
-        dst.size != VMOPSIZE_DWORD ||
-        lhs.size != VMOPSIZE_DWORD ||
-        rhs.size != VMOPSIZE_DWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+template<VMOPCode Op>
+VMHandler MetaVM::resolveUnary(VMDecodedInstruction const &inst, bool checked) {
+    VMDecodedOperand const &operand = inst.operand1;
+    switch (getOperandMode(operand)) {
+        case VMMODE_REGISTER: return resolveUnary<Op, VMMODE_REGISTER>(operand.size);
+        case VMMODE_MEMORY:   return resolveUnary<Op, VMMODE_MEMORY>(operand.size);
+        default:
+            if (Op == VMOPCODE_NEG) return checked ? &member<&MetaVM::neg<true>> : &member<&MetaVM::neg<false>>;
+            return checked ? &member<&MetaVM::bitwise_not<true>> : &member<&MetaVM::bitwise_not<false>>;
     }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.fsingles[0] = lhsWord.fsingles[0] * rhsWord.fsingles[0];
 }
 
-void MetaVM::divfs(VMInstruction &inst) {
-    VMOperand lhs = inst.operand1;
-    VMOperand rhs = inst.operand2;
-    VMOperand dst = inst.operand3;
+VMHandler MetaVM::resolveHandler(VMDecodedInstruction const &inst, bool checked) {
+    #define resolve(opcode) case opcode: return resolveBinary<opcode>(inst, checked)
 
-    if (
-        dst.size != VMOPSIZE_DWORD ||
-        lhs.size != VMOPSIZE_DWORD ||
-        rhs.size != VMOPSIZE_DWORD ||
-        dst.type == VMOPTYPE_IMMEDIATE
-    ) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+    switch (inst.opcode) {
+        case VMOPCODE_MOV:  return resolveMove(inst, checked);
+        case VMOPCODE_PUSH: return resolvePush(inst);
+        case VMOPCODE_POP:  return resolvePop(inst, checked);
+        case VMOPCODE_NEG:  return resolveUnary<VMOPCODE_NEG>(inst, checked);
+        case VMOPCODE_NOT:  return resolveUnary<VMOPCODE_NOT>(inst, checked);
+        resolve(VMOPCODE_ADD);   resolve(VMOPCODE_SUB);   resolve(VMOPCODE_MUL);
+        resolve(VMOPCODE_DIV);   resolve(VMOPCODE_DIVR);  resolve(VMOPCODE_ADDS);
+        resolve(VMOPCODE_SUBS);  resolve(VMOPCODE_MULS);  resolve(VMOPCODE_DIVS);
+        resolve(VMOPCODE_DIVSR); resolve(VMOPCODE_ADDF);  resolve(VMOPCODE_SUBF);
+        resolve(VMOPCODE_MULF);  resolve(VMOPCODE_DIVF);  resolve(VMOPCODE_ADDFS);
+        resolve(VMOPCODE_SUBFS); resolve(VMOPCODE_MULFS); resolve(VMOPCODE_DIVFS);
+        resolve(VMOPCODE_AND);   resolve(VMOPCODE_OR);    resolve(VMOPCODE_XOR);
+        #define vector(opcode) case opcode:
+        METAVM_VECTOR(vector)
+        #undef vector
+            return resolveVector(inst);
+        #define memory(opcode) case opcode:
+        METAVM_MEMORY(memory)
+        #undef memory
+            return resolveMemory(inst);
+        default: return nullptr;
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    dstWord.fsingles[0] = lhsWord.fsingles[0] / rhsWord.fsingles[0];
+    #undef resolve
 }
 
-void MetaVM::neg(VMInstruction &inst) {
-    VMOperand src = inst.operand1;
-    VMOperand dst = inst.operand1;
-    
-    if (dst.size < src.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &srcWord = getVMWord(src);
-    VMWord &dstWord = getVMWord(dst);
-
-    switch (dst.size) {
-        case VMOPSIZE_QWORD: {
-            s64 value = getSigned(src.size, srcWord);
-            dstWord.s = -value;
-        } break;
-        case VMOPSIZE_DWORD: {
-            s32 value = getSigned(src.size, srcWord);
-            dstWord.sdwords[0] = -value;
-        } break;
-        case VMOPSIZE_WORD: {
-            s16 value = getSigned(src.size, srcWord);
-            dstWord.swords[0] = -value;
-        } break;
-        default: {
-            s8 value = getSigned(src.size, srcWord);
-            dstWord.sbytes[0] = -value;
-        } break;
-    }
-}
+template<bool Checked>
+bool MetaVM::neg(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &operand = inst.operand1;
 
-void MetaVM::bitwise_and(VMInstruction &inst) {
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-    VMOperand dst = inst.operand1;
-    
-    if (dst.size < lhs.size || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+    // only immediates end up here, see resolveUnary
+    if (Checked && operand.type == VMOPTYPE_IMMEDIATE) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
     }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
+    VMWord &word = getVMWord(operand);
 
-    switch (dst.size) {
+    switch (operand.size) {
         case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.u = lhsValue & rhsValue;
+            s64 value = getSigned(operand.size, word);
+            word.s = -value;
         } break;
         case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue & rhsValue;
+            s32 value = getSigned(operand.size, word);
+            word.sdwords[0] = -value;
         } break;
         case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue & rhsValue;
+            s16 value = getSigned(operand.size, word);
+            word.swords[0] = -value;
         } break;
         default: {
-            u8 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u8 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.ubytes[0] = lhsValue & rhsValue;
+            s8 value = getSigned(operand.size, word);
+            word.sbytes[0] = -value;
         } break;
     }
-}
-
-void MetaVM::bitwise_or(VMInstruction &inst) {
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-    VMOperand dst = inst.operand1;
-    
-    if (dst.size < lhs.size || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
 
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    switch (dst.size) {
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.u = lhsValue | rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue | rhsValue;
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue | rhsValue;
-        } break;
-        default: {
-            u8 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u8 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.ubytes[0] = lhsValue | rhsValue;
-        } break;
-    }
+    return true;
 }
 
-void MetaVM::bitwise_xor(VMInstruction &inst) {
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-    VMOperand dst = inst.operand1;
-    
-    if (dst.size < lhs.size || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &dstWord = getVMWord(dst);
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
+template<bool Checked>
+bool MetaVM::bitwise_not(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &operand = inst.operand1;
 
-    switch (dst.size) {
-        case VMOPSIZE_QWORD: {
-            u64 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u64 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.u = lhsValue ^ rhsValue;
-        } break;
-        case VMOPSIZE_DWORD: {
-            u32 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u32 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.udwords[0] = lhsValue ^ rhsValue;
-        } break;
-        case VMOPSIZE_WORD: {
-            u16 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u16 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.uwords[0] = lhsValue ^ rhsValue;
-        } break;
-        default: {
-            u8 lhsValue = getUnsigned(lhs.size, lhsWord);
-            u8 rhsValue = getUnsigned(rhs.size, rhsWord);
-            dstWord.ubytes[0] = lhsValue ^ rhsValue;
-        } break;
-    }
-}
-
-void MetaVM::bitwise_not(VMInstruction &inst) {
-    VMOperand src = inst.operand1;
-    VMOperand dst = inst.operand1;
-    
-    if (dst.size < src.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
+    // only immediates end up here, see resolveUnary
+    if (Checked && operand.type == VMOPTYPE_IMMEDIATE) {
+        return raise(VMEXCEPT_INVALID_OPERANDS, 0);
     }
 
-    VMWord &srcWord = getVMWord(src);
-    VMWord &dstWord = getVMWord(dst);
+    VMWord &word = getVMWord(operand);
 
-    switch (dst.size) {
+    switch (operand.size) {
         case VMOPSIZE_QWORD: {
-            u64 value = getUnsigned(src.size, srcWord);
-            dstWord.u = ~value;
+            u64 value = getUnsigned(operand.size, word);
+            word.u = ~value;
         } break;
         case VMOPSIZE_DWORD: {
-            u32 value = getSigned(src.size, srcWord);
-            dstWord.udwords[0] = ~value;
+            u32 value = getSigned(operand.size, word);
+            word.udwords[0] = ~value;
         } break;
         case VMOPSIZE_WORD: {
-            u16 value = getSigned(src.size, srcWord);
-            dstWord.uwords[0] = ~value;
+            u16 value = getSigned(operand.size, word);
+            word.uwords[0] = ~value;
         } break;
         default: {
-            u8 value = getSigned(src.size, srcWord);
-            dstWord.ubytes[0] = ~value;
+            u8 value = getSigned(operand.size, word);
+            word.ubytes[0] = ~value;
         } break;
     }
-}
-
-void MetaVM::jmp(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    
-    VMWord &dstWord = getVMWord(dst);
-    
-    if (dstWord.u >= _bytecode.size()) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    _registers.data[31] = dst.value;
-}
-
-void MetaVM::jeq(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-
-    VMWord &dstWord = getVMWord(dst);
-    
-    if (dstWord.u >= _bytecode.size() || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    if (getUnsigned(lhs.size, lhsWord) != getUnsigned(rhs.size, rhsWord)) return;
-
-    _registers.data[31] = dst.value;
-}
-
-void MetaVM::jne(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-
-    VMWord &dstWord = getVMWord(dst);
-    
-    if (dstWord.u >= _bytecode.size() || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    if (getUnsigned(lhs.size, lhsWord) == getUnsigned(rhs.size, rhsWord)) return;
-
-    _registers.data[31] = dst.value;
-}
-
-void MetaVM::jgt(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-    
-    VMWord &dstWord = getVMWord(dst);
-
-    if (dstWord.u >= _bytecode.size() || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    if (!(getUnsigned(lhs.size, lhsWord) > getUnsigned(rhs.size, rhsWord))) return;
-
-    _registers.data[31] = dst.value;
-}
-
-void MetaVM::jlt(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-
-    VMWord &dstWord = getVMWord(dst);
-    
-    if (dstWord.u >= _bytecode.size() || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    if (!(getUnsigned(lhs.size, lhsWord) < getUnsigned(rhs.size, rhsWord))) return;
-
-    _registers.data[31] = dst.value;
-}
-
-void MetaVM::jge(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-
-    VMWord &dstWord = getVMWord(dst);
-    
-    if (dstWord.u >= _bytecode.size() || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
 
-    if (!(getUnsigned(lhs.size, lhsWord) >= getUnsigned(rhs.size, rhsWord))) return;
-
-    _registers.data[31] = dst.value;
+    return true;
 }
-
-void MetaVM::jle(VMInstruction &inst) {
-    VMOperand dst = inst.operand1;
-    VMOperand lhs = inst.operand2;
-    VMOperand rhs = inst.operand3;
-
-    VMWord &dstWord = getVMWord(dst);
-    
-    if (dstWord.u >= _bytecode.size() || lhs.size != rhs.size) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    VMWord &lhsWord = getVMWord(lhs);
-    VMWord &rhsWord = getVMWord(rhs);
-
-    if (!(getUnsigned(lhs.size, lhsWord) <= getUnsigned(rhs.size, rhsWord))) return;
-
-    _registers.data[31] = dst.value;
-}
-
-void MetaVM::call(VMInstruction &inst) {
-    VMOperand address = inst.operand1;
-
-    VMWord &addressWord = getVMWord(address);
-    VMOperandSize addressSize = address.size;
-
-    u64 value = getUnsigned(addressSize, addressWord);
-    std::printf("bytecode length: %llu\n", _bytecode.size());
-    if (value >= _bytecode.length()) {
-        _exceptions.append(VMEXCEPT_INVALID_OPERANDS);
-        return;
-    }
-
-    u8 size = VMOPSIZE_QWORD; 
-
-    // make sure there's enough room for (at least) the instruction pointer
-    if (_registers.data[30].u - size >= _memory.size()) {
-        _exceptions.append(VMEXCEPT_STACK_OVERFLOW);
-        return;
-    }
-
-    // push the current instruction pointer to the stack
-    _registers.data[30].u -= size;
-    VMWord &stackTop = getStackTop();
-    stackTop = _registers.data[31];
-
-    // make the next instruction the called code
-    _registers.data[31] = value;
-}
-
-void MetaVM::ret(VMInstruction &) {
-    VMWord &stackTop = getStackTop();
-
-    // make sure the stack top is a sane address
-    if (stackTop.u >= _bytecode.length()) {
-        _exceptions.append(VMEXCEPT_UNEXPECTED_OPCODE);
-        return;
-    }
-
-    // take the top of the stack
-    u8 size = VMOPSIZE_QWORD;
-    _registers.data[30].u += size;
-
-    // get save it back to the register
-    _registers.data[31] = stackTop;
-}
-
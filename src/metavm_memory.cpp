@@ -0,0 +1,127 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "metavm.hpp"
+
+// the bulk memory operations, one dispatch and one bounds check for a whole
+// range of memory instead of a loop of MOVs
+//
+// copies, fills and searches go to libc, whose memmove, memset and memchr
+// are vectorized already, comparisons want the offset of the first
+// difference rather than memcmp's sign and get a SIMD kernel of their own,
+// -D METAVM_SCALAR_VECTORS turns it off like the vector kernels
+#if !defined(METAVM_SCALAR_VECTORS) && (defined(__AVX2__) || defined(__SSE2__))
+    #define METAVM_SIMD_MEMORY
+    #include <immintrin.h>
+#endif
+
+// the offset of the first byte that differs, `length` if there is none
+static u64 compareBytes(u8 const *lhs, u8 const *rhs, u64 length) {
+    u64 i = 0;
+
+#if defined(METAVM_SIMD_MEMORY) && defined(__AVX2__)
+    for (; length - i >= 32; i += 32) {
+        __m256i a = _mm256_loadu_si256((__m256i const *) (lhs + i));
+        __m256i b = _mm256_loadu_si256((__m256i const *) (rhs + i));
+        u32 equal = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        if (equal != 0xffffffffu) return i + __builtin_ctz(~equal);
+    }
+#elif defined(METAVM_SIMD_MEMORY)
+    for (; length - i >= 16; i += 16) {
+        __m128i a = _mm_loadu_si128((__m128i const *) (lhs + i));
+        __m128i b = _mm_loadu_si128((__m128i const *) (rhs + i));
+        u32 equal = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (equal != 0xffffu) return i + __builtin_ctz(~equal);
+    }
+#endif
+
+    for (; i < length; ++i) {
+        if (lhs[i] != rhs[i]) return i;
+    }
+    return length;
+}
+
+static bool isMemoryOperand(VMDecodedOperand const &operand) {
+    return operand.type == VMOPTYPE_POINTER || operand.type == VMOPTYPE_INDIRECT || operand.type == VMOPTYPE_DISPLACEMENT;
+}
+
+// the checks verifyProgram does for bulk memory instructions
+static bool isValidMemoryInstruction(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &op1 = inst.operand1;
+    VMDecodedOperand const &op2 = inst.operand2;
+    VMDecodedOperand const &op3 = inst.operand3;
+
+    switch (inst.opcode) {
+        case VMOPCODE_MCOPY: return isMemoryOperand(op1) && isMemoryOperand(op2);
+        case VMOPCODE_MFILL: return isMemoryOperand(op1);
+        case VMOPCODE_MCMP:  return isMemoryOperand(op1) && isMemoryOperand(op2) && op3.type != VMOPTYPE_IMMEDIATE;
+        default:             return isMemoryOperand(op1) && op3.type != VMOPTYPE_IMMEDIATE;
+    }
+}
+
+bool MetaVM::memoryCopy(MetaVM &vm, VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &length = inst.operand3;
+    u64 size = getUnsigned(length.size, vm.getVMWord(length));
+    u64 source = vm.getAddress(inst.operand1);
+    u64 destination = vm.getAddress(inst.operand2);
+    if (!vm.isInMemory(source, size)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, 0);
+    if (!vm.isInMemory(destination, size)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, 1);
+
+    if (size != 0) std::memmove(&vm._memory[destination], &vm._memory[source], size);
+    return true;
+}
+
+bool MetaVM::memoryFill(MetaVM &vm, VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &value = inst.operand2;
+    VMDecodedOperand const &length = inst.operand3;
+    u64 size = getUnsigned(length.size, vm.getVMWord(length));
+    u64 destination = vm.getAddress(inst.operand1);
+    if (!vm.isInMemory(destination, size)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, 0);
+
+    if (size != 0) std::memset(&vm._memory[destination], (u8) getUnsigned(value.size, vm.getVMWord(value)), size);
+    return true;
+}
+
+bool MetaVM::memoryCompare(MetaVM &vm, VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &length = inst.operand3;
+    VMWord &lengthWord = vm.getVMWord(length);
+    u64 size = getUnsigned(length.size, lengthWord);
+    u64 lhs = vm.getAddress(inst.operand1);
+    u64 rhs = vm.getAddress(inst.operand2);
+    if (!vm.isInMemory(lhs, size)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, 0);
+    if (!vm.isInMemory(rhs, size)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, 1);
+
+    // never more than the length, so it fits where the length came from
+    u64 offset = size != 0 ? compareBytes(&vm._memory[lhs], &vm._memory[rhs], size) : 0;
+    std::memcpy((void *) &lengthWord, &offset, length.size);
+    return true;
+}
+
+bool MetaVM::memoryFind(MetaVM &vm, VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &value = inst.operand2;
+    VMDecodedOperand const &length = inst.operand3;
+    VMWord &lengthWord = vm.getVMWord(length);
+    u64 size = getUnsigned(length.size, lengthWord);
+    u64 address = vm.getAddress(inst.operand1);
+    if (!vm.isInMemory(address, size)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, 0);
+
+    u64 offset = size;
+    if (size != 0) {
+        u8 const *start = &vm._memory[address];
+        u8 const *found = (u8 const *) std::memchr(start, (u8) getUnsigned(value.size, vm.getVMWord(value)), size);
+        if (found != nullptr) offset = found - start;
+    }
+    std::memcpy((void *) &lengthWord, &offset, length.size);
+    return true;
+}
+
+VMHandler MetaVM::resolveMemory(VMDecodedInstruction const &inst) {
+    if (!isValidMemoryInstruction(inst)) return &invalidOperands;
+
+    switch (inst.opcode) {
+        case VMOPCODE_MCOPY: return &memoryCopy;
+        case VMOPCODE_MFILL: return &memoryFill;
+        case VMOPCODE_MCMP:  return &memoryCompare;
+        case VMOPCODE_MFIND: return &memoryFind;
+        default:             return nullptr;
+    }
+}
@@ -0,0 +1,370 @@
+#include <type_traits>
+
+#include "common.hpp"
+#include "types.hpp"
+#include "metavm.hpp"
+
+// the vector extension, lane-wise operations over the 32 byte vector registers
+//
+// every operation has a scalar kernel, a loop over the lanes, and the ones
+// the target has instructions for get a SIMD kernel on top: with AVX2
+// (-mavx2) a vector is one 256 bit register, otherwise with SSE2 (every
+// x86-64) it's two 128 bit halves, the results are the same either way,
+// build with -D METAVM_SCALAR_VECTORS to only use the scalar kernels
+#if !defined(METAVM_SCALAR_VECTORS) && (defined(__AVX2__) || defined(__SSE2__))
+    #define METAVM_SIMD_VECTORS
+    #include <immintrin.h>
+#endif
+
+template<VMOPCode Op> struct VMVectorOperation;
+
+// comparisons yield a bool, which becomes a lane of all ones or all zeroes
+#define vecop(opcode, valueKind, expression)                                           \
+    template<> struct VMVectorOperation<opcode> {                                      \
+        static constexpr VMValueKind kind = valueKind;                                 \
+        template<typename T> static auto apply(T lhs, T rhs) { return expression; }    \
+    };
+
+vecop(VMOPCODE_VADD,    VMVALUE_UNSIGNED, (T) (lhs + rhs))
+vecop(VMOPCODE_VSUB,    VMVALUE_UNSIGNED, (T) (lhs - rhs))
+vecop(VMOPCODE_VMUL,    VMVALUE_UNSIGNED, (T) (lhs * rhs))
+vecop(VMOPCODE_VADDF,   VMVALUE_FLOAT,    lhs + rhs)
+vecop(VMOPCODE_VSUBF,   VMVALUE_FLOAT,    lhs - rhs)
+vecop(VMOPCODE_VMULF,   VMVALUE_FLOAT,    lhs * rhs)
+vecop(VMOPCODE_VMIN,    VMVALUE_UNSIGNED, lhs < rhs ? lhs : rhs)
+vecop(VMOPCODE_VMAX,    VMVALUE_UNSIGNED, lhs > rhs ? lhs : rhs)
+vecop(VMOPCODE_VMINS,   VMVALUE_SIGNED,   lhs < rhs ? lhs : rhs)
+vecop(VMOPCODE_VMAXS,   VMVALUE_SIGNED,   lhs > rhs ? lhs : rhs)
+vecop(VMOPCODE_VMINF,   VMVALUE_FLOAT,    lhs < rhs ? lhs : rhs)
+vecop(VMOPCODE_VMAXF,   VMVALUE_FLOAT,    lhs > rhs ? lhs : rhs)
+vecop(VMOPCODE_VCMPEQ,  VMVALUE_UNSIGNED, lhs == rhs)
+vecop(VMOPCODE_VCMPGT,  VMVALUE_UNSIGNED, lhs > rhs)
+vecop(VMOPCODE_VCMPGTS, VMVALUE_SIGNED,   lhs > rhs)
+vecop(VMOPCODE_VCMPEQF, VMVALUE_FLOAT,    lhs == rhs)
+vecop(VMOPCODE_VCMPGTF, VMVALUE_FLOAT,    lhs > rhs)
+
+// the right hand side holds the lane indices
+vecop(VMOPCODE_VSHUF,   VMVALUE_UNSIGNED, rhs)
+
+#undef vecop
+
+// the scalar kernel, `dst` may be either source
+template<VMOPCode Op, VMOperandSize Size>
+struct VMVectorKernel {
+    static void apply(VMVector &dst, VMVector const &lhs, VMVector const &rhs) {
+        using Operation = VMVectorOperation<Op>;
+        using T = typename VMValue<Operation::kind, Size>::type;
+        using U = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
+        constexpr u64 count = VECTOR_SIZE / Size;
+
+        T lhsLanes[count];
+        T rhsLanes[count];
+        std::memcpy(lhsLanes, &lhs, VECTOR_SIZE);
+        std::memcpy(rhsLanes, &rhs, VECTOR_SIZE);
+
+        if constexpr (Op == VMOPCODE_VSHUF) {
+            T result[count];
+            for (u64 i = 0; i < count; ++i) {
+                result[i] = lhsLanes[rhsLanes[i] % count];
+            }
+            std::memcpy(&dst, result, VECTOR_SIZE);
+        } else if constexpr (std::is_same<decltype(Operation::apply(T(), T())), bool>::value) {
+            U result[count];
+            for (u64 i = 0; i < count; ++i) {
+                result[i] = Operation::apply(lhsLanes[i], rhsLanes[i]) ? (U) ~(U) 0 : (U) 0;
+            }
+            std::memcpy(&dst, result, VECTOR_SIZE);
+        } else {
+            T result[count];
+            for (u64 i = 0; i < count; ++i) {
+                result[i] = Operation::apply(lhsLanes[i], rhsLanes[i]);
+            }
+            std::memcpy(&dst, result, VECTOR_SIZE);
+        }
+    }
+};
+
+#if defined(METAVM_SIMD_VECTORS)
+
+#if defined(__AVX2__)
+    typedef __m256i VMSimdInteger;
+    typedef __m256  VMSimdSingle;
+    typedef __m256d VMSimdDouble;
+
+    #define simd(name) _mm256_##name
+
+    static VMSimdInteger simdLoad(VMSimdInteger const *source) { return _mm256_load_si256(source); }
+    static VMSimdSingle  simdLoad(VMSimdSingle const *source)  { return _mm256_load_ps((f32 const *) source); }
+    static VMSimdDouble  simdLoad(VMSimdDouble const *source)  { return _mm256_load_pd((f64 const *) source); }
+    static void simdStore(VMSimdInteger *destination, VMSimdInteger value) { _mm256_store_si256(destination, value); }
+    static void simdStore(VMSimdSingle *destination, VMSimdSingle value)   { _mm256_store_ps((f32 *) destination, value); }
+    static void simdStore(VMSimdDouble *destination, VMSimdDouble value)   { _mm256_store_pd((f64 *) destination, value); }
+
+    // ordered and quiet, NaN lanes compare false like in C
+    static VMSimdSingle simdEqual(VMSimdSingle lhs, VMSimdSingle rhs)   { return _mm256_cmp_ps(lhs, rhs, _CMP_EQ_OQ); }
+    static VMSimdDouble simdEqual(VMSimdDouble lhs, VMSimdDouble rhs)   { return _mm256_cmp_pd(lhs, rhs, _CMP_EQ_OQ); }
+    static VMSimdSingle simdGreater(VMSimdSingle lhs, VMSimdSingle rhs) { return _mm256_cmp_ps(lhs, rhs, _CMP_GT_OQ); }
+    static VMSimdDouble simdGreater(VMSimdDouble lhs, VMSimdDouble rhs) { return _mm256_cmp_pd(lhs, rhs, _CMP_GT_OQ); }
+#else
+    typedef __m128i VMSimdInteger;
+    typedef __m128  VMSimdSingle;
+    typedef __m128d VMSimdDouble;
+
+    #define simd(name) _mm_##name
+
+    static VMSimdInteger simdLoad(VMSimdInteger const *source) { return _mm_load_si128(source); }
+    static VMSimdSingle  simdLoad(VMSimdSingle const *source)  { return _mm_load_ps((f32 const *) source); }
+    static VMSimdDouble  simdLoad(VMSimdDouble const *source)  { return _mm_load_pd((f64 const *) source); }
+    static void simdStore(VMSimdInteger *destination, VMSimdInteger value) { _mm_store_si128(destination, value); }
+    static void simdStore(VMSimdSingle *destination, VMSimdSingle value)   { _mm_store_ps((f32 *) destination, value); }
+    static void simdStore(VMSimdDouble *destination, VMSimdDouble value)   { _mm_store_pd((f64 *) destination, value); }
+
+    static VMSimdSingle simdEqual(VMSimdSingle lhs, VMSimdSingle rhs)   { return _mm_cmpeq_ps(lhs, rhs); }
+    static VMSimdDouble simdEqual(VMSimdDouble lhs, VMSimdDouble rhs)   { return _mm_cmpeq_pd(lhs, rhs); }
+    static VMSimdSingle simdGreater(VMSimdSingle lhs, VMSimdSingle rhs) { return _mm_cmpgt_ps(lhs, rhs); }
+    static VMSimdDouble simdGreater(VMSimdDouble lhs, VMSimdDouble rhs) { return _mm_cmpgt_pd(lhs, rhs); }
+#endif
+
+// a SIMD kernel, `expression` combines the registers `a` and `b`
+#define kernel(opcode, size, type, expression)                                                  \
+    template<> void VMVectorKernel<opcode, size>::apply(VMVector &dst, VMVector const &lhs, VMVector const &rhs) { \
+        for (u64 i = 0; i < VECTOR_SIZE / sizeof(type); ++i) {                                  \
+            type a = simdLoad((type const *) &lhs + i);                                         \
+            type b = simdLoad((type const *) &rhs + i);                                         \
+            simdStore((type *) &dst + i, expression);                                           \
+        }                                                                                       \
+    }
+
+kernel(VMOPCODE_VADD,    VMOPSIZE_BYTE,  VMSimdInteger, simd(add_epi8)(a, b))
+kernel(VMOPCODE_VADD,    VMOPSIZE_WORD,  VMSimdInteger, simd(add_epi16)(a, b))
+kernel(VMOPCODE_VADD,    VMOPSIZE_DWORD, VMSimdInteger, simd(add_epi32)(a, b))
+kernel(VMOPCODE_VADD,    VMOPSIZE_QWORD, VMSimdInteger, simd(add_epi64)(a, b))
+kernel(VMOPCODE_VSUB,    VMOPSIZE_BYTE,  VMSimdInteger, simd(sub_epi8)(a, b))
+kernel(VMOPCODE_VSUB,    VMOPSIZE_WORD,  VMSimdInteger, simd(sub_epi16)(a, b))
+kernel(VMOPCODE_VSUB,    VMOPSIZE_DWORD, VMSimdInteger, simd(sub_epi32)(a, b))
+kernel(VMOPCODE_VSUB,    VMOPSIZE_QWORD, VMSimdInteger, simd(sub_epi64)(a, b))
+kernel(VMOPCODE_VMUL,    VMOPSIZE_WORD,  VMSimdInteger, simd(mullo_epi16)(a, b))
+kernel(VMOPCODE_VMIN,    VMOPSIZE_BYTE,  VMSimdInteger, simd(min_epu8)(a, b))
+kernel(VMOPCODE_VMAX,    VMOPSIZE_BYTE,  VMSimdInteger, simd(max_epu8)(a, b))
+kernel(VMOPCODE_VMINS,   VMOPSIZE_WORD,  VMSimdInteger, simd(min_epi16)(a, b))
+kernel(VMOPCODE_VMAXS,   VMOPSIZE_WORD,  VMSimdInteger, simd(max_epi16)(a, b))
+kernel(VMOPCODE_VCMPEQ,  VMOPSIZE_BYTE,  VMSimdInteger, simd(cmpeq_epi8)(a, b))
+kernel(VMOPCODE_VCMPEQ,  VMOPSIZE_WORD,  VMSimdInteger, simd(cmpeq_epi16)(a, b))
+kernel(VMOPCODE_VCMPEQ,  VMOPSIZE_DWORD, VMSimdInteger, simd(cmpeq_epi32)(a, b))
+kernel(VMOPCODE_VCMPGTS, VMOPSIZE_BYTE,  VMSimdInteger, simd(cmpgt_epi8)(a, b))
+kernel(VMOPCODE_VCMPGTS, VMOPSIZE_WORD,  VMSimdInteger, simd(cmpgt_epi16)(a, b))
+kernel(VMOPCODE_VCMPGTS, VMOPSIZE_DWORD, VMSimdInteger, simd(cmpgt_epi32)(a, b))
+kernel(VMOPCODE_VADDF,   VMOPSIZE_DWORD, VMSimdSingle,  simd(add_ps)(a, b))
+kernel(VMOPCODE_VADDF,   VMOPSIZE_QWORD, VMSimdDouble,  simd(add_pd)(a, b))
+kernel(VMOPCODE_VSUBF,   VMOPSIZE_DWORD, VMSimdSingle,  simd(sub_ps)(a, b))
+kernel(VMOPCODE_VSUBF,   VMOPSIZE_QWORD, VMSimdDouble,  simd(sub_pd)(a, b))
+kernel(VMOPCODE_VMULF,   VMOPSIZE_DWORD, VMSimdSingle,  simd(mul_ps)(a, b))
+kernel(VMOPCODE_VMULF,   VMOPSIZE_QWORD, VMSimdDouble,  simd(mul_pd)(a, b))
+kernel(VMOPCODE_VMINF,   VMOPSIZE_DWORD, VMSimdSingle,  simd(min_ps)(a, b))
+kernel(VMOPCODE_VMINF,   VMOPSIZE_QWORD, VMSimdDouble,  simd(min_pd)(a, b))
+kernel(VMOPCODE_VMAXF,   VMOPSIZE_DWORD, VMSimdSingle,  simd(max_ps)(a, b))
+kernel(VMOPCODE_VMAXF,   VMOPSIZE_QWORD, VMSimdDouble,  simd(max_pd)(a, b))
+kernel(VMOPCODE_VCMPEQF, VMOPSIZE_DWORD, VMSimdSingle,  simdEqual(a, b))
+kernel(VMOPCODE_VCMPEQF, VMOPSIZE_QWORD, VMSimdDouble,  simdEqual(a, b))
+kernel(VMOPCODE_VCMPGTF, VMOPSIZE_DWORD, VMSimdSingle,  simdGreater(a, b))
+kernel(VMOPCODE_VCMPGTF, VMOPSIZE_QWORD, VMSimdDouble,  simdGreater(a, b))
+
+// SSE4 and later forms, AVX2 has all of them at 256 bits
+#if defined(__AVX2__)
+kernel(VMOPCODE_VMUL,    VMOPSIZE_DWORD, VMSimdInteger, simd(mullo_epi32)(a, b))
+kernel(VMOPCODE_VMIN,    VMOPSIZE_WORD,  VMSimdInteger, simd(min_epu16)(a, b))
+kernel(VMOPCODE_VMIN,    VMOPSIZE_DWORD, VMSimdInteger, simd(min_epu32)(a, b))
+kernel(VMOPCODE_VMAX,    VMOPSIZE_WORD,  VMSimdInteger, simd(max_epu16)(a, b))
+kernel(VMOPCODE_VMAX,    VMOPSIZE_DWORD, VMSimdInteger, simd(max_epu32)(a, b))
+kernel(VMOPCODE_VMINS,   VMOPSIZE_BYTE,  VMSimdInteger, simd(min_epi8)(a, b))
+kernel(VMOPCODE_VMINS,   VMOPSIZE_DWORD, VMSimdInteger, simd(min_epi32)(a, b))
+kernel(VMOPCODE_VMAXS,   VMOPSIZE_BYTE,  VMSimdInteger, simd(max_epi8)(a, b))
+kernel(VMOPCODE_VMAXS,   VMOPSIZE_DWORD, VMSimdInteger, simd(max_epi32)(a, b))
+kernel(VMOPCODE_VCMPEQ,  VMOPSIZE_QWORD, VMSimdInteger, simd(cmpeq_epi64)(a, b))
+kernel(VMOPCODE_VCMPGTS, VMOPSIZE_QWORD, VMSimdInteger, simd(cmpgt_epi64)(a, b))
+
+// the low 3 bits of every index pick the lane, the same as modulo 8
+kernel(VMOPCODE_VSHUF,   VMOPSIZE_DWORD, VMSimdInteger, simd(permutevar8x32_epi32)(a, b))
+#endif
+
+#undef kernel
+#undef simd
+
+#endif
+
+static bool isFloatLane(VMOperandSize size) {
+    return size == VMOPSIZE_DWORD || size == VMOPSIZE_QWORD;
+}
+
+static bool isMemoryOperand(VMDecodedOperand const &operand) {
+    return operand.type == VMOPTYPE_POINTER || operand.type == VMOPTYPE_INDIRECT || operand.type == VMOPTYPE_DISPLACEMENT;
+}
+
+// the checks verifyProgram does for vector instructions, the decoder already
+// put vector registers exactly where they belong
+static bool isValidVectorInstruction(VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &op1 = inst.operand1;
+    VMDecodedOperand const &op2 = inst.operand2;
+    VMDecodedOperand const &op3 = inst.operand3;
+
+    VMDecodedOperand const *operands[] = { &op1, &op2, &op3 };
+    for (s32 i = 0; i < getOperandCount(inst.opcode); ++i) {
+        if (isVectorOperand(inst.opcode, i) && operands[i]->registerIndex >= VECTOR_REGISTER_COUNT) return false;
+    }
+
+    switch (inst.opcode) {
+        case VMOPCODE_VLOAD:    return isMemoryOperand(op1);
+        case VMOPCODE_VSTORE:   return isMemoryOperand(op2);
+        case VMOPCODE_VSPLAT:   return true;
+        case VMOPCODE_VEXTRACT: return op3.type != VMOPTYPE_IMMEDIATE && op3.size >= op1.size;
+        case VMOPCODE_VSUM:
+        case VMOPCODE_VSUMS:    return op2.type != VMOPTYPE_IMMEDIATE;
+        case VMOPCODE_VSUMF:    return op2.type != VMOPTYPE_IMMEDIATE && isFloatLane(op1.size) && op2.size == op1.size;
+        case VMOPCODE_VADDF:    case VMOPCODE_VSUBF:   case VMOPCODE_VMULF:
+        case VMOPCODE_VMINF:    case VMOPCODE_VMAXF:
+        case VMOPCODE_VCMPEQF:  case VMOPCODE_VCMPGTF:
+            if (!isFloatLane(op1.size)) return false;
+            return op2.size == op1.size && op3.size == op1.size;
+        default:
+            return op2.size == op1.size && op3.size == op1.size;
+    }
+}
+
+template<VMOPCode Op, VMOperandSize Size>
+bool MetaVM::vectorLanes(MetaVM &vm, VMDecodedInstruction const &inst) {
+    VMVector *vectors = vm._registers.vectors;
+    VMVectorKernel<Op, Size>::apply(
+        vectors[inst.operand3.registerIndex],
+        vectors[inst.operand1.registerIndex],
+        vectors[inst.operand2.registerIndex]
+    );
+    return true;
+}
+
+template<bool Store>
+bool MetaVM::vectorMove(MetaVM &vm, VMDecodedInstruction const &inst) {
+    VMDecodedOperand const &vector = Store ? inst.operand1 : inst.operand2;
+    VMDecodedOperand const &address = Store ? inst.operand2 : inst.operand1;
+
+    // the whole vector has to be inside memory
+    u64 offset = vm.getAddress(address);
+    if (!vm.isInMemory(offset, VECTOR_SIZE)) return vm.raise(VMEXCEPT_INVALID_ADDRESS, Store ? 1 : 0);
+
+    if (Store) {
+        std::memcpy(&vm._memory[offset], &vm._registers.vectors[vector.registerIndex], VECTOR_SIZE);
+    } else {
+        std::memcpy(&vm._registers.vectors[vector.registerIndex], &vm._memory[offset], VECTOR_SIZE);
+    }
+    return true;
+}
+
+template<VMOperandSize Size>
+bool MetaVM::vectorSplat(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using U = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
+    VMDecodedOperand const &src = inst.operand1;
+
+    // float lanes take the bits of the source
+    U value = (U) getUnsigned(src.size, vm.getVMWord(src));
+    U lanes[VECTOR_SIZE / Size];
+    for (u64 i = 0; i < VECTOR_SIZE / Size; ++i) {
+        lanes[i] = value;
+    }
+    std::memcpy(&vm._registers.vectors[inst.operand2.registerIndex], lanes, VECTOR_SIZE);
+    return true;
+}
+
+template<VMOperandSize Size>
+bool MetaVM::vectorExtract(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using U = typename VMValue<VMVALUE_UNSIGNED, Size>::type;
+    VMDecodedOperand const &lane = inst.operand2;
+    VMDecodedOperand const &dst = inst.operand3;
+
+    u64 index = getUnsigned(lane.size, vm.getVMWord(lane)) % (VECTOR_SIZE / Size);
+    U value;
+    std::memcpy(&value, &vm._registers.vectors[inst.operand1.registerIndex].ubytes[index * Size], Size);
+
+    // zero extended to the destination
+    u64 extended = value;
+    std::memcpy((void *) &vm.getVMWord(dst), &extended, dst.size);
+    return true;
+}
+
+template<VMValueKind Kind, VMOperandSize Size>
+bool MetaVM::vectorSum(MetaVM &vm, VMDecodedInstruction const &inst) {
+    using T = typename VMValue<Kind, Size>::type;
+    VMDecodedOperand const &dst = inst.operand2;
+
+    T lanes[VECTOR_SIZE / Size];
+    std::memcpy(lanes, &vm._registers.vectors[inst.operand1.registerIndex], VECTOR_SIZE);
+
+    // lane by lane from the first, so float sums round the same everywhere
+    if constexpr (Kind == VMVALUE_FLOAT) {
+        T sum = 0;
+        for (u64 i = 0; i < VECTOR_SIZE / Size; ++i) {
+            sum += lanes[i];
+        }
+        std::memcpy((void *) &vm.getVMWord(dst), &sum, Size);
+    } else {
+        // integer lanes are widened to 64 bits and wrap there
+        using W = typename VMValue<Kind, VMOPSIZE_QWORD>::type;
+        W sum = 0;
+        for (u64 i = 0; i < VECTOR_SIZE / Size; ++i) {
+            sum = (W) ((u64) sum + (u64) (W) lanes[i]);
+        }
+        std::memcpy((void *) &vm.getVMWord(dst), &sum, dst.size);
+    }
+    return true;
+}
+
+bool MetaVM::invalidOperands(MetaVM &vm, VMDecodedInstruction const &) {
+    return vm.raise(VMEXCEPT_INVALID_OPERANDS);
+}
+
+template<VMOPCode Op>
+VMHandler MetaVM::resolveLanes(VMOperandSize size) {
+    if constexpr (VMVectorOperation<Op>::kind == VMVALUE_FLOAT) {
+        return size == VMOPSIZE_QWORD ? &vectorLanes<Op, VMOPSIZE_QWORD> : &vectorLanes<Op, VMOPSIZE_DWORD>;
+    } else {
+        switch (size) {
+            case VMOPSIZE_QWORD: return &vectorLanes<Op, VMOPSIZE_QWORD>;
+            case VMOPSIZE_DWORD: return &vectorLanes<Op, VMOPSIZE_DWORD>;
+            case VMOPSIZE_WORD:  return &vectorLanes<Op, VMOPSIZE_WORD>;
+            default:             return &vectorLanes<Op, VMOPSIZE_BYTE>;
+        }
+    }
+}
+
+VMHandler MetaVM::resolveVector(VMDecodedInstruction const &inst) {
+    if (!isValidVectorInstruction(inst)) return &invalidOperands;
+
+    // `handler` followed by its last template argument, the lane size
+    #define sized(size, ...)                                            \
+        switch (size) {                                                 \
+            case VMOPSIZE_QWORD: return &__VA_ARGS__ VMOPSIZE_QWORD>;   \
+            case VMOPSIZE_DWORD: return &__VA_ARGS__ VMOPSIZE_DWORD>;   \
+            case VMOPSIZE_WORD:  return &__VA_ARGS__ VMOPSIZE_WORD>;    \
+            default:             return &__VA_ARGS__ VMOPSIZE_BYTE>;    \
+        }
+    #define lanes(opcode) case opcode: return resolveLanes<opcode>(inst.operand1.size)
+
+    switch (inst.opcode) {
+        case VMOPCODE_VLOAD:    return &vectorMove<false>;
+        case VMOPCODE_VSTORE:   return &vectorMove<true>;
+        case VMOPCODE_VSPLAT:   sized(inst.operand2.size, vectorSplat<);
+        case VMOPCODE_VEXTRACT: sized(inst.operand1.size, vectorExtract<);
+        case VMOPCODE_VSUM:     sized(inst.operand1.size, vectorSum<VMVALUE_UNSIGNED,);
+        case VMOPCODE_VSUMS:    sized(inst.operand1.size, vectorSum<VMVALUE_SIGNED,);
+        case VMOPCODE_VSUMF:
+            return inst.operand1.size == VMOPSIZE_QWORD ? &vectorSum<VMVALUE_FLOAT, VMOPSIZE_QWORD> : &vectorSum<VMVALUE_FLOAT, VMOPSIZE_DWORD>;
+        lanes(VMOPCODE_VADD);   lanes(VMOPCODE_VSUB);    lanes(VMOPCODE_VMUL);
+        lanes(VMOPCODE_VADDF);  lanes(VMOPCODE_VSUBF);   lanes(VMOPCODE_VMULF);
+        lanes(VMOPCODE_VMIN);   lanes(VMOPCODE_VMAX);    lanes(VMOPCODE_VMINS);
+        lanes(VMOPCODE_VMAXS);  lanes(VMOPCODE_VMINF);   lanes(VMOPCODE_VMAXF);
+        lanes(VMOPCODE_VCMPEQ); lanes(VMOPCODE_VCMPGT);  lanes(VMOPCODE_VCMPGTS);
+        lanes(VMOPCODE_VCMPEQF); lanes(VMOPCODE_VCMPGTF); lanes(VMOPCODE_VSHUF);
+        default: return nullptr;
+    }
+
+    #undef sized
+    #undef lanes
+}
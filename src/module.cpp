@@ -0,0 +1,323 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "module.hpp"
+#include "metavm.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr u64 VMMODULE_ALIGNMENT = 8;
+
+static bool isValidSection(VMModuleSection const &section, u64 fileSize, u64 entrySize = 1) {
+    if (section.size == 0) return true;
+    return section.offset % VMMODULE_ALIGNMENT == 0
+        && section.offset >= sizeof(VMModuleHeader)
+        && section.offset <= fileSize
+        && section.size <= fileSize - section.offset
+        && section.size % entrySize == 0;
+}
+
+static VMModuleStatus validateModule(VMModule &module) {
+    VMModuleHeader const &header = *module.header;
+    if (header.magic != VMMODULE_MAGIC) return VMMODULE_INVALID_HEADER;
+    if (header.version != VMMODULE_VERSION) return VMMODULE_UNSUPPORTED_VERSION;
+
+    u64 fileSize = module.mappingSize;
+    if (!isValidSection(header.code, fileSize) || !isValidSection(header.data, fileSize) ||
+        !isValidSection(header.symbols, fileSize, sizeof(VMModuleSymbol)) || !isValidSection(header.strings, fileSize) ||
+        !isValidSection(header.decoded, fileSize, header.decodedSize ? header.decodedSize : 1) ||
+        !isValidSection(header.constants, fileSize, sizeof(VMWord)) ||
+        !isValidSection(header.handlers, fileSize, sizeof(VMExceptionHandler))) {
+        return VMMODULE_INVALID_SECTION;
+    }
+
+    u8 *base = (u8 *) module.mapping;
+    module.code = memory_view<u8> { base + header.code.offset, header.code.size };
+    module.data = memory_view<u8> { base + header.data.offset, header.data.size };
+
+    // names are offsets into a zero terminated strings section
+    module.symbols = (VMModuleSymbol const *) (base + header.symbols.offset);
+    module.symbolCount = header.symbols.size / sizeof(VMModuleSymbol);
+    module.strings = (char const *) (base + header.strings.offset);
+    if (module.symbolCount != 0 && (header.strings.size == 0 || module.strings[header.strings.size - 1] != '\0')) {
+        return VMMODULE_INVALID_SECTION;
+    }
+    for (u64 i = 0; i < module.symbolCount; ++i) {
+        if (module.symbols[i].name >= header.strings.size) return VMMODULE_INVALID_SECTION;
+    }
+
+    // targets are checked against the code once it's loaded
+    module.handlers = (VMExceptionHandler const *) (base + header.handlers.offset);
+    module.handlerCount = header.handlers.size / sizeof(VMExceptionHandler);
+    for (u64 i = 0; i < module.handlerCount; ++i) {
+        VMExceptionHandler const &handler = module.handlers[i];
+        if (handler.start > handler.end || handler.exceptionRegister >= REGISTER_COUNT ||
+            handler.addressRegister >= REGISTER_COUNT) {
+            return VMMODULE_INVALID_SECTION;
+        }
+    }
+
+    // a cache written by a build with another instruction layout is useless
+    if (header.decodedSize == sizeof(VMDecodedInstruction) && header.decoded.size != 0) {
+        module.decoded = (VMDecodedInstruction const *) (base + header.decoded.offset);
+        module.decodedCount = header.decoded.size / sizeof(VMDecodedInstruction);
+        module.constants = (VMWord const *) (base + header.constants.offset);
+        module.constantCount = header.constants.size / sizeof(VMWord);
+    }
+
+    return VMMODULE_OK;
+}
+
+VMModuleStatus mapModule(char const *path, VMModule &module) {
+    module = {};
+
+    int file = open(path, O_RDONLY);
+    if (file < 0) return VMMODULE_CANT_OPEN;
+
+    struct stat status;
+    if (fstat(file, &status) != 0) {
+        close(file);
+        return VMMODULE_CANT_OPEN;
+    }
+    if ((u64) status.st_size < sizeof(VMModuleHeader)) {
+        close(file);
+        return VMMODULE_INVALID_HEADER;
+    }
+
+    // nothing is ever written through the mapping, pages are only read in
+    // (and shared with the page cache) when a section is touched
+    void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) return VMMODULE_CANT_MAP;
+
+    module.mapping = mapping;
+    module.mappingSize = status.st_size;
+    module.header = (VMModuleHeader const *) mapping;
+
+    VMModuleStatus result = validateModule(module);
+    if (result != VMMODULE_OK) unmapModule(module);
+    return result;
+}
+
+void unmapModule(VMModule &module) {
+    if (module.mapping != nullptr) {
+        munmap(module.mapping, module.mappingSize);
+    }
+    module = {};
+}
+
+static bool hasPayload(VMDecodedOperand const &operand) {
+    return operand.type == VMOPTYPE_IMMEDIATE || operand.type == VMOPTYPE_POINTER || operand.type == VMOPTYPE_DISPLACEMENT;
+}
+
+static bool isValidOperand(VMDecodedOperand const &operand, bool payload, u64 constantCount) {
+    if (operand.type > VMOPTYPE_VECTOR) return false;
+    if (operand.size != VMOPSIZE_BYTE && operand.size != VMOPSIZE_WORD &&
+        operand.size != VMOPSIZE_DWORD && operand.size != VMOPSIZE_QWORD) {
+        return false;
+    }
+
+    // payloads live in the constant pool
+    if (!payload) return true;
+    return operand.value < constantCount;
+}
+
+static VMModuleStatus loadDecoded(VMModule const &module, VMProgram &program) {
+    u64 constantBase = program.constants.length();
+    for (u64 i = 0; i < module.constantCount; ++i) {
+        if (!program.constants.append(module.constants[i])) return VMMODULE_OUT_OF_SPACE;
+    }
+
+    // the cache is as untrusted as the bytecode, so everything the decoder
+    // would have guaranteed is checked again
+    u64 constantCount = program.constants.length();
+    u64 codeBase = program.code.length();
+    for (u64 i = 0; i < module.decodedCount; ++i) {
+        VMDecodedInstruction inst = module.decoded[i];
+        s32 count = getOperandCount(inst.opcode);
+        if (count < 0) return VMMODULE_INVALID_CODE;
+
+        VMDecodedOperand *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+        for (s32 j = 0; j < count; ++j) {
+            VMDecodedOperand &operand = *operands[j];
+
+            // immediate targets are addresses, the engines check them
+            bool payload = hasPayload(operand) && !(j == 0 && hasTarget(inst.opcode));
+            if (payload) {
+                operand.value += constantBase;
+            } else if (operand.type == VMOPTYPE_REGISTER) {
+                operand.value = getRegisterOffset(operand.registerIndex, operand.size);
+            }
+            if (!isValidOperand(operand, payload, constantCount)) return VMMODULE_INVALID_CODE;
+            if ((operand.type == VMOPTYPE_VECTOR) != isVectorOperand(inst.opcode, j)) return VMMODULE_INVALID_CODE;
+        }
+
+        // handlers and labels are addresses in the writing process
+        inst.label = nullptr;
+        inst.handler = MetaVM::resolveHandler(inst);
+        if (!program.code.append(inst)) return VMMODULE_OUT_OF_SPACE;
+    }
+
+    u64 length = program.code.length();
+    if (length == codeBase || program.code[length - 1].opcode != VMOPCODE_HLT) {
+        return VMMODULE_INVALID_CODE;
+    }
+
+    // superinstructions read ahead, only the ones fuseProgram could have
+    // picked are safe to run
+    for (u64 i = codeBase; i < length; ++i) {
+        VMDecodedInstruction const &inst = program.code[i];
+        if (inst.dispatch != getDispatch(inst) && inst.dispatch != getSuperinstruction(program, i)) {
+            return VMMODULE_INVALID_CODE;
+        }
+    }
+
+    return VMMODULE_OK;
+}
+
+VMModuleStatus loadModule(VMModule const &module, VMProgram &program, memory_view<u8> &memory) {
+    VMModuleHeader const &header = *module.header;
+    if (header.dataAddress > memory.size() || header.data.size > memory.size() - header.dataAddress) {
+        return VMMODULE_OUT_OF_SPACE;
+    }
+
+    program.linked = false;
+    program.verified = false;
+    if (module.decodedCount != 0) {
+        VMModuleStatus status = loadDecoded(module, program);
+        if (status != VMMODULE_OK) return status;
+    } else {
+        memory_view<u8> code = module.code;
+        switch (decodeBytecode(code, code.size(), program)) {
+            case VMDECODE_OK:           break;
+            case VMDECODE_OUT_OF_SPACE: return VMMODULE_OUT_OF_SPACE;
+            default:                    return VMMODULE_INVALID_CODE;
+        }
+    }
+
+    for (u64 i = 0; i < module.handlerCount; ++i) {
+        if (module.handlers[i].target >= program.code.length()) return VMMODULE_INVALID_SECTION;
+    }
+    program.handlers = module.handlers;
+    program.handlerCount = module.handlerCount;
+
+    if (header.data.size != 0) {
+        std::memcpy(&memory[header.dataAddress], &module.data[0], header.data.size);
+    }
+
+    return VMMODULE_OK;
+}
+
+bool findSymbol(VMModule const &module, char const *name, u64 &address) {
+    for (u64 i = 0; i < module.symbolCount; ++i) {
+        VMModuleSymbol const &symbol = module.symbols[i];
+        if (std::strcmp(module.strings + symbol.name, name) == 0) {
+            address = symbol.address;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct ModuleWriter {
+    std::FILE *file;
+    u64 cursor;
+    bool failed;
+
+    void write(void const *data, u64 size) {
+        if (size != 0 && std::fwrite(data, 1, size, file) != size) failed = true;
+        cursor += size;
+    }
+
+    // pads up to where the next section starts
+    void seek(VMModuleSection const &section) {
+        static u8 const zeroes[VMMODULE_ALIGNMENT] {};
+        if (section.size == 0) return;
+        write(zeroes, section.offset - cursor);
+    }
+};
+
+VMModuleStatus writeModule(char const *path, VMModuleImage const &image) {
+    VMModuleHeader header {};
+    header.magic = VMMODULE_MAGIC;
+    header.version = VMMODULE_VERSION;
+    header.decodedSize = sizeof(VMDecodedInstruction);
+    header.dataAddress = image.dataAddress;
+
+    // the layout is computed up front so the header is written first
+    u64 cursor = sizeof(VMModuleHeader);
+    #define place(section, bytes)                                           \
+        if (u64 size = (bytes)) {                                           \
+            cursor = memory::align(cursor, VMMODULE_ALIGNMENT);             \
+            header.section = { cursor, size };                              \
+            cursor += size;                                                 \
+        }
+
+    u64 stringsSize = 0;
+    u64 symbolCount = image.symbols ? image.symbols->size() : 0;
+    for (u64 i = 0; i < symbolCount; ++i) {
+        stringsSize += std::strlen((*image.symbols)[i].name) + 1;
+    }
+
+    VMProgram const *decoded = image.decoded;
+    place(code, image.codeLength);
+    place(data, image.data ? image.data->size() : 0);
+    place(symbols, symbolCount * sizeof(VMModuleSymbol));
+    place(strings, stringsSize);
+    place(decoded, decoded ? decoded->code.length() * sizeof(VMDecodedInstruction) : 0);
+    place(constants, decoded ? decoded->constants.length() * sizeof(VMWord) : 0);
+    place(handlers, image.handlers ? image.handlers->size() * sizeof(VMExceptionHandler) : 0);
+
+    #undef place
+
+    std::FILE *file = std::fopen(path, "wb");
+    if (file == nullptr) return VMMODULE_CANT_OPEN;
+
+    ModuleWriter writer { file, 0, false };
+    writer.write(&header, sizeof(header));
+
+    writer.seek(header.code);
+    writer.write(&(*image.code)[0], image.codeLength);
+
+    writer.seek(header.data);
+    if (header.data.size) writer.write(&(*image.data)[0], header.data.size);
+
+    writer.seek(header.symbols);
+    u32 name = 0;
+    for (u64 i = 0; i < symbolCount; ++i) {
+        VMSymbol const &symbol = (*image.symbols)[i];
+        VMModuleSymbol entry { name, 0, symbol.address };
+        writer.write(&entry, sizeof(entry));
+        name += std::strlen(symbol.name) + 1;
+    }
+
+    writer.seek(header.strings);
+    for (u64 i = 0; i < symbolCount; ++i) {
+        char const *symbolName = (*image.symbols)[i].name;
+        writer.write(symbolName, std::strlen(symbolName) + 1);
+    }
+
+    writer.seek(header.decoded);
+    for (u64 i = 0; decoded && i < decoded->code.length(); ++i) {
+        // handlers and labels are resolved again by the loader
+        VMDecodedInstruction inst = decoded->code[i];
+        inst.label = nullptr;
+        inst.handler = nullptr;
+        writer.write(&inst, sizeof(inst));
+    }
+
+    writer.seek(header.constants);
+    for (u64 i = 0; decoded && i < decoded->constants.length(); ++i) {
+        writer.write(&decoded->constants[i], sizeof(VMWord));
+    }
+
+    writer.seek(header.handlers);
+    if (header.handlers.size) writer.write(&(*image.handlers)[0], header.handlers.size);
+
+    bool written = !writer.failed && writer.cursor == cursor;
+    if (std::fclose(file) != 0 || !written) return VMMODULE_CANT_WRITE;
+    return VMMODULE_OK;
+}
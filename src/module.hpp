@@ -0,0 +1,146 @@
+#if !defined(METAVM_MODULE_HPP)
+#define METAVM_MODULE_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+
+// on-disk module, a header followed by sections, offsets are from the start
+// of the file and every section is 8 byte aligned:
+//
+//  code       compact bytecode (see bytecode.hpp), required
+//  data       initialized memory, copied to `dataAddress` on load
+//  symbols    VMModuleSymbol entries, named instruction addresses
+//  strings    zero terminated symbol names
+//  decoded    VMDecodedInstruction entries, a cache of the decoded code
+//             including its terminating halt, valid with `constants` only
+//  constants  VMWord entries, the constant pool of `decoded`
+//  handlers   VMExceptionHandler entries, the exception handler table
+//
+// mapModule maps the file privately and reads every section in place, the
+// code is decoded straight from the mapped pages unless the decoded cache
+// can be used, which skips decoding altogether
+
+constexpr u32 VMMODULE_MAGIC = 0x4d4d564d; // "MVMM"
+constexpr u16 VMMODULE_VERSION = 7;
+
+struct VMModuleSection {
+    u64 offset;
+    u64   size;
+};
+
+struct VMModuleHeader {
+    u32                  magic;
+    u16                version;
+
+    // sizeof(VMDecodedInstruction) of the writer, the decoded cache is
+    // ignored when it differs
+    u16            decodedSize;
+
+    VMModuleSection       code;
+    VMModuleSection       data;
+    u64            dataAddress;
+    VMModuleSection    symbols;
+    VMModuleSection    strings;
+    VMModuleSection    decoded;
+    VMModuleSection  constants;
+    VMModuleSection   handlers;
+};
+
+struct VMModuleSymbol {
+    // offset of the name in the strings section
+    u32       name;
+    u32   reserved;
+    u64    address;
+};
+
+// a symbol to write, see writeModule
+struct VMSymbol {
+    char const *name;
+    u64      address;
+};
+
+enum VMModuleStatus {
+    VMMODULE_OK,
+    VMMODULE_CANT_OPEN,
+    VMMODULE_CANT_MAP,
+    VMMODULE_CANT_WRITE,
+    VMMODULE_INVALID_HEADER,
+    VMMODULE_UNSUPPORTED_VERSION,
+    VMMODULE_INVALID_SECTION,
+    VMMODULE_INVALID_CODE,
+    VMMODULE_OUT_OF_SPACE,
+};
+
+inline const char *getModuleStatusName(VMModuleStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMMODULE_OK);
+        stname(VMMODULE_CANT_OPEN);
+        stname(VMMODULE_CANT_MAP);
+        stname(VMMODULE_CANT_WRITE);
+        stname(VMMODULE_INVALID_HEADER);
+        stname(VMMODULE_UNSUPPORTED_VERSION);
+        stname(VMMODULE_INVALID_SECTION);
+        stname(VMMODULE_INVALID_CODE);
+        stname(VMMODULE_OUT_OF_SPACE);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// a mapped module, the views point into the mapping and stay valid until
+// unmapModule
+struct VMModule {
+    VMModuleHeader const *header;
+    memory_view<u8>         code;
+    memory_view<u8>         data;
+    VMModuleSymbol const *symbols;
+    u64              symbolCount;
+    char const          *strings;
+    VMDecodedInstruction const *decoded;
+    u64             decodedCount;
+    VMWord const       *constants;
+    u64            constantCount;
+    VMExceptionHandler const *handlers;
+    u64             handlerCount;
+
+    void                *mapping;
+    u64              mappingSize;
+};
+
+// maps and validates the module at `path`
+VMModuleStatus mapModule(char const *path, VMModule &module);
+void unmapModule(VMModule &module);
+
+// fills `program` from the decoded cache or by decoding the code section,
+// and copies the data section to `memory`, the program comes out unverified,
+// its exception handler table points into the mapping
+VMModuleStatus loadModule(VMModule const &module, VMProgram &program, memory_view<u8> &memory);
+
+// looks up the address of a symbol, returns false if there is none
+bool findSymbol(VMModule const &module, char const *name, u64 &address);
+
+// everything writeModule puts in a module, only `code` is required
+struct VMModuleImage {
+    // compact bytecode, see encodeBytecode
+    memory_view<u8>          *code;
+    u64                 codeLength;
+
+    memory_view<u8>          *data;
+    u64                dataAddress;
+
+    memory_view<VMSymbol>  *symbols;
+
+    // the decoded form of `code` to cache, fused or not
+    VMProgram const        *decoded;
+
+    memory_view<VMExceptionHandler> *handlers;
+};
+
+VMModuleStatus writeModule(char const *path, VMModuleImage const &image);
+
+#endif
@@ -0,0 +1,46 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "native.hpp"
+
+u64 VMNatives::add(VMNativeFunction function, void *context) {
+    if (!natives.append({ function, nullptr, context })) return VMNATIVE_INVALID_INDEX;
+    return natives.length() - 1;
+}
+
+u64 VMNatives::addBatched(VMNativeBatchFunction batch, void *context) {
+    if (!natives.append({ nullptr, batch, context })) return VMNATIVE_INVALID_INDEX;
+    return natives.length() - 1;
+}
+
+void VMNatives::record(u64 index, VMWord const *registers, memory_view<u8> &memory) {
+    VMNativeRecord record;
+    record.native = index;
+    std::memcpy(record.arguments, registers, sizeof(record.arguments));
+
+    // without a queue every call is a batch of its own
+    if (queue.size() == 0) {
+        runBatch(&record, 1, memory);
+        return;
+    }
+
+    if (_queued == queue.size()) flush(memory);
+    queue[_queued++] = record;
+}
+
+void VMNatives::flush(memory_view<u8> &memory) {
+    // one batch per run of calls to the same native
+    u64 start = 0;
+    for (u64 i = 1; i <= _queued; ++i) {
+        if (i == _queued || queue[i].native != queue[start].native) {
+            runBatch(&queue[start], i - start, memory);
+            start = i;
+        }
+    }
+    _queued = 0;
+}
+
+void VMNatives::runBatch(VMNativeRecord const *records, u64 count, memory_view<u8> &memory) {
+    VMNative const &native = natives[records[0].native];
+    VMNativeBatch batch { records, count, memory, native.context };
+    native.batch(batch);
+}
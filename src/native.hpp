@@ -0,0 +1,146 @@
+#if !defined(METAVM_NATIVE_HPP)
+#define METAVM_NATIVE_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+
+// host functions a program calls with VMOPCODE_CALLN, by their index in a
+// VMNatives attached to the VM (see MetaVM::attachNatives)
+//
+// arguments are passed in r0 to r7 and results come back in r0 and r1, the
+// native gets the whole register file though and what it leaves there stays,
+// natives keeping to the convention leave r2 and up alone, r30 and r31 are
+// never theirs to change
+//
+// natives work on VM memory in place through slices of it (see getSlice),
+// nothing is copied in or out
+//
+// natives called often and only for their effect, logging or counting, can
+// be batched, a call then only records the native and r0 to r3 in the
+// queue, the native gets the recorded calls all at once when the queue is
+// full, before an unbatched native runs and when the run stops, so it still
+// sees every call in program order, but it sees memory as it is then rather
+// than at the call, and it can neither return results nor fail
+//
+// natives waiting on something, a read or a timer, can return VMNATIVE_PENDING
+// instead of blocking, the run then returns VMRUN_SUSPENDED with r31 past the
+// CALLN, the thread is free to run other VMs, and once the operation is done
+// the host leaves the results in the registers, calls MetaVM::complete and
+// runs the VM again, which goes on after the CALLN, nothing but the VM itself
+// needs to be kept meanwhile, the slices the native was given stay valid as
+// long as the memory is
+
+// registers arguments are passed in, from r0 on
+constexpr u64 VMNATIVE_ARGUMENTS = 8;
+
+// registers a batched call records, from r0 on
+constexpr u64 VMNATIVE_BATCH_ARGUMENTS = 4;
+
+// what VMNatives::add returns when the registry is full
+constexpr u64 VMNATIVE_INVALID_INDEX = ~0ull;
+
+enum VMNativeStatus {
+    // the program goes on after the CALLN
+    VMNATIVE_OK,
+
+    // the call raises VMEXCEPT_NATIVE_FAILED
+    VMNATIVE_FAILED,
+
+    // the call raises VMEXCEPT_INVALID_ADDRESS, for natives that were passed
+    // memory they can't slice
+    VMNATIVE_INVALID_ADDRESS,
+
+    // the call completes later, the run is suspended until then, see
+    // MetaVM::complete
+    VMNATIVE_PENDING,
+};
+
+inline const char *getNativeStatusName(VMNativeStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMNATIVE_OK);
+        stname(VMNATIVE_FAILED);
+        stname(VMNATIVE_INVALID_ADDRESS);
+        stname(VMNATIVE_PENDING);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// the `length` bytes of `memory` from `address` on, in place, returns false
+// if they aren't all inside it
+inline bool getSlice(memory_view<u8> &memory, u64 address, u64 length, memory_view<u8> &slice) {
+    if (address > memory.size() || memory.size() - address < length) return false;
+    slice = memory_view<u8> { &memory[0] + address, length };
+    return true;
+}
+
+struct MetaVM;
+
+struct VMNativeCall {
+    VMWord        *registers;
+    memory_view<u8>   &memory;
+    void            *context;
+
+    // the VM that made the call, to complete pending ones
+    MetaVM               *vm;
+};
+
+// a batched call, the native it went to and its arguments
+struct VMNativeRecord {
+    u64                                 native;
+    VMWord arguments[VMNATIVE_BATCH_ARGUMENTS];
+};
+
+// consecutive batched calls to one native
+struct VMNativeBatch {
+    VMNativeRecord const *records;
+    u64                     count;
+    memory_view<u8>       &memory;
+    void                 *context;
+};
+
+using VMNativeFunction = VMNativeStatus (*)(VMNativeCall &call);
+using VMNativeBatchFunction = void (*)(VMNativeBatch &batch);
+
+// one of `function` and `batch` is set, the other is null
+struct VMNative {
+    VMNativeFunction       function;
+    VMNativeBatchFunction     batch;
+    void                   *context;
+};
+
+struct VMNatives {
+    // natives are registered into `natives`, batched calls are queued in
+    // `queue`, which may be empty, batches then have a single call, natives
+    // can be shared by several VMs but every VM needs a queue of its own
+    VMNatives(array_view<VMNative> &natives, memory_view<VMNativeRecord> &queue) :
+        natives(natives),
+        queue(queue)
+    {}
+
+    array_view<VMNative>          &natives;
+    memory_view<VMNativeRecord>     &queue;
+
+    // register a native, return its index or VMNATIVE_INVALID_INDEX when
+    // the registry is full
+    u64 add(VMNativeFunction function, void *context = nullptr);
+    u64 addBatched(VMNativeBatchFunction batch, void *context = nullptr);
+
+    // queues a call to the batched native `index`, running the queue first
+    // if it's full
+    void record(u64 index, VMWord const *registers, memory_view<u8> &memory);
+
+    // runs the queued calls, in the order they were made
+    void flush(memory_view<u8> &memory);
+
+private:
+    u64                             _queued = 0;
+
+    void runBatch(VMNativeRecord const *records, u64 count, memory_view<u8> &memory);
+};
+
+#endif
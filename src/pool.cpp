@@ -0,0 +1,158 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "pool.hpp"
+#include "arena.hpp"
+#include "metavm.hpp"
+
+VMPool::VMPool(u64 workerCount, u64 memorySize) :
+          _workers(new Worker[workerCount]),
+             _workerCount(0),
+               _memorySize(memorySize)
+{
+    // only as many workers as there are images and arenas are started, the
+    // images go to the cache, which holds one for every worker
+    u8 **images = new u8 *[workerCount];
+    if (getImageClass(_memorySize) < VMIMAGE_CLASS_COUNT) {
+        while (_workerCount < workerCount && _workers[_workerCount].arena.capacity() != 0) {
+            images[_workerCount] = _images.acquire(_memorySize);
+            if (images[_workerCount] == nullptr) break;
+            _workerCount++;
+        }
+    }
+    _images.maxCached = _workerCount;
+    for (u64 i = 0; i < _workerCount; ++i) {
+        _images.release(images[i], _memorySize);
+    }
+    delete[] images;
+
+    for (u64 i = 0; i < _workerCount; ++i) {
+        _workers[i].thread = std::thread(&VMPool::work, this, i);
+    }
+}
+
+VMPool::~VMPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wakeup.notify_all();
+
+    // workers drain every queued job before they exit
+    for (u64 i = 0; i < _workerCount; ++i) {
+        _workers[i].thread.join();
+    }
+    delete[] _workers;
+}
+
+std::future<VMJobResult> VMPool::submit(VMProgram &program, VMRegisters const &registers, u64 entry,
+                                        u64 budget, u64 deadline) {
+    if (_workerCount == 0) return std::future<VMJobResult>();
+    if (!program.linked) MetaVM::prepare(program);
+
+    VMJob *job = new VMJob { &program, registers, entry, budget, deadline, {} };
+    std::future<VMJobResult> result = job->result.get_future();
+
+    Worker &worker = _workers[_next.fetch_add(1, std::memory_order_relaxed) % _workerCount];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(job);
+    }
+
+    // the job is queued before it's counted, see work
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending++;
+    }
+    _wakeup.notify_one();
+
+    return result;
+}
+
+VMJob *VMPool::take(u64 index) {
+    {
+        // the newest job of our own is the one most likely still in cache
+        Worker &worker = _workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+            VMJob *job = worker.jobs.back();
+            worker.jobs.pop_back();
+            return job;
+        }
+    }
+
+    for (u64 i = 1; i < _workerCount; ++i) {
+        // steal the oldest job of the next worker that has one
+        Worker &victim = _workers[(index + i) % _workerCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            VMJob *job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return job;
+        }
+    }
+
+    return nullptr;
+}
+
+void VMPool::work(u64 index) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wakeup.wait(lock, [this] { return _pending != 0 || _stopping; });
+            if (_pending == 0) return;
+            _pending--;
+        }
+
+        // every claimed count stands for a queued job no other worker
+        // claimed, it may just still be on its way into a deque
+        VMJob *job;
+        while ((job = take(index)) == nullptr) {
+            std::this_thread::yield();
+        }
+
+        runJob(_workers[index], *job);
+    }
+}
+
+void VMPool::runJob(Worker &worker, VMJob &job) {
+    // the cache has an image for every worker, see VMPool
+    u8 *image = _images.acquire(_memorySize);
+    memory_view<u8> memory { image, _memorySize };
+
+    VMArenaScope scope { worker.arena };
+    VMException *log = (VMException *) arena_allocator(VMJOB_MAX_EXCEPTIONS * sizeof(VMException));
+    array_view<VMException> exceptionsView { log, VMJOB_MAX_EXCEPTIONS };
+    VMNativeRecord *queue = (VMNativeRecord *) arena_allocator(VMJOB_NATIVE_QUEUE * sizeof(VMNativeRecord));
+    memory_view<VMNativeRecord> queueView { queue, VMJOB_NATIVE_QUEUE };
+
+    // vector registers included, only the stack and instruction pointers
+    // are the pool's
+    VMRegisters registers = job.registers;
+    registers.data[REGISTER_COUNT - 2].u = _memorySize;
+    registers.data[REGISTER_COUNT - 1].u = job.entry;
+
+    MetaVM vm { *job.program, memory, exceptionsView };
+    vm.setRegisters(registers);
+
+    // the registry is shared, the queue is the job's, CALLN raises with an
+    // empty registry just as it does without one
+    array_view<VMNative> noNatives {};
+    VMNatives natives { _natives != nullptr ? *_natives : noNatives, queueView };
+    vm.attachNatives(&natives);
+
+    VMJobResult result {};
+    result.status = vm.run(job.budget, job.deadline);
+    result.exception = vm.getException();
+    result.registers = vm.getRegisters();
+    result.exceptionCount = exceptionsView.length();
+    for (u64 i = 0; i < result.exceptionCount; ++i) {
+        result.exceptions[i] = exceptionsView[i];
+    }
+
+    job.result.set_value(result);
+    delete &job;
+
+    // the image is cleared for the next job, a big one as it's touched again
+    _images.release(image, _memorySize);
+    worker.arena.reset();
+}
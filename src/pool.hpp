@@ -0,0 +1,120 @@
+#if !defined(METAVM_POOL_HPP)
+#define METAVM_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "arena.hpp"
+#include "metavm.hpp"
+
+// exceptions a job can report, a run stops at the first one anyway
+constexpr u64 VMJOB_MAX_EXCEPTIONS = 8;
+
+// batched native calls a job queues before they run, see VMNatives
+constexpr u64 VMJOB_NATIVE_QUEUE = 64;
+
+struct VMJobResult {
+    // how the run ended, a preempted or suspended job is dropped with its
+    // memory, the registers say where it stopped
+    VMRunStatus                             status;
+    VMRegisters                          registers;
+    VMException exceptions[VMJOB_MAX_EXCEPTIONS];
+    u64                             exceptionCount;
+
+    // the last exception raised, see MetaVM::getException
+    VMExceptionRecord                    exception;
+};
+
+// one run of a program, see VMPool::submit
+struct VMJob {
+    VMProgram                  *program;
+
+    // registers the run starts with, vector registers included, except for
+    // r30 (the stack pointer, the top of the job's memory) and r31 (`entry`)
+    VMRegisters               registers;
+    u64                           entry;
+
+    // what the run is given, see MetaVM::run
+    u64                          budget;
+    u64                        deadline;
+
+    std::promise<VMJobResult>    result;
+};
+
+// runs jobs on a fixed set of worker threads, every worker owns a deque of
+// jobs it pops from the back of, idle workers steal from the front of the
+// others', each job runs in a fresh VM on a zeroed memory image taken from
+// the pool's VMImagePool and handed back cleared after the job, its
+// exception log lives in its worker's arena, which is reset between jobs
+//
+// programs are shared by all jobs running them and must not change while
+// any of them is queued or running, submit prepares a program the first time
+// it sees it (see MetaVM::prepare), so the first submit of a program must
+// not race with other submits of it
+struct VMPool {
+    // the pool maps an image per worker up front and workers whose image
+    // can't be mapped aren't started, see workerCount, `memorySize` is at
+    // most the largest VMImagePool class, none are started otherwise
+    VMPool(u64 workerCount, u64 memorySize);
+    ~VMPool();
+
+    // returns an invalid future (see std::future::valid) if the pool has no
+    // workers, a job runs until it halts or raises, or until about `budget`
+    // instructions ran or the clock passed `deadline`, as MetaVM::run does,
+    // the time a job waits in the queue counts against its deadline
+    std::future<VMJobResult> submit(VMProgram &program, VMRegisters const &registers = VMRegisters(), u64 entry = 0,
+                                    u64 budget = VMRUN_UNLIMITED, u64 deadline = VMRUN_NO_DEADLINE);
+
+    // the natives VMOPCODE_CALLN calls in every job, registered before any
+    // job is submitted and left alone until the pool is gone, every job has
+    // a batch queue of its own, a job whose native returns VMNATIVE_PENDING
+    // ends as VMRUN_SUSPENDED, the pool can't complete it
+    void attachNatives(array_view<VMNative> *natives) {
+        _natives = natives;
+    }
+
+    // the workers that were started, 0 if no memory could be mapped at all
+    u64 workerCount() const {
+        return _workerCount;
+    }
+
+private:
+    struct Worker {
+        std::mutex              mutex;
+        std::deque<VMJob *>      jobs;
+        VMArena                 arena;
+        std::thread            thread;
+    };
+
+    Worker                       *_workers;
+    u64                      _workerCount;
+    u64                       _memorySize;
+
+    // holds an image for every worker, none is ever mapped after the
+    // constructor since at most one per worker is taken at a time
+    VMImagePool                   _images;
+
+    array_view<VMNative>        *_natives = nullptr;
+
+    // guards `_pending` and `_stopping`, idle workers sleep on `_wakeup`
+    std::mutex                     _mutex;
+    std::condition_variable       _wakeup;
+    u64                          _pending = 0;
+    bool                        _stopping = false;
+
+    // where submit queues the next job, round robin
+    std::atomic<u64>                _next {0};
+
+    void work(u64 index);
+    VMJob *take(u64 index);
+    void runJob(Worker &worker, VMJob &job);
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "profile.hpp"
+
+bool writeProfile(char const *path, VMProfile const &profile) {
+    std::FILE *file = std::fopen(path, "w");
+    if (file == nullptr) return false;
+
+    u64 length = profile.entries.length();
+    std::fprintf(file, "metavm-profile %u %llu\n", VMPROFILE_VERSION, length);
+    for (u64 i = 0; i < length; ++i) {
+        VMProfileEntry const &entry = profile.entries[i];
+        if (entry.executions == 0 && entry.calls == 0) continue;
+        std::fprintf(file, "%llu %llu %llu %llu %llu %llu %llu\n", i, entry.executions, entry.cycles,
+            entry.samples, entry.taken, entry.notTaken, entry.calls);
+    }
+
+    bool written = !std::ferror(file);
+    return std::fclose(file) == 0 && written;
+}
+
+bool readProfile(char const *path, VMProfile &profile) {
+    std::FILE *file = std::fopen(path, "r");
+    if (file == nullptr) return false;
+
+    for (u64 i = 0; i < profile.entries.length(); ++i) {
+        profile.entries[i] = {};
+    }
+
+    u32 version;
+    u64 length;
+    bool valid = std::fscanf(file, "metavm-profile %u %llu", &version, &length) == 2
+              && version == VMPROFILE_VERSION
+              && length <= profile.entries.length();
+
+    u64 address;
+    VMProfileEntry entry;
+    while (valid && std::fscanf(file, "%llu %llu %llu %llu %llu %llu %llu", &address, &entry.executions,
+               &entry.cycles, &entry.samples, &entry.taken, &entry.notTaken, &entry.calls) == 7) {
+        if (address >= length) {
+            valid = false;
+            break;
+        }
+        profile.entries[address] = entry;
+    }
+
+    valid = valid && std::feof(file);
+    std::fclose(file);
+    return valid;
+}
+
+static f64 getPercentage(u64 part, u64 total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+// walks indices by descending `value(i)`, ties in index order, `previous`
+// is the index visited last or `count` to start, returns `count` when done
+template<typename Value>
+static u64 getNextHottest(Value value, u64 count, u64 previous) {
+    u64 next = count;
+    for (u64 i = 0; i < count; ++i) {
+        if (value(i) == 0) continue;
+
+        // only what comes after `previous` in the ordering
+        if (previous != count && (value(i) > value(previous) || (value(i) == value(previous) && i <= previous))) {
+            continue;
+        }
+        if (next == count || value(i) > value(next)) next = i;
+    }
+    return next;
+}
+
+static void printOpcodes(VMProgram const &program, VMProfile const &profile, u64 length, u64 totalExecutions, u64 totalCycles) {
+    u64 executions[256] {};
+    u64 cycles[256] {};
+    for (u64 i = 0; i < length; ++i) {
+        u8 opcode = program.code[i].opcode;
+        executions[opcode] += profile.entries[i].executions;
+        cycles[opcode] += getEstimatedCycles(profile.entries[i]);
+    }
+
+    std::printf("OPCODES:\n");
+    std::printf("%-16s %14s %8s %16s %8s %12s\n", "opcode", "executions", "%", "cycles", "%", "cycles/exec");
+    auto value = [&](u64 i) { return executions[i]; };
+    for (u64 i = getNextHottest(value, 256, 256); i != 256; i = getNextHottest(value, 256, i)) {
+        std::printf("%-16s %14llu %7.2f%% %16llu %7.2f%% %12.1f\n", getOPCodeName((VMOPCode) i),
+            executions[i], getPercentage(executions[i], totalExecutions),
+            cycles[i], getPercentage(cycles[i], totalCycles), (f64) cycles[i] / executions[i]);
+    }
+}
+
+static void printHotSpots(VMProgram const &program, VMProfile const &profile, u64 length, u64 top, u64 totalExecutions, u64 totalCycles) {
+    auto value = [&](u64 i) { return profile.entries[i].executions; };
+
+    std::printf("HOT SPOTS:\n");
+    std::printf("%-10s %-16s %14s %8s %16s %8s\n", "address", "opcode", "executions", "%", "cycles", "%");
+    u64 i = getNextHottest(value, length, length);
+    for (u64 printed = 0; printed < top && i != length; ++printed) {
+        VMProfileEntry const &entry = profile.entries[i];
+        u64 cycles = getEstimatedCycles(entry);
+        std::printf("%-10llu %-16s %14llu %7.2f%% %16llu %7.2f%%\n", i, getOPCodeName(program.code[i].opcode),
+            entry.executions, getPercentage(entry.executions, totalExecutions),
+            cycles, getPercentage(cycles, totalCycles));
+        i = getNextHottest(value, length, i);
+    }
+}
+
+static void printBranches(VMProgram const &program, VMProfile const &profile, u64 length) {
+    std::printf("BRANCHES:\n");
+    std::printf("%-10s %-16s %14s %14s %8s\n", "address", "opcode", "taken", "not taken", "taken");
+    for (u64 i = 0; i < length; ++i) {
+        VMProfileEntry const &entry = profile.entries[i];
+        if (entry.taken + entry.notTaken == 0) continue;
+        std::printf("%-10llu %-16s %14llu %14llu %7.2f%%\n", i, getOPCodeName(program.code[i].opcode),
+            entry.taken, entry.notTaken, getPercentage(entry.taken, entry.taken + entry.notTaken));
+    }
+}
+
+static void printFunctions(VMProgram const &program, VMProfile const &profile, u64 length, u64 totalExecutions, u64 totalCycles) {
+    // functions are laid out one after the other, each one owns every
+    // instruction up to the next entry point
+    bool *isEntry = (bool *) default_allocator(length * sizeof(bool));
+    if (isEntry == nullptr) {
+        std::printf("FUNCTIONS: out of memory\n");
+        return;
+    }
+    isEntry[0] = true;
+    for (u64 i = 0; i < length; ++i) {
+        VMDecodedInstruction const &inst = program.code[i];
+        if (inst.opcode == VMOPCODE_CALL && inst.operand1.type == VMOPTYPE_IMMEDIATE) {
+            u64 target = inst.operand1.value;
+            if (target < length) isEntry[target] = true;
+        }
+        if (profile.entries[i].calls != 0) isEntry[i] = true;
+    }
+
+    std::printf("FUNCTIONS:\n");
+    std::printf("%-10s %12s %14s %8s %16s %8s\n", "entry", "calls", "executions", "%", "cycles", "%");
+    for (u64 entry = 0; entry < length;) {
+        u64 executions = 0;
+        u64 cycles = 0;
+        u64 end = entry;
+        do {
+            executions += profile.entries[end].executions;
+            cycles += getEstimatedCycles(profile.entries[end]);
+            end++;
+        } while (end < length && !isEntry[end]);
+
+        std::printf("%-10llu %12llu %14llu %7.2f%% %16llu %7.2f%%\n", entry, profile.entries[entry].calls,
+            executions, getPercentage(executions, totalExecutions), cycles, getPercentage(cycles, totalCycles));
+        entry = end;
+    }
+
+    default_deallocator(isEntry, length * sizeof(bool));
+}
+
+void printProfile(VMProgram const &program, VMProfile const &profile, u64 top) {
+    u64 length = program.code.length();
+    if (profile.entries.length() < length) length = profile.entries.length();
+    if (length == 0) return;
+
+    u64 totalExecutions = 0;
+    u64 totalCycles = 0;
+    for (u64 i = 0; i < length; ++i) {
+        totalExecutions += profile.entries[i].executions;
+        totalCycles += getEstimatedCycles(profile.entries[i]);
+    }
+
+    std::printf("PROFILE: %llu instructions, %llu estimated cycles\n", totalExecutions, totalCycles);
+    printOpcodes(program, profile, length, totalExecutions, totalCycles);
+    printHotSpots(program, profile, length, top, totalExecutions, totalCycles);
+    printBranches(program, profile, length);
+    printFunctions(program, profile, length, totalExecutions, totalCycles);
+}
@@ -0,0 +1,100 @@
+#if !defined(METAVM_PROFILE_HPP)
+#define METAVM_PROFILE_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+
+#if defined(__x86_64__)
+    #include <x86intrin.h>
+#endif
+
+// execution profile of a program, build with -D METAVM_PROFILE and attach
+// one to a MetaVM to fill it (see MetaVM::attachProfile), without the flag
+// the engines carry no profiling code at all
+//
+// only dispatched instructions are counted, parts of a superinstruction
+// after its head and code running in the JIT are not, so profile programs
+// that are neither fused nor compiled
+//
+// profiles outlive a run through writeProfile/readProfile so a training run
+// can drive fuseProgram in later ones, the file is plain text:
+//
+//  metavm-profile <version> <instruction count>
+//  <address> <executions> <cycles> <samples> <taken> <not taken> <calls>
+//
+// with one line per instruction that was executed or called
+
+// everything recorded for one instruction address
+struct VMProfileEntry {
+    u64   executions;
+
+    // cycles spent in `samples` sampled executions, from the dispatch of the
+    // instruction to the next one, handlers and dispatch overhead included
+    u64       cycles;
+    u64      samples;
+
+    // outcomes of a conditional jump
+    u64        taken;
+    u64     notTaken;
+
+    // calls that landed here, every call target starts a function
+    u64        calls;
+};
+
+struct VMProfile {
+    // one entry per decoded instruction
+    memory_view<VMProfileEntry> &entries;
+
+    // one in about every `samplePeriod` dispatches has its cycles measured,
+    // the distance between samples is randomized so loops whose length
+    // divides the period don't put every sample on the same instruction
+    u64  samplePeriod = 64;
+
+    // the sample in flight, see MetaVM::profileDispatch
+    u64     countdown = 1;
+    u64    sampleSeed = 0x9e3779b97f4a7c15;
+    bool     sampling = false;
+    u64 sampleAddress = 0;
+    u64   sampleStart = 0;
+
+    // dispatches until the next sample, uniform in [period / 2, period * 3 / 2]
+    u64 nextCountdown() {
+        sampleSeed ^= sampleSeed << 13;
+        sampleSeed ^= sampleSeed >> 7;
+        sampleSeed ^= sampleSeed << 17;
+        return samplePeriod / 2 + sampleSeed % samplePeriod + 1;
+    }
+};
+
+constexpr u32 VMPROFILE_VERSION = 2;
+
+// cycle counter the profiler samples, zero where there is none
+inline u64 readTimestamp() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// cycles an instruction cost over all its executions, extrapolated from the
+// sampled ones
+inline u64 getEstimatedCycles(VMProfileEntry const &entry) {
+    if (entry.samples == 0) return 0;
+    return (u64) ((f64) entry.cycles / entry.samples * entry.executions);
+}
+
+// returns false if the file can't be written
+bool writeProfile(char const *path, VMProfile const &profile);
+
+// clears `profile` and reads a profile written by writeProfile, returns false
+// if the file can't be read or was recorded for a longer program
+bool readProfile(char const *path, VMProfile &profile);
+
+// prints the flat profile (per opcode and the `top` hottest addresses), the
+// conditional jumps and a per-function breakdown, functions start at address
+// 0 and at every call target, whether the call was static or seen at runtime
+void printProfile(VMProgram const &program, VMProfile const &profile, u64 top = 20);
+
+#endif
@@ -0,0 +1,87 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "snapshot.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+static u64 getPageSize() {
+    static u64 const pageSize = (u64) sysconf(_SC_PAGESIZE);
+    return pageSize;
+}
+
+static bool isZero(u8 const *memory, u64 size) {
+    for (u64 i = 0; i < size; ++i) {
+        if (memory[i] != 0) return false;
+    }
+    return true;
+}
+
+VMSnapshotStatus takeSnapshot(MetaVM const &vm, memory_view<u8> const &memory, VMSnapshot &snapshot) {
+    int file = memfd_create("metavm-snapshot", MFD_CLOEXEC);
+    if (file < 0) return VMSNAPSHOT_CANT_CREATE;
+
+    u64 pageSize = getPageSize();
+    if (ftruncate(file, memory::align(memory.size(), pageSize)) != 0) {
+        close(file);
+        return VMSNAPSHOT_CANT_CREATE;
+    }
+
+    // pages left out are holes that read back as zero and take no memory,
+    // most of a freshly initialized image is untouched
+    for (u64 offset = 0; offset < memory.size(); offset += pageSize) {
+        u8 const *page = &memory[offset];
+        u64 size = memory.size() - offset < pageSize ? memory.size() - offset : pageSize;
+        if (isZero(page, size)) continue;
+
+        u64 written = 0;
+        while (written < size) {
+            ssize_t result = pwrite(file, page + written, size - written, offset + written);
+            if (result <= 0) {
+                close(file);
+                return VMSNAPSHOT_CANT_WRITE;
+            }
+            written += result;
+        }
+    }
+
+    snapshot.registers = vm.getRegisters();
+    snapshot.frameDepth = vm.getFrameDepth();
+    std::memcpy(snapshot.frames, vm.getFrames(), snapshot.frameDepth * sizeof(VMFrame));
+    snapshot.file = file;
+    snapshot.memorySize = memory.size();
+    return VMSNAPSHOT_OK;
+}
+
+void releaseSnapshot(VMSnapshot &snapshot) {
+    if (snapshot.file >= 0) {
+        close(snapshot.file);
+    }
+    snapshot.file = -1;
+    snapshot.memorySize = 0;
+}
+
+VMSnapshotStatus forkSnapshot(VMSnapshot const &snapshot, VMFork &fork) {
+    fork = {};
+
+    u64 mappingSize = memory::align(snapshot.memorySize, getPageSize());
+    void *mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, snapshot.file, 0);
+    if (mapping == MAP_FAILED) return VMSNAPSHOT_CANT_MAP;
+
+    fork.memory = memory_view<u8> { (u8 *) mapping, snapshot.memorySize };
+    fork.mapping = mapping;
+    fork.mappingSize = mappingSize;
+    return VMSNAPSHOT_OK;
+}
+
+void restoreFork(VMFork &fork) {
+    // dropping the private copies of a file mapping reverts them to the file
+    madvise(fork.mapping, fork.mappingSize, MADV_DONTNEED);
+}
+
+void releaseFork(VMFork &fork) {
+    if (fork.mapping != nullptr) {
+        munmap(fork.mapping, fork.mappingSize);
+    }
+    fork = {};
+}
@@ -0,0 +1,83 @@
+#if !defined(METAVM_SNAPSHOT_HPP)
+#define METAVM_SNAPSHOT_HPP
+
+#include "common.hpp"
+#include "types.hpp"
+#include "metavm.hpp"
+
+// a VM frozen after its initialization, the memory image lives in a memfd
+// that forks map privately, so a fork shares every page with the snapshot
+// until it writes one, and restoring it only drops the pages it wrote
+//
+//  VMSnapshot snapshot;
+//  takeSnapshot(vm, memory, snapshot);
+//
+//  VMFork fork;
+//  forkSnapshot(snapshot, fork);
+//  MetaVM vm { program, fork.memory, exceptions };
+//  vm.setRegisters(snapshot.registers, snapshot.frames, snapshot.frameDepth);
+//  vm.run();
+//  restoreFork(fork); // and setRegisters again to run it anew
+//
+// a VM can be snapshotted between runs as well, a preempted one included,
+// its forks resume where it stopped
+
+enum VMSnapshotStatus {
+    VMSNAPSHOT_OK,
+    VMSNAPSHOT_CANT_CREATE,
+    VMSNAPSHOT_CANT_WRITE,
+    VMSNAPSHOT_CANT_MAP,
+};
+
+inline const char *getSnapshotStatusName(VMSnapshotStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMSNAPSHOT_OK);
+        stname(VMSNAPSHOT_CANT_CREATE);
+        stname(VMSNAPSHOT_CANT_WRITE);
+        stname(VMSNAPSHOT_CANT_MAP);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+struct VMSnapshot {
+    VMRegisters registers;
+
+    // the frames the VM was in, see MetaVM::getFrames
+    VMFrame frames[VMFRAME_DEPTH];
+    u64                frameDepth = 0;
+
+    // memfd holding the memory image, padded to whole pages
+    int              file = -1;
+    u64        memorySize = 0;
+};
+
+// copies the registers and frames of `vm` and its `memory`, the VM can go on
+// running afterwards
+VMSnapshotStatus takeSnapshot(MetaVM const &vm, memory_view<u8> const &memory, VMSnapshot &snapshot);
+
+// forks that are still mapped keep the image alive
+void releaseSnapshot(VMSnapshot &snapshot);
+
+// a copy-on-write mapping of a snapshot's memory image, `memory` is the
+// view to build the forked VM on, it stays valid until releaseFork
+struct VMFork {
+    memory_view<u8>   memory;
+    void            *mapping;
+    u64          mappingSize;
+};
+
+VMSnapshotStatus forkSnapshot(VMSnapshot const &snapshot, VMFork &fork);
+
+// puts the memory of a fork back to the snapshot's image, the pages it wrote
+// are dropped and read back from the snapshot when they're touched again,
+// registers are left to MetaVM::setRegisters
+void restoreFork(VMFork &fork);
+
+void releaseFork(VMFork &fork);
+
+#endif
@@ -0,0 +1,132 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "trace.hpp"
+
+VMTrace::VMTrace(memory_view<u8> &buffer) :
+    _data(&buffer[0]),
+    _mask(buffer.size() - 1),
+    _publishInterval(buffer.size() / 4 < VMTRACE_PUBLISH_INTERVAL ? buffer.size() / 4 : VMTRACE_PUBLISH_INTERVAL)
+{}
+
+u64 readTrace(VMTrace &trace, u8 *destination, u64 length) {
+    u64 tail = trace.tail.load(std::memory_order_relaxed);
+    u64 head = trace.head.load(std::memory_order_acquire);
+    u64 size = head - tail < length ? head - tail : length;
+
+    // the bytes wrap around the end of the ring at most once
+    u64 capacity = trace._mask + 1;
+    u64 offset = tail & trace._mask;
+    u64 first = size < capacity - offset ? size : capacity - offset;
+    std::memcpy(destination, trace._data + offset, first);
+    std::memcpy(destination + first, trace._data, size - first);
+
+    trace.tail.store(tail + size, std::memory_order_release);
+    return size;
+}
+
+bool writeTraceHeader(std::FILE *file) {
+    VMTraceHeader header { VMTRACE_MAGIC, VMTRACE_VERSION };
+    return std::fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool drainTrace(VMTrace &trace, std::FILE *file) {
+    u64 tail = trace.tail.load(std::memory_order_relaxed);
+    u64 head = trace.head.load(std::memory_order_acquire);
+
+    // straight from the ring, in two parts if the bytes wrap around
+    u64 capacity = trace._mask + 1;
+    u64 offset = tail & trace._mask;
+    u64 size = head - tail;
+    u64 first = size < capacity - offset ? size : capacity - offset;
+    bool written = std::fwrite(trace._data + offset, 1, first, file) == first
+                && std::fwrite(trace._data, 1, size - first, file) == size - first;
+
+    trace.tail.store(head, std::memory_order_release);
+    return written;
+}
+
+struct TraceReader {
+    u8 const *data;
+    u64     length;
+    u64    &cursor;
+
+    bool get(u8 &byte) {
+        if (cursor >= length) return false;
+        byte = data[cursor++];
+        return true;
+    }
+
+    bool getVarint(u64 &value) {
+        value = 0;
+        for (u8 shift = 0; shift < 64; shift += 7) {
+            u8 byte;
+            if (!get(byte)) return false;
+            value |= (u64) (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool getZigzag(u64 &difference) {
+        u64 zigzag;
+        if (!getVarint(zigzag)) return false;
+        difference = (zigzag >> 1) ^ (0 - (zigzag & 1));
+        return true;
+    }
+};
+
+VMTraceStatus VMTraceDecoder::readHeader(u8 const *data, u64 length, u64 &cursor) {
+    VMTraceHeader header;
+    if (length - cursor < sizeof(header)) return VMTRACE_INVALID_HEADER;
+    std::memcpy(&header, data + cursor, sizeof(header));
+    if (header.magic != VMTRACE_MAGIC) return VMTRACE_INVALID_HEADER;
+    if (header.version != VMTRACE_VERSION) return VMTRACE_UNSUPPORTED_VERSION;
+
+    cursor += sizeof(header);
+    return VMTRACE_OK;
+}
+
+VMTraceStatus VMTraceDecoder::next(u8 const *data, u64 length, u64 &cursor, VMTraceRecord &record) {
+    if (cursor >= length) return VMTRACE_END;
+
+    // the cursor only moves once the whole record is there
+    u64 position = cursor;
+    TraceReader reader { data, length, position };
+    u8 tag;
+    reader.get(tag);
+    if (tag & ~(VMTRACE_JUMP | VMTRACE_VALUE | VMTRACE_DELTA | VMTRACE_SYNC)) return VMTRACE_INVALID_RECORD;
+    if (!reader.get(record.opcode)) return VMTRACE_TRUNCATED;
+
+    record.dropped = 0;
+    if (tag & VMTRACE_SYNC) {
+        if (!reader.getVarint(record.dropped) || !reader.getVarint(record.address)) return VMTRACE_TRUNCATED;
+        for (u64 i = 0; i < VMTRACE_PREDICTORS; ++i) {
+            _predictors[i] = {};
+        }
+        _synced = true;
+    } else if (!_synced) {
+        // the first record of a trace is always a sync one
+        return VMTRACE_INVALID_RECORD;
+    } else {
+        u64 difference = 0;
+        if ((tag & VMTRACE_JUMP) && !reader.getZigzag(difference)) return VMTRACE_TRUNCATED;
+        record.address = _nextAddress + difference;
+    }
+
+    record.hasValue = tag & VMTRACE_VALUE;
+    record.value = 0;
+    if (record.hasValue) {
+        VMTracePredictor &predictor = _predictors[record.address & (VMTRACE_PREDICTORS - 1)];
+        u64 difference = 0;
+        if ((tag & VMTRACE_DELTA) && !reader.getZigzag(difference)) return VMTRACE_TRUNCATED;
+        record.value = predictor.value + predictor.stride + difference;
+        predictor.stride = record.value - predictor.value;
+        predictor.value = record.value;
+    } else if (tag & VMTRACE_DELTA) {
+        return VMTRACE_INVALID_RECORD;
+    }
+
+    _nextAddress = record.address + 1;
+    cursor = position;
+    return VMTRACE_OK;
+}
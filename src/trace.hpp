@@ -0,0 +1,258 @@
+#if !defined(METAVM_TRACE_HPP)
+#define METAVM_TRACE_HPP
+
+#include <atomic>
+
+#include "common.hpp"
+#include "types.hpp"
+
+// execution trace of a run, build with -D METAVM_TRACE and attach one to a
+// MetaVM to record every instruction it retires (see MetaVM::attachTrace),
+// without the flag the engines carry no tracing code at all
+//
+// the VM writes records into a ring buffer while a reader on another thread
+// drains it (see readTrace and drainTrace), neither ever waits for the other,
+// when the ring is full the VM drops records and counts them, so a reader
+// that can't keep up loses records but never slows the run down
+//
+// a record is an instruction address, its opcode and the value it left in
+// its destination (see getDestinationOperand), delta compressed:
+//
+//  record := tag:u8 opcode:u8 [dropped:varint address:varint] [jump:zigzag] [value:zigzag]
+//
+// addresses are relative to the one after the previous record's, so straight
+// code has none, values are relative to a prediction, the value the same
+// instruction had last time plus the difference to the time before, so
+// counters and pointers walking arrays have none either, most records take
+// two or three bytes
+//
+// like profiles traces only see what the engines execute, code running in
+// the JIT is not traced, an instruction that raised is not retired and has
+// no record
+
+// bits of a record's tag
+enum VMTraceTag : u8 {
+    // the address is not the one after the previous record's, a zigzag
+    // LEB128 difference to that follows
+    VMTRACE_JUMP  = 0x01,
+
+    // the instruction has a destination value
+    VMTRACE_VALUE = 0x02,
+
+    // the value is not the predicted one, a zigzag LEB128 difference to the
+    // prediction follows
+    VMTRACE_DELTA = 0x04,
+
+    // the first record and the first one after records were dropped, the
+    // number dropped and the absolute address follow, predictions restart
+    VMTRACE_SYNC  = 0x08,
+};
+
+// the most a record takes, a tag, an opcode and three LEB128 numbers
+constexpr u64 VMTRACE_MAX_RECORD = 2 + 3 * 10;
+
+// the VM makes what it wrote visible to the reader every this many bytes
+// (or every quarter of smaller rings), when the ring is full and when the
+// engine stops, not with every record, so the two sides don't fight over
+// the cache line the head is in
+constexpr u64 VMTRACE_PUBLISH_INTERVAL = 4096;
+
+// value predictions are kept per instruction address modulo this
+constexpr u64 VMTRACE_PREDICTORS = 256;
+
+// a trace file is a VMTraceHeader followed by the records as the VM wrote them
+constexpr u32 VMTRACE_MAGIC = 0x544d564d; // "MVMT"
+constexpr u32 VMTRACE_VERSION = 1;
+
+struct VMTraceHeader {
+    u32   magic;
+    u32 version;
+};
+
+// the value of an address the writer and the reader predict the same way
+struct VMTracePredictor {
+    u64  value;
+    u64 stride;
+};
+
+struct VMTrace {
+    // `buffer` has to be a power of two of bytes
+    VMTrace(memory_view<u8> &buffer);
+
+    // bytes written by the VM and read by the reader so far, only ever
+    // moved by their own side
+    alignas(64) std::atomic<u64>  head {0};
+    alignas(64) std::atomic<u64>  tail {0};
+
+    // records dropped since the last one written, only written by the VM,
+    // once it stopped the ones at the end no sync record counts
+    alignas(64) u64            dropped = 0;
+
+    // appends a record, `address` is where the retired instruction is
+    void record(u64 address, u8 opcode, bool hasValue, u64 value) {
+        // the reader is only looked at when the ring seems full
+        if (_cursor - _cachedTail > _mask + 1 - VMTRACE_MAX_RECORD) {
+            flush();
+            _cachedTail = tail.load(std::memory_order_acquire);
+            if (_cursor - _cachedTail > _mask + 1 - VMTRACE_MAX_RECORD) {
+                dropped++;
+                _synced = false;
+                return;
+            }
+        }
+
+        // straight into the ring unless the record could wrap around its end
+        u64 offset = _cursor & _mask;
+        u64 length;
+        if (_mask + 1 - offset >= VMTRACE_MAX_RECORD) {
+            length = encode(_data + offset, address, opcode, hasValue, value);
+        } else {
+            u8 bytes[VMTRACE_MAX_RECORD];
+            length = encode(bytes, address, opcode, hasValue, value);
+            for (u64 i = 0; i < length; ++i) {
+                _data[(_cursor + i) & _mask] = bytes[i];
+            }
+        }
+
+        _cursor += length;
+        if (_cursor - _published >= _publishInterval) flush();
+    }
+
+    // makes every record written so far visible to the reader
+    void flush() {
+        head.store(_cursor, std::memory_order_release);
+        _published = _cursor;
+    }
+
+private:
+    friend u64 readTrace(VMTrace &trace, u8 *destination, u64 length);
+    friend bool drainTrace(VMTrace &trace, std::FILE *file);
+
+    u8                           *_data;
+    u64                           _mask;
+    u64                         _cursor = 0;
+    u64                      _published = 0;
+    u64                _publishInterval;
+    u64                     _cachedTail = 0;
+    u64                    _nextAddress = 0;
+    bool                        _synced = false;
+    VMTracePredictor _predictors[VMTRACE_PREDICTORS] {};
+
+    // writes the record to `bytes`, returns its length
+    u64 encode(u8 *bytes, u64 address, u8 opcode, bool hasValue, u64 value) {
+        u64 length = 2;
+        u8 tag = 0;
+
+        if (!_synced) {
+            tag |= VMTRACE_SYNC;
+            length = putVarint(bytes, length, dropped);
+            length = putVarint(bytes, length, address);
+            for (u64 i = 0; i < VMTRACE_PREDICTORS; ++i) {
+                _predictors[i] = {};
+            }
+            dropped = 0;
+            _synced = true;
+        } else if (address != _nextAddress) {
+            tag |= VMTRACE_JUMP;
+            length = putZigzag(bytes, length, address - _nextAddress);
+        }
+        _nextAddress = address + 1;
+
+        if (hasValue) {
+            tag |= VMTRACE_VALUE;
+            VMTracePredictor &predictor = _predictors[address & (VMTRACE_PREDICTORS - 1)];
+            u64 difference = value - (predictor.value + predictor.stride);
+            predictor.stride = value - predictor.value;
+            predictor.value = value;
+            if (difference != 0) {
+                tag |= VMTRACE_DELTA;
+                length = putZigzag(bytes, length, difference);
+            }
+        }
+
+        bytes[0] = tag;
+        bytes[1] = opcode;
+        return length;
+    }
+
+    // LEB128 into `bytes` at `length`, returns the new length
+    static u64 putVarint(u8 *bytes, u64 length, u64 value) {
+        while (value >= 0x80) {
+            bytes[length++] = (u8) value | 0x80;
+            value >>= 7;
+        }
+        bytes[length++] = (u8) value;
+        return length;
+    }
+
+    static u64 putZigzag(u8 *bytes, u64 length, u64 difference) {
+        return putVarint(bytes, length, difference << 1 ^ (u64) ((s64) difference >> 63));
+    }
+};
+
+// copies up to `length` bytes of records the VM wrote to `destination` and
+// frees their room in the ring, returns the number of bytes copied, records
+// may be split between two reads, the bytes read in order are a trace
+u64 readTrace(VMTrace &trace, u8 *destination, u64 length);
+
+// writes the header of a trace file, returns false if it can't be written
+bool writeTraceHeader(std::FILE *file);
+
+// appends everything the VM wrote since the last drain to `file`, returns
+// false if it can't be written
+bool drainTrace(VMTrace &trace, std::FILE *file);
+
+enum VMTraceStatus {
+    VMTRACE_OK,
+    VMTRACE_END,
+    VMTRACE_INVALID_HEADER,
+    VMTRACE_UNSUPPORTED_VERSION,
+    VMTRACE_TRUNCATED,
+    VMTRACE_INVALID_RECORD,
+};
+
+inline const char *getTraceStatusName(VMTraceStatus status) {
+    #define stname(s) case s: return #s
+
+    switch (status) {
+        stname(VMTRACE_OK);
+        stname(VMTRACE_END);
+        stname(VMTRACE_INVALID_HEADER);
+        stname(VMTRACE_UNSUPPORTED_VERSION);
+        stname(VMTRACE_TRUNCATED);
+        stname(VMTRACE_INVALID_RECORD);
+    }
+
+    #undef stname
+
+    return "";
+}
+
+// a record with what's relative in it resolved
+struct VMTraceRecord {
+    u64  address;
+    u64    value;
+
+    // records the VM dropped right before this one
+    u64  dropped;
+    u8    opcode;
+    bool hasValue;
+};
+
+// the reading side of the compression, keeps the predictions in step with
+// the VM's while it goes through the records in order
+struct VMTraceDecoder {
+    // checks the header at the start of a trace file and moves `cursor` past it
+    VMTraceStatus readHeader(u8 const *data, u64 length, u64 &cursor);
+
+    // decodes the record at `cursor` and moves the cursor past it, returns
+    // VMTRACE_END once the cursor reached `length`
+    VMTraceStatus next(u8 const *data, u64 length, u64 &cursor, VMTraceRecord &record);
+
+private:
+    u64                    _nextAddress = 0;
+    bool                        _synced = false;
+    VMTracePredictor _predictors[VMTRACE_PREDICTORS] {};
+};
+
+#endif
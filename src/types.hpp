@@ -9,6 +9,10 @@ enum VMOperandType {
     // NOTE: cannot be used on float registers
     VMOPTYPE_INDIRECT, 
     VMOPTYPE_DISPLACEMENT,
+
+    // a vector register, `size` is the width of its lanes, only valid where
+    // a vector opcode expects one (see isVectorOperand)
+    VMOPTYPE_VECTOR,
 };
 
 enum VMOperandSize : u8 {
@@ -91,6 +95,45 @@ union VMWord {
     }
 };
 
+// 32 bytes of lanes, 32 u8 through 4 f64
+constexpr u64 VECTOR_SIZE = 32;
+
+union alignas(VECTOR_SIZE) VMVector {
+    u8   ubytes[VECTOR_SIZE];
+    s8   sbytes[VECTOR_SIZE];
+
+    u16  uwords[VECTOR_SIZE / 2];
+    s16  swords[VECTOR_SIZE / 2];
+
+    u32 udwords[VECTOR_SIZE / 4];
+    s32 sdwords[VECTOR_SIZE / 4];
+
+    u64  uqwords[VECTOR_SIZE / 8];
+    s64  sqwords[VECTOR_SIZE / 8];
+
+    f32 fsingles[VECTOR_SIZE / 4];
+    f64 fdoubles[VECTOR_SIZE / 8];
+};
+
+enum VMValueKind {
+    VMVALUE_UNSIGNED,
+    VMVALUE_SIGNED,
+    VMVALUE_FLOAT,
+};
+
+// the C type of a value of a kind and size
+template<VMValueKind Kind, VMOperandSize Size> struct VMValue;
+template<> struct VMValue<VMVALUE_UNSIGNED, VMOPSIZE_BYTE>  { using type = u8;  };
+template<> struct VMValue<VMVALUE_UNSIGNED, VMOPSIZE_WORD>  { using type = u16; };
+template<> struct VMValue<VMVALUE_UNSIGNED, VMOPSIZE_DWORD> { using type = u32; };
+template<> struct VMValue<VMVALUE_UNSIGNED, VMOPSIZE_QWORD> { using type = u64; };
+template<> struct VMValue<VMVALUE_SIGNED,   VMOPSIZE_BYTE>  { using type = s8;  };
+template<> struct VMValue<VMVALUE_SIGNED,   VMOPSIZE_WORD>  { using type = s16; };
+template<> struct VMValue<VMVALUE_SIGNED,   VMOPSIZE_DWORD> { using type = s32; };
+template<> struct VMValue<VMVALUE_SIGNED,   VMOPSIZE_QWORD> { using type = s64; };
+template<> struct VMValue<VMVALUE_FLOAT,    VMOPSIZE_DWORD> { using type = f32; };
+template<> struct VMValue<VMVALUE_FLOAT,    VMOPSIZE_QWORD> { using type = f64; };
+
 struct VMOperand {
     VMOperandType          type;
     VMOperandSize          size;
@@ -123,9 +166,100 @@ enum VMOPCode {
     VMOPCODE_JMP,       VMOPCODE_JEQ,      VMOPCODE_JNE,      VMOPCODE_JGT,      VMOPCODE_JLT,    VMOPCODE_JGE,    VMOPCODE_JLE,
 
     // procedures (functions)
-    VMOPCODE_CALL,      VMOPCODE_RET
+    VMOPCODE_CALL,      VMOPCODE_RET,
+
+    // conditional jumps comparing signed integers and floats, f32 (dword)
+    // and f64 (qword) ones, the jumps above compare unsigned integers, a
+    // comparison with a NaN only holds for JNEF
+    VMOPCODE_JGTS,      VMOPCODE_JLTS,     VMOPCODE_JGES,     VMOPCODE_JLES,
+    VMOPCODE_JEQF,      VMOPCODE_JNEF,     VMOPCODE_JGTF,     VMOPCODE_JLTF,   VMOPCODE_JGEF,   VMOPCODE_JLEF,
+
+    // frames, right after a call
+    //
+    //  ENTER registers, size   saves the registers whose bits are set in
+    //                          `registers` (r0 to r29) below the return
+    //                          address and reserves `size` bytes of locals
+    //  LEAVE                   restores them, drops the frame and returns
+    //                          to where the call that entered it came from
+    VMOPCODE_ENTER,     VMOPCODE_LEAVE,
+
+    // host functions, CALLN native calls the native registered at that
+    // index, see native.hpp
+    VMOPCODE_CALLN,
+
+    // vectors, lane-wise over the vector registers, the lane width is the
+    // size of the vector operands, the F family takes f32 (dword) and f64
+    // (qword) lanes, the S family signed ones and the rest unsigned ones
+    //
+    //  VLOAD    memory, vector         VSTORE   vector, memory
+    //  VSPLAT   scalar, vector         VEXTRACT vector, lane, scalar
+    //  VSUM*    vector, scalar         the lanes added up, at the scalar's size
+    //  VSHUF    vector, index, vector  lane i of the result is lane index[i]
+    //                                  (modulo the lane count) of the vector
+    //  the rest vector, vector, vector VCMP* set the lanes they hold for to
+    //                                  all ones and the others to zero
+    VMOPCODE_VLOAD = 0x60,
+    VMOPCODE_VSTORE,    VMOPCODE_VSPLAT,   VMOPCODE_VEXTRACT,
+    VMOPCODE_VADD,      VMOPCODE_VSUB,     VMOPCODE_VMUL,
+    VMOPCODE_VADDF,     VMOPCODE_VSUBF,    VMOPCODE_VMULF,
+    VMOPCODE_VMIN,      VMOPCODE_VMAX,     VMOPCODE_VMINS,    VMOPCODE_VMAXS,  VMOPCODE_VMINF,  VMOPCODE_VMAXF,
+    VMOPCODE_VCMPEQ,    VMOPCODE_VCMPGT,   VMOPCODE_VCMPGTS,  VMOPCODE_VCMPEQF, VMOPCODE_VCMPGTF,
+    VMOPCODE_VSHUF,     VMOPCODE_VSUM,     VMOPCODE_VSUMS,    VMOPCODE_VSUMF,
+
+    // bulk memory, over `length` bytes of memory checked to be in range as a
+    // whole, the length is read at the size of its operand
+    //
+    //  MCOPY source, destination, length   the ranges may overlap
+    //  MFILL destination, value, length    every byte set to the low byte of value
+    //  MCMP  memory, memory, length        length receives the offset of the
+    //                                      first byte that differs, or itself
+    //  MFIND memory, value, length         length receives the offset of the
+    //                                      first byte equal to the low byte of
+    //                                      value, or itself
+    VMOPCODE_MCOPY = 0x80,
+    VMOPCODE_MFILL,     VMOPCODE_MCMP,     VMOPCODE_MFIND
 };
 
+inline const char *getOPCodeName(VMOPCode opcode) {
+    #define opname(o) case o: return #o
+
+    switch (opcode) {
+        opname(VMOPCODE_HLT);   opname(VMOPCODE_NOP);   opname(VMOPCODE_MOV);
+        opname(VMOPCODE_PUSH);  opname(VMOPCODE_POP);
+        opname(VMOPCODE_ADD);   opname(VMOPCODE_SUB);   opname(VMOPCODE_MUL);
+        opname(VMOPCODE_DIV);   opname(VMOPCODE_DIVR);  opname(VMOPCODE_ADDS);
+        opname(VMOPCODE_SUBS);  opname(VMOPCODE_MULS);  opname(VMOPCODE_DIVS);
+        opname(VMOPCODE_DIVSR); opname(VMOPCODE_ADDF);  opname(VMOPCODE_SUBF);
+        opname(VMOPCODE_MULF);  opname(VMOPCODE_DIVF);  opname(VMOPCODE_ADDFS);
+        opname(VMOPCODE_SUBFS); opname(VMOPCODE_MULFS); opname(VMOPCODE_DIVFS);
+        opname(VMOPCODE_NEG);   opname(VMOPCODE_AND);   opname(VMOPCODE_OR);
+        opname(VMOPCODE_XOR);   opname(VMOPCODE_NOT);   opname(VMOPCODE_JMP);
+        opname(VMOPCODE_JEQ);   opname(VMOPCODE_JNE);   opname(VMOPCODE_JGT);
+        opname(VMOPCODE_JLT);   opname(VMOPCODE_JGE);   opname(VMOPCODE_JLE);
+        opname(VMOPCODE_CALL);  opname(VMOPCODE_RET);
+        opname(VMOPCODE_JGTS);  opname(VMOPCODE_JLTS);  opname(VMOPCODE_JGES);
+        opname(VMOPCODE_JLES);  opname(VMOPCODE_JEQF);  opname(VMOPCODE_JNEF);
+        opname(VMOPCODE_JGTF);  opname(VMOPCODE_JLTF);  opname(VMOPCODE_JGEF);
+        opname(VMOPCODE_JLEF);  opname(VMOPCODE_ENTER); opname(VMOPCODE_LEAVE);
+        opname(VMOPCODE_CALLN);
+        opname(VMOPCODE_VLOAD);   opname(VMOPCODE_VSTORE);  opname(VMOPCODE_VSPLAT);
+        opname(VMOPCODE_VEXTRACT); opname(VMOPCODE_VADD);   opname(VMOPCODE_VSUB);
+        opname(VMOPCODE_VMUL);    opname(VMOPCODE_VADDF);   opname(VMOPCODE_VSUBF);
+        opname(VMOPCODE_VMULF);   opname(VMOPCODE_VMIN);    opname(VMOPCODE_VMAX);
+        opname(VMOPCODE_VMINS);   opname(VMOPCODE_VMAXS);   opname(VMOPCODE_VMINF);
+        opname(VMOPCODE_VMAXF);   opname(VMOPCODE_VCMPEQ);  opname(VMOPCODE_VCMPGT);
+        opname(VMOPCODE_VCMPGTS); opname(VMOPCODE_VCMPEQF); opname(VMOPCODE_VCMPGTF);
+        opname(VMOPCODE_VSHUF);   opname(VMOPCODE_VSUM);    opname(VMOPCODE_VSUMS);
+        opname(VMOPCODE_VSUMF);
+        opname(VMOPCODE_MCOPY);   opname(VMOPCODE_MFILL);   opname(VMOPCODE_MCMP);
+        opname(VMOPCODE_MFIND);
+    }
+
+    #undef opname
+
+    return "";
+}
+
 struct VMInstruction {
     VMOPCode    opcode;
     VMOperand operand1;
@@ -135,12 +269,16 @@ struct VMInstruction {
 
 // 32 registers is more than enough for most operations
 constexpr u64 REGISTER_COUNT = 32;
+constexpr u64 VECTOR_REGISTER_COUNT = 16;
 
 struct VMRegisters {
     // general purpose registers
     // can also be used as floating point registers
     // registers 30 and 31 are reserved
     VMWord data[REGISTER_COUNT] {};
+
+    // vector registers, see VMOPCODE_VLOAD
+    VMVector vectors[VECTOR_REGISTER_COUNT] {};
 };
 
 enum VMException {
@@ -150,6 +288,10 @@ enum VMException {
     VMEXCEPT_STACK_UNDERFLOW,
     VMEXCEPT_INTEGER_OVERFLOW,
     VMEXCEPT_FLOAT_OVERFLOW,
+    VMEXCEPT_INVALID_ADDRESS,
+
+    // a native called with VMOPCODE_CALLN reported a failure
+    VMEXCEPT_NATIVE_FAILED,
 };
 
 inline const char *getExceptionName(VMException exception) {
@@ -162,6 +304,8 @@ inline const char *getExceptionName(VMException exception) {
         exname(VMEXCEPT_STACK_UNDERFLOW);
         exname(VMEXCEPT_INTEGER_OVERFLOW);
         exname(VMEXCEPT_FLOAT_OVERFLOW);
+        exname(VMEXCEPT_INVALID_ADDRESS);
+        exname(VMEXCEPT_NATIVE_FAILED);
     }
 
     #undef exname
@@ -169,5 +313,20 @@ inline const char *getExceptionName(VMException exception) {
     return "";
 }
 
+// the operand of a VMExceptionRecord when no single operand is at fault
+constexpr s32 VMEXCEPTION_NO_OPERAND = -1;
+
+// an exception with the context it was raised in
+struct VMExceptionRecord {
+    VMException exception;
+
+    // index (from 0) of the operand that caused it, VMEXCEPTION_NO_OPERAND
+    // when it's the instruction as a whole
+    s32           operand;
+
+    // address of the instruction that raised it
+    u64           address;
+};
+
 #endif
 
@@ -0,0 +1,190 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "metavm.hpp"
+
+static bool isValidRegister(VMDecodedOperand const &operand) {
+    switch (operand.type) {
+        case VMOPTYPE_REGISTER:
+            // sub registers of a size pack (QWORD / size) of them per register
+            return operand.registerIndex < REGISTER_COUNT * (VMOPSIZE_QWORD / operand.size);
+        case VMOPTYPE_INDIRECT:
+        case VMOPTYPE_DISPLACEMENT:
+            return operand.registerIndex < REGISTER_COUNT;
+        case VMOPTYPE_VECTOR:
+            return operand.registerIndex < VECTOR_REGISTER_COUNT;
+        default:
+            return true;
+    }
+}
+
+static bool isValidTarget(VMProgram &program, VMDecodedOperand const &target) {
+    // targets in registers or memory are only known at runtime and stay checked
+    if (target.type != VMOPTYPE_IMMEDIATE) return true;
+
+    // the decoder resolved it to the address, see hasTarget
+    return target.value < program.code.length();
+}
+
+// a MOV of an immediate to r31 is a jump with a static target, every other
+// write to r31 is only known at runtime, where the engines check it whether
+// the program is verified or not
+static bool isValidJumpThroughIP(VMProgram &program, VMDecodedOperand const &source, VMDecodedOperand const &destination) {
+    bool writesIP = destination.type == VMOPTYPE_REGISTER && destination.size == VMOPSIZE_QWORD &&
+                    destination.value == (REGISTER_COUNT - 1) * sizeof(VMWord);
+    if (!writesIP || source.type != VMOPTYPE_IMMEDIATE) return true;
+    return getUnsigned(source.size, program.constants[source.value]) < program.code.length();
+}
+
+static bool isFloatOperation(VMOPCode opcode, VMOperandSize &size) {
+    switch (opcode) {
+        case VMOPCODE_ADDF:  case VMOPCODE_SUBF:  case VMOPCODE_MULF:  case VMOPCODE_DIVF:
+            size = VMOPSIZE_QWORD;
+            return true;
+        case VMOPCODE_ADDFS: case VMOPCODE_SUBFS: case VMOPCODE_MULFS: case VMOPCODE_DIVFS:
+            size = VMOPSIZE_DWORD;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool isMemoryOperand(VMDecodedOperand const &operand) {
+    return operand.type == VMOPTYPE_POINTER || operand.type == VMOPTYPE_INDIRECT || operand.type == VMOPTYPE_DISPLACEMENT;
+}
+
+static bool isFloatLane(VMOperandSize size) {
+    return size == VMOPSIZE_DWORD || size == VMOPSIZE_QWORD;
+}
+
+static VMVerifyStatus verifyInstruction(VMProgram &program, VMDecodedInstruction const &inst) {
+    s32 count = getOperandCount(inst.opcode);
+    if (count < 0) return VMVERIFY_INVALID_OPERANDS;
+
+    VMDecodedOperand const *operands[] = { &inst.operand1, &inst.operand2, &inst.operand3 };
+    for (s32 i = 0; i < count; ++i) {
+        if (!isValidRegister(*operands[i])) return VMVERIFY_INVALID_REGISTER;
+    }
+
+    VMDecodedOperand const &op1 = inst.operand1;
+    VMDecodedOperand const &op2 = inst.operand2;
+    VMDecodedOperand const &op3 = inst.operand3;
+    VMOperandSize floatSize;
+
+    switch (inst.opcode) {
+        case VMOPCODE_MOV:
+            if (op2.type == VMOPTYPE_IMMEDIATE || op2.size < op1.size) return VMVERIFY_INVALID_OPERANDS;
+            if (!isValidJumpThroughIP(program, op1, op2)) return VMVERIFY_INVALID_TARGET;
+        break;
+        case VMOPCODE_POP:
+        case VMOPCODE_NEG:
+        case VMOPCODE_NOT:
+            if (op1.type == VMOPTYPE_IMMEDIATE) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_AND:
+        case VMOPCODE_OR:
+        case VMOPCODE_XOR:
+            if (op1.type == VMOPTYPE_IMMEDIATE || op1.size < op2.size || op2.size != op3.size) {
+                return VMVERIFY_INVALID_OPERANDS;
+            }
+        break;
+        case VMOPCODE_JMP:
+        case VMOPCODE_CALL:
+            if (!isValidTarget(program, op1)) return VMVERIFY_INVALID_TARGET;
+        break;
+        case VMOPCODE_JEQ:  case VMOPCODE_JNE:  case VMOPCODE_JGT:
+        case VMOPCODE_JLT:  case VMOPCODE_JGE:  case VMOPCODE_JLE:
+        case VMOPCODE_JGTS: case VMOPCODE_JLTS: case VMOPCODE_JGES: case VMOPCODE_JLES:
+            if (op2.size != op3.size) return VMVERIFY_INVALID_OPERANDS;
+            if (!isValidTarget(program, op1)) return VMVERIFY_INVALID_TARGET;
+        break;
+        case VMOPCODE_JEQF: case VMOPCODE_JNEF: case VMOPCODE_JGTF:
+        case VMOPCODE_JLTF: case VMOPCODE_JGEF: case VMOPCODE_JLEF:
+            if (!isFloatLane(op2.size) || op2.size != op3.size) return VMVERIFY_INVALID_OPERANDS;
+            if (!isValidTarget(program, op1)) return VMVERIFY_INVALID_TARGET;
+        break;
+        case VMOPCODE_ENTER:
+            // masks in registers or memory are checked at runtime
+            if (op1.type == VMOPTYPE_IMMEDIATE && getUnsigned(op1.size, program.constants[op1.value]) >> VMFRAME_REGISTERS) {
+                return VMVERIFY_INVALID_OPERANDS;
+            }
+        break;
+        case VMOPCODE_VLOAD:
+            if (!isMemoryOperand(op1)) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_VSTORE:
+            if (!isMemoryOperand(op2)) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_VSPLAT:
+        break;
+        case VMOPCODE_VEXTRACT:
+            if (op3.type == VMOPTYPE_IMMEDIATE || op3.size < op1.size) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_VSUM:
+        case VMOPCODE_VSUMS:
+            if (op2.type == VMOPTYPE_IMMEDIATE) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_VSUMF:
+            if (op2.type == VMOPTYPE_IMMEDIATE || !isFloatLane(op1.size) || op2.size != op1.size) {
+                return VMVERIFY_INVALID_OPERANDS;
+            }
+        break;
+        case VMOPCODE_VADD:   case VMOPCODE_VSUB:   case VMOPCODE_VMUL:
+        case VMOPCODE_VMIN:   case VMOPCODE_VMAX:   case VMOPCODE_VMINS:  case VMOPCODE_VMAXS:
+        case VMOPCODE_VCMPEQ: case VMOPCODE_VCMPGT: case VMOPCODE_VCMPGTS: case VMOPCODE_VSHUF:
+            if (op2.size != op1.size || op3.size != op1.size) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_VADDF:  case VMOPCODE_VSUBF:  case VMOPCODE_VMULF:
+        case VMOPCODE_VMINF:  case VMOPCODE_VMAXF:  case VMOPCODE_VCMPEQF: case VMOPCODE_VCMPGTF:
+            if (!isFloatLane(op1.size) || op2.size != op1.size || op3.size != op1.size) {
+                return VMVERIFY_INVALID_OPERANDS;
+            }
+        break;
+        case VMOPCODE_MCOPY:
+            if (!isMemoryOperand(op1) || !isMemoryOperand(op2)) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_MFILL:
+            if (!isMemoryOperand(op1)) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        case VMOPCODE_MCMP:
+            if (!isMemoryOperand(op1) || !isMemoryOperand(op2) || op3.type == VMOPTYPE_IMMEDIATE) {
+                return VMVERIFY_INVALID_OPERANDS;
+            }
+        break;
+        case VMOPCODE_MFIND:
+            if (!isMemoryOperand(op1) || op3.type == VMOPTYPE_IMMEDIATE) return VMVERIFY_INVALID_OPERANDS;
+        break;
+        default:
+            if (count != 3) break;
+
+            // the arithmetic families take their destination last
+            if (op3.type == VMOPTYPE_IMMEDIATE) return VMVERIFY_INVALID_OPERANDS;
+            if (isFloatOperation(inst.opcode, floatSize)) {
+                if (op1.size != floatSize || op2.size != floatSize || op3.size != floatSize) {
+                    return VMVERIFY_INVALID_OPERANDS;
+                }
+            } else if (op3.size < op1.size || op3.size < op2.size) {
+                return VMVERIFY_INVALID_OPERANDS;
+            }
+        break;
+    }
+
+    return VMVERIFY_OK;
+}
+
+VMVerifyResult verifyProgram(VMProgram &program) {
+    for (u64 i = 0; i < program.code.length(); ++i) {
+        VMVerifyStatus status = verifyInstruction(program, program.code[i]);
+        if (status != VMVERIFY_OK) return { status, i };
+    }
+
+    for (u64 i = 0; i < program.code.length(); ++i) {
+        VMDecodedInstruction &inst = program.code[i];
+        inst.handler = MetaVM::resolveHandler(inst, false);
+    }
+
+    // the unchecked engine has its own labels
+    program.linked = false;
+    program.verified = true;
+    return { VMVERIFY_OK, 0 };
+}
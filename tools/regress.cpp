@@ -0,0 +1,343 @@
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "assembler.hpp"
+#include "metavm.hpp"
+#include "snapshot.hpp"
+#include "arena.hpp"
+#include "pool.hpp"
+
+// regression programs for the engines, each is assembled, run once as
+// decoded and once verified, and its run status, last exception and r0
+// are compared with what's expected, prints the programs that differ and
+// exits with 1 if any did, the runs that need more than a program, forking
+// a snapshot or the allocators and the pool, come after the table
+//
+// usage: metavm-regress
+
+struct RegressionCase {
+    char const          *name;
+    char const        *source;
+    VMRunStatus        status;
+
+    // only compared for VMRUN_EXCEPTION
+    VMException     exception;
+
+    // r0 has to be in [minimum, maximum]
+    u64               minimum;
+    u64               maximum;
+
+    // what the run is given, the deadline in nanoseconds from its start
+    u64                budget;
+    u64              deadline;
+
+    // what verifyProgram returns, programs it rejects aren't run verified
+    VMVerifyStatus verification;
+};
+
+// a tenth of a second
+constexpr u64 REGRESS_DEADLINE = 100000000;
+
+static RegressionCase const cases[] = {
+    // writes to r31 outside the code raise instead of fetching past it
+    { "r31_out_of_code", "mov 1, r0\n mov 100000000, r1\n mov r1, r31\n hlt\n",
+      VMRUN_EXCEPTION, VMEXCEPT_INVALID_OPERANDS, 1, 1, VMRUN_UNLIMITED, VMRUN_NO_DEADLINE, VMVERIFY_OK },
+    { "r31_forward", "mov 3, r31\n mov 5, r0\n hlt\n mov 7, r0\n hlt\n",
+      VMRUN_HALTED, VMEXCEPT_UNEXPECTED_OPCODE, 7, 7, VMRUN_UNLIMITED, VMRUN_NO_DEADLINE, VMVERIFY_OK },
+    { "r31_immediate_out_of_code", "mov 1, r0\n mov 100000000, r31\n hlt\n",
+      VMRUN_EXCEPTION, VMEXCEPT_INVALID_OPERANDS, 1, 1, VMRUN_UNLIMITED, VMRUN_NO_DEADLINE, VMVERIFY_INVALID_TARGET },
+
+    // neg and not change their only operand in place
+    { "neg_not_in_place", "mov 5, r0\n neg r0\n not r0\n hlt\n",
+      VMRUN_HALTED, VMEXCEPT_UNEXPECTED_OPCODE, 4, 4, VMRUN_UNLIMITED, VMRUN_NO_DEADLINE, VMVERIFY_OK },
+
+    // the bits family only takes sources of one size
+    { "and_mixed_sources", "mov 1, r0\n and r2, r0, r1.d0\n hlt\n",
+      VMRUN_EXCEPTION, VMEXCEPT_INVALID_OPERANDS, 1, 1, VMRUN_UNLIMITED, VMRUN_NO_DEADLINE, VMVERIFY_INVALID_OPERANDS },
+
+    // endless loops are preempted whether they jump or write r31, a budget
+    // of 1000 is two instructions short of 500 rounds
+    { "budget_jmp", "loop: add r0, 1, r0\n jmp loop\n",
+      VMRUN_PREEMPTED, VMEXCEPT_UNEXPECTED_OPCODE, 499, 500, 1000, VMRUN_NO_DEADLINE, VMVERIFY_OK },
+    { "budget_r31", "loop: add r0, 1, r0\n mov 0, r31\n",
+      VMRUN_PREEMPTED, VMEXCEPT_UNEXPECTED_OPCODE, 499, 500, 1000, VMRUN_NO_DEADLINE, VMVERIFY_OK },
+    { "deadline_jmp", "loop: add r0, 1, r0\n jmp loop\n",
+      VMRUN_PREEMPTED, VMEXCEPT_UNEXPECTED_OPCODE, 1, ~0ull, VMRUN_UNLIMITED, REGRESS_DEADLINE, VMVERIFY_OK },
+    { "deadline_r31", "loop: add r0, 1, r0\n mov 0, r31\n",
+      VMRUN_PREEMPTED, VMEXCEPT_UNEXPECTED_OPCODE, 1, ~0ull, VMRUN_UNLIMITED, REGRESS_DEADLINE, VMVERIFY_OK },
+};
+
+static static_array<u8, KB(64)> stream {};
+static static_array<VMAssemblerSymbol, 256> symbols {};
+static static_array<char, KB(4)> names {};
+static static_array<VMAssemblerPatch, 256> patches {};
+static static_array<VMDecodedInstruction, KB(4) + 1> decoded {};
+static static_array<VMWord, KB(12)> constants {};
+static static_array<u8, KB(4)> vmMemory {};
+
+// assembles and decodes `source` into `program`, which uses the static tables
+// above and is valid until the next call
+static bool assemble(char const *name, char const *source, VMProgram &program) {
+    auto streamView = stream.view(0, stream.size());
+    auto symbolsView = symbols.view(0, symbols.size());
+    auto namesView = names.view(0, names.size());
+    auto patchesView = patches.arrayView();
+    VMAssembler assembler { streamView, symbolsView, namesView, patchesView };
+    VMAssembleStatus assembled = assembler.feed(source, std::strlen(source));
+    if (assembled == VMASSEMBLE_OK) assembled = assembler.finish();
+    if (assembled != VMASSEMBLE_OK) {
+        std::printf("%s: %s on line %llu\n", name, getAssembleStatusName(assembled), assembler.line());
+        return false;
+    }
+
+    VMDecodeStatus status = decodeBytecode(streamView, assembler.length(), program);
+    if (status != VMDECODE_OK) {
+        std::printf("%s: %s\n", name, getDecodeStatusName(status));
+        return false;
+    }
+    return true;
+}
+
+static bool runCase(RegressionCase const &test, bool verify) {
+    VMProgram program { decoded.arrayView(), constants.arrayView(), false, false };
+    if (!assemble(test.name, test.source, program)) return false;
+    if (verify) {
+        VMVerifyResult verification = verifyProgram(program);
+        if (verification.status != test.verification) {
+            std::printf("%s: %s at %llu\n", test.name, getVerifyStatusName(verification.status), verification.index);
+            return false;
+        }
+        if (verification.status != VMVERIFY_OK) return true;
+    }
+
+    static_array<VMException, 8> exceptions {};
+    std::memset(&vmMemory[0], 0, vmMemory.size());
+    auto memoryView = vmMemory.view(0, vmMemory.size());
+    auto exceptionsView = exceptions.arrayView();
+    MetaVM vm { program, memoryView, exceptionsView };
+    u64 deadline = test.deadline == VMRUN_NO_DEADLINE ? VMRUN_NO_DEADLINE : getMonotonicTime() + test.deadline;
+    VMRunStatus result = vm.run(test.budget, deadline);
+
+    u64 r0 = vm.getRegisters().data[0].u;
+    bool passed = result == test.status && r0 >= test.minimum && r0 <= test.maximum;
+    if (result == VMRUN_EXCEPTION) passed = passed && vm.getException().exception == test.exception;
+    if (!passed) {
+        std::printf("%s%s: %s %s, r0 %llu\n", test.name, verify ? " (verified)" : "", getRunStatusName(result),
+                    result == VMRUN_EXCEPTION ? getExceptionName(vm.getException().exception) : "", r0);
+    }
+    return passed;
+}
+
+// a VM preempted inside a frame is snapshotted, the fork has to leave the
+// frame and halt like the VM itself
+static bool runForkInFrame() {
+    char const *name = "fork_in_frame";
+    char const *source =
+        "call f\n hlt\n"
+        "f: enter 0, 0\n loop: add r0, 1, r0\n jlt loop, r0, 1000\n leave\n";
+    VMProgram program { decoded.arrayView(), constants.arrayView(), false, false };
+    if (!assemble(name, source, program)) return false;
+
+    static_array<VMException, 8> exceptions {};
+    std::memset(&vmMemory[0], 0, vmMemory.size());
+    auto memoryView = vmMemory.view(0, vmMemory.size());
+    auto exceptionsView = exceptions.arrayView();
+    MetaVM vm { program, memoryView, exceptionsView };
+    VMRunStatus result = vm.run(100);
+    if (result != VMRUN_PREEMPTED || vm.getFrameDepth() != 1) {
+        std::printf("%s: %s with %llu frames before the snapshot\n", name, getRunStatusName(result), vm.getFrameDepth());
+        return false;
+    }
+
+    VMSnapshot snapshot;
+    VMFork fork;
+    if (takeSnapshot(vm, memoryView, snapshot) != VMSNAPSHOT_OK || forkSnapshot(snapshot, fork) != VMSNAPSHOT_OK) {
+        std::printf("%s: no snapshot\n", name);
+        releaseSnapshot(snapshot);
+        return false;
+    }
+
+    static_array<VMException, 8> forkExceptions {};
+    auto forkExceptionsView = forkExceptions.arrayView();
+    MetaVM forked { program, fork.memory, forkExceptionsView };
+    forked.setRegisters(snapshot.registers, snapshot.frames, snapshot.frameDepth);
+
+    bool passed = true;
+    MetaVM *vms[] = { &vm, &forked };
+    for (MetaVM *current : vms) {
+        result = current->run();
+        u64 r0 = current->getRegisters().data[0].u;
+        if (result != VMRUN_HALTED || r0 != 1000) {
+            std::printf("%s%s: %s %s, r0 %llu\n", name, current == &forked ? " (fork)" : "", getRunStatusName(result),
+                        result == VMRUN_EXCEPTION ? getExceptionName(current->getException().exception) : "", r0);
+            passed = false;
+        }
+    }
+
+    releaseFork(fork);
+    releaseSnapshot(snapshot);
+    return passed;
+}
+
+static bool isZero(u8 const *memory, u64 size) {
+    for (u64 i = 0; i < size; ++i) {
+        if (memory[i] != 0) return false;
+    }
+    return true;
+}
+
+// what an arena hands out is zeroed, whether it was never touched, dirtied
+// before a reset or grown into by a reallocation
+static bool runArenaZeroing() {
+    char const *name = "arena_zeroing";
+    VMArena arena { KB(64) };
+    bool passed = arena.capacity() == KB(64);
+
+    u8 *first = (u8 *) arena.allocate(256);
+    passed = passed && first != nullptr && isZero(first, 256);
+    if (passed) std::memset(first, 0xff, 256);
+
+    arena.reset();
+    u8 *again = (u8 *) arena.allocate(128);
+    passed = passed && again == first && isZero(again, 128);
+    if (passed) std::memset(again, 0xff, 128);
+
+    // the most recent allocation grows in place over bytes dirtied before
+    // the reset, anything else is copied
+    u8 *grown = (u8 *) arena.reallocate(again, 128, 512);
+    passed = passed && grown == again && grown[127] == 0xff && isZero(grown + 128, 384);
+    u8 *other = (u8 *) arena.allocate(64);
+    u8 *moved = (u8 *) arena.reallocate(grown, 512, 1024);
+    passed = passed && other != nullptr && moved != nullptr && moved != grown && moved[0] == 0xff && isZero(moved + 512, 512);
+
+    // so is everything once the pages went back to the kernel
+    if (passed) std::memset(moved, 0xff, 1024);
+    arena.release();
+    u8 *released = (u8 *) arena.allocate(KB(4));
+    passed = passed && released == first && isZero(released, KB(4));
+
+    if (!passed) std::printf("%s: dirty or misplaced allocation\n", name);
+    return passed;
+}
+
+// images released to a pool come back zeroed to an acquire of the same class
+static bool runImageReuse() {
+    char const *name = "image_reuse";
+    VMImagePool images;
+    u8 *image = images.acquire(KB(6));
+    bool passed = image != nullptr && isZero(image, KB(6));
+    if (passed) std::memset(image, 0xff, KB(6));
+    images.release(image, KB(6));
+
+    u8 *reused = images.acquire(KB(5));
+    passed = passed && reused == image && isZero(reused, KB(8));
+    images.release(reused, KB(5));
+
+    // a size of another class doesn't take it
+    u8 *bigger = images.acquire(KB(16));
+    passed = passed && bigger != nullptr && bigger != image && isZero(bigger, KB(16));
+    images.release(bigger, KB(16));
+
+    if (!passed) std::printf("%s: image not reused or not zeroed\n", name);
+    return passed;
+}
+
+// jobs run on recycled images, each sees zeroed memory whatever the one
+// before it left there
+static bool runPoolJobs() {
+    char const *name = "pool_jobs";
+    char const *source = "mov [2048], r0\n add r0, 1, r1\n mov r1, [2048]\n hlt\n";
+    VMProgram program { decoded.arrayView(), constants.arrayView(), false, false };
+    if (!assemble(name, source, program)) return false;
+
+    VMPool pool { 2, KB(4) };
+    if (pool.workerCount() != 2) {
+        std::printf("%s: %llu workers\n", name, pool.workerCount());
+        return false;
+    }
+
+    bool passed = true;
+    for (u64 i = 0; i < 16; ++i) {
+        VMJobResult result = pool.submit(program).get();
+        if (result.registers.data[0].u != 0 || result.registers.data[1].u != 1 || result.exceptionCount != 0) {
+            std::printf("%s: job %llu read %llu\n", name, i, result.registers.data[0].u);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+static VMNativeStatus addNative(VMNativeCall &call) {
+    call.registers[0].u += call.registers[1].u;
+    return VMNATIVE_OK;
+}
+
+// jobs get their budget and deadline, their run status and exception, and
+// the natives attached to the pool
+static bool runPoolLimits() {
+    char const *name = "pool_limits";
+    VMPool pool { 2, KB(4) };
+    static_array<VMNative, 4> registry {};
+    auto registryView = registry.arrayView();
+    pool.attachNatives(&registryView);
+    memory_view<VMNativeRecord> noQueue {};
+    VMNatives natives { registryView, noQueue };
+    u64 add = natives.add(addNative);
+
+    bool passed = true;
+    VMProgram program { decoded.arrayView(), constants.arrayView(), false, false };
+    if (!assemble(name, "loop: add r0, 1, r0\n jmp loop\n", program)) return false;
+    VMJobResult budget = pool.submit(program, VMRegisters(), 0, 1000).get();
+    VMJobResult deadline = pool.submit(program, VMRegisters(), 0, VMRUN_UNLIMITED, getMonotonicTime() + REGRESS_DEADLINE).get();
+    if (budget.status != VMRUN_PREEMPTED || budget.registers.data[0].u < 499 || budget.registers.data[0].u > 500) {
+        std::printf("%s: budget %s, r0 %llu\n", name, getRunStatusName(budget.status), budget.registers.data[0].u);
+        passed = false;
+    }
+    if (deadline.status != VMRUN_PREEMPTED) {
+        std::printf("%s: deadline %s\n", name, getRunStatusName(deadline.status));
+        passed = false;
+    }
+
+    VMRegisters registers {};
+    registers.data[0].u = 40;
+    registers.data[1].u = 2;
+    VMProgram calls { decoded.arrayView(), constants.arrayView(), false, false };
+    char source[64];
+    std::snprintf(source, sizeof(source), "calln %llu\n hlt\n", add);
+    if (!assemble(name, source, calls)) return false;
+    VMJobResult native = pool.submit(calls, registers).get();
+    if (native.status != VMRUN_HALTED || native.registers.data[0].u != 42) {
+        std::printf("%s: native %s, r0 %llu\n", name, getRunStatusName(native.status), native.registers.data[0].u);
+        passed = false;
+    }
+
+    VMProgram raises { decoded.arrayView(), constants.arrayView(), false, false };
+    if (!assemble(name, "mov 1, r0\n mov 100000000, r1\n mov r1, r31\n hlt\n", raises)) return false;
+    VMJobResult exception = pool.submit(raises).get();
+    if (exception.status != VMRUN_EXCEPTION || exception.exception.exception != VMEXCEPT_INVALID_OPERANDS ||
+        exception.exception.address != 2 || exception.exception.operand != 1) {
+        std::printf("%s: exception %s %s at %llu\n", name, getRunStatusName(exception.status),
+                    getExceptionName(exception.exception.exception), exception.exception.address);
+        passed = false;
+    }
+    return passed;
+}
+
+int main() {
+    u64 failed = 0;
+    u64 count = sizeof(cases) / sizeof(cases[0]);
+    for (u64 i = 0; i < count; ++i) {
+        if (!runCase(cases[i], false)) failed++;
+        if (!runCase(cases[i], true)) failed++;
+    }
+
+    u64 runs = 2 * count;
+    bool (*const others[])() = { runForkInFrame, runArenaZeroing, runImageReuse, runPoolJobs, runPoolLimits };
+    for (auto other : others) {
+        if (!other()) failed++;
+        runs++;
+    }
+
+    std::printf("%llu of %llu runs failed\n", failed, runs);
+    return failed != 0;
+}
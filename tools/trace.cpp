@@ -0,0 +1,75 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "types.hpp"
+#include "trace.hpp"
+
+// offline decoder of the traces a build with -D METAVM_TRACE writes (see
+// trace.hpp), prints one line per record, or with --summary only how many
+// records of each opcode there were
+//
+// usage: metavm-trace <trace> [--summary]
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::printf("usage: %s <trace> [--summary]\n", argv[0]);
+        return 1;
+    }
+    bool summary = argc > 2 && std::strcmp(argv[2], "--summary") == 0;
+
+    int file = open(argv[1], O_RDONLY);
+    struct stat status;
+    if (file < 0 || fstat(file, &status) != 0) {
+        std::printf("failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    u64 length = status.st_size;
+    void *mapping = length != 0 ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0) : nullptr;
+    close(file);
+    if (mapping == MAP_FAILED) {
+        std::printf("failed to map %s\n", argv[1]);
+        return 1;
+    }
+    u8 const *data = (u8 const *) mapping;
+
+    // the decoder is large enough not to want it on the stack
+    static VMTraceDecoder decoder {};
+    u64 cursor = 0;
+    VMTraceStatus result = decoder.readHeader(data, length, cursor);
+
+    u64 records = 0;
+    u64 dropped = 0;
+    u64 opcodes[256] {};
+    VMTraceRecord record;
+    while (result == VMTRACE_OK && (result = decoder.next(data, length, cursor, record)) == VMTRACE_OK) {
+        records++;
+        dropped += record.dropped;
+        opcodes[record.opcode]++;
+        if (summary) continue;
+
+        if (record.dropped != 0) std::printf("... %llu dropped\n", record.dropped);
+        if (record.hasValue) {
+            std::printf("%llu %s %#llx\n", record.address, getOPCodeName((VMOPCode) record.opcode), record.value);
+        } else {
+            std::printf("%llu %s\n", record.address, getOPCodeName((VMOPCode) record.opcode));
+        }
+    }
+
+    if (summary) {
+        std::printf("%llu records, %llu dropped, %.2f bytes per record\n", records, dropped,
+            records ? (f64) (length - sizeof(VMTraceHeader)) / records : 0.0);
+        for (u64 opcode = 0; opcode < 256; ++opcode) {
+            if (opcodes[opcode] != 0) std::printf("%-16s %llu\n", getOPCodeName((VMOPCode) opcode), opcodes[opcode]);
+        }
+    }
+
+    if (mapping != nullptr) munmap(mapping, length);
+    if (result != VMTRACE_END) {
+        std::printf("failed to decode %s at byte %llu: %s\n", argv[1], cursor, getTraceStatusName(result));
+        return 1;
+    }
+    return 0;
+}